@@ -0,0 +1,295 @@
+/**
+ * @file bench.cpp
+ * @brief Microbenchmarks of the load, index build, query and write paths, on
+ * synthetic ledgers of several sizes
+ *
+ * Usage: munnybud_bench [--min-time seconds] [--filter text] [rows ...]
+ * The sizes default to 10k, 1M and 10M rows. Each benchmark repeats until it
+ * has run for the minimum time (0.5 seconds by default), and only those whose
+ * name or parameters contain the filter text are run. What munnybud itself
+ * prints is discarded, its errors go to stderr.
+ * Prints one tab-separated line per benchmark and size: benchmark, params,
+ * rows, runs, best seconds, median seconds, items per second at the best time.
+ */
+
+#include "expression.hpp"
+#include "indexmanager.hpp"
+#include "storage.hpp"
+#include "utils.hpp"
+#include "ledger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Runs past this many repetitions stop even under the minimum time.
+ */
+static const size_t MAX_RUNS = 1000;
+
+/**
+ * @brief Middle of the ledgers of makeLedger, the base date of the ranged queries.
+ */
+static const char* BASE_DATE = "2020-06-15";
+
+/**
+ * @struct
+ * @brief Command line of the benchmark.
+ */
+struct BenchOptions {
+    double minTime = 0.5;
+    std::string filter;
+    std::vector<size_t> sizes;
+};
+
+/**
+ * @brief Times a benchmark and prints its line, unless the filter excludes it.
+ * The setup runs before every repetition and is not timed.
+ *
+ * @param items work items of one run, for the throughput column
+ * @param maxRuns repetitions allowed at most
+ */
+static void measure(const BenchOptions& options, const std::string& name, const std::string& params, size_t rows,
+                    size_t items, const std::function<void()>& setup, const std::function<void()>& run,
+                    size_t maxRuns = MAX_RUNS) {
+    if (maxRuns == 0)
+        return;
+    if (!options.filter.empty() && name.find(options.filter) == std::string::npos &&
+        params.find(options.filter) == std::string::npos)
+        return;
+    std::vector<double> times;
+    const auto begin = std::chrono::steady_clock::now();
+    auto elapsed = [&]() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count(); };
+    // the setups count towards the minimum time, or a quick run after a slow setup would repeat MAX_RUNS times
+    while (times.size() < maxRuns && (times.empty() || elapsed() < options.minTime)) {
+        if (setup)
+            setup();
+        auto start = std::chrono::steady_clock::now();
+        run();
+        times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    double best = times.front();
+    double median = times[times.size() / 2];
+    std::cout << name << '\t' << (params.empty() ? "-" : params) << '\t' << rows << '\t' << times.size() << '\t'
+              << best << '\t' << median << '\t' << (best > 0 ? items / best : 0) << std::endl;
+}
+
+/**
+ * @brief Reads and parses the whole transaction file into json.
+ */
+static void benchLoad(const BenchOptions& options, const std::string& transactionFile, size_t rows) {
+    measure(options, "loadFile", "", rows, rows, nullptr, [&]() { StorageHandler::loadFile(transactionFile); });
+}
+
+/**
+ * @brief Builds each index from the parsed file, on a fresh index manager every
+ * run. The vocabularies are built over an index manager that already has the
+ * index they are drawn from, and count one item per build.
+ */
+static void benchIndexes(const BenchOptions& options, const DateBuckets& buckets, size_t rows) {
+    using Populate = void (IndexManager::*)(const DateBuckets&);
+    static const std::pair<const char*, Populate> builds[] = {
+        {"populateWalletIdx", &IndexManager::populateWalletIdx},
+        {"populateCategoryIndex", &IndexManager::populateCategoryIndex},
+        {"populateDateHash", &IndexManager::populateDateHash},
+        {"populateDateMap", &IndexManager::populateDateMap},
+        {"populateAmountIdx", &IndexManager::populateAmountIdx},
+        {"populateTextIdx", &IndexManager::populateTextIdx},
+        {"populateColumns", &IndexManager::populateColumns},
+        {"populateAllIdxs", &IndexManager::populateAllIdxs},
+    };
+    std::unique_ptr<IndexManager> indexes;
+    for (const auto& [name, populate] : builds) {
+        measure(options, name, "", rows, rows, [&]() { indexes = std::make_unique<IndexManager>(); },
+                [&]() { ((*indexes).*populate)(buckets); });
+    }
+
+    using PopulateVocab = void (IndexManager::*)();
+    static const std::pair<const char*, std::pair<Populate, PopulateVocab>> vocabularies[] = {
+        {"populateCategoryVocab", {&IndexManager::populateCategoryIndex, &IndexManager::populateCategoryVocab}},
+        {"populateWalletVocab", {&IndexManager::populateWalletIdx, &IndexManager::populateWalletVocab}},
+        {"populateTokenVocab", {&IndexManager::populateTextIdx, &IndexManager::populateTokenVocab}},
+    };
+    for (const auto& [name, steps] : vocabularies) {
+        const auto [source, vocabulary] = steps;
+        measure(options, name, "", rows, 1,
+                [&]() {
+                    indexes = std::make_unique<IndexManager>();
+                    ((*indexes).*source)(buckets);
+                },
+                [&]() { ((*indexes).*vocabulary)(); });
+    }
+}
+
+/**
+ * @brief Intersects postings of the wallet, category and date indexes, two and
+ * three at a time, with and without a tag mask over the columns.
+ */
+static void benchIntersection(const BenchOptions& options, const DateBuckets& buckets, size_t rows) {
+    IndexManager indexes;
+    indexes.populateAllIdxs(buckets);
+
+    std::unordered_set<TransactionId> month;
+    const std::string monthPrefix = std::string(BASE_DATE).substr(0, 8);
+    for (auto it = indexes.transactionsByDateMap->lower_bound(monthPrefix);
+         it != indexes.transactionsByDateMap->end() && it->first.compare(0, monthPrefix.size(), monthPrefix) == 0; it++)
+        month.insert(it->second.begin(), it->second.end());
+    auto postingsOf = [](const auto& index, const std::string& key) {
+        auto it = index.find(key);
+        return it == index.end() ? std::unordered_set<TransactionId>()
+                                 : std::unordered_set<TransactionId>(it->second.begin(), it->second.end());
+    };
+    const std::vector<std::unordered_set<TransactionId>> two = {postingsOf(*indexes.transactionsByWallet, "cash"),
+                                                                postingsOf(*indexes.transactionsByCategory, "food")};
+    std::vector<std::unordered_set<TransactionId>> three = two;
+    three.push_back(month);
+    const SelectionMask mask = indexes.tagMask({}, {0}, {});
+
+    auto postings = [](const std::vector<std::unordered_set<TransactionId>>& sets) {
+        size_t count = 0;
+        for (const auto& set : sets)
+            count += set.size();
+        return count;
+    };
+    measure(options, "setIntersection", "wallet,category", rows, postings(two), nullptr,
+            [&]() { indexes.setIntersection(two); });
+    measure(options, "setIntersection", "wallet,category,month", rows, postings(three), nullptr,
+            [&]() { indexes.setIntersection(three); });
+    measure(options, "setIntersection", "wallet,category mask=tag", rows, postings(two), nullptr,
+            [&]() { indexes.setIntersection(two, mask); });
+    measure(options, "setIntersection", "wallet,category,month mask=tag", rows, postings(three), nullptr,
+            [&]() { indexes.setIntersection(three, mask); });
+}
+
+/**
+ * @brief Runs 'view' queries over the loaded ledger: every date range (none,
+ * day, week, month) with every kind of filter, one at a time and combined.
+ * The indexes are built by an untimed query first.
+ */
+static void benchQueries(const BenchOptions& options, StorageHandler& storage, size_t rows) {
+    using Filter = std::pair<const char*, std::function<void(ViewQuery&)>>;
+    const std::vector<Filter> filters = {
+        {"none", [](ViewQuery&) {}},
+        {"wallet", [](ViewQuery& query) { query.wallet = "cash"; }},
+        {"category", [](ViewQuery& query) { query.category = "food"; }},
+        {"search", [](ViewQuery& query) { query.search = "taxi"; }},
+        {"amount",
+         [](ViewQuery& query) {
+             query.minAmount = -2000;
+             query.maxAmount = 2000;
+         }},
+        {"type", [](ViewQuery& query) { query.type = "income"; }},
+        {"weekday", [](ViewQuery& query) { query.weekdays = {6, 7}; }},
+        {"where", [](ViewQuery& query) { query.where = parseExpression("amount > 50000"); }},
+        {"tags", [](ViewQuery& query) { query.anyTags = {"work"}; }},
+        {"top", [](ViewQuery& query) { query.top = 10; }},
+        {"combined",
+         [](ViewQuery& query) {
+             query.wallet = "cash";
+             query.category = "food";
+             query.type = "expense";
+         }},
+    };
+    static const char* ranges[] = {"all", "day", "week", "month"};
+
+    TransactionGroups result;
+    ViewQuery warmup;
+    warmup.range = 0;
+    storage.retrieveTransactions(warmup, result);
+    for (int range = 0; range < 4; range++) {
+        for (const auto& [name, apply] : filters) {
+            ViewQuery query;
+            query.baseDate = BASE_DATE;
+            query.range = range;
+            apply(query);
+            measure(options, "retrieveTransactions", std::string("range=") + ranges[range] + " filter=" + name, rows,
+                    rows, [&]() { result.clear(); }, [&]() { storage.retrieveTransactions(query, result); });
+        }
+    }
+}
+
+/**
+ * @brief Stores transactions one commit at a time, then deletes them the same
+ * way, so the ledger ends as it started. An untimed store and delete first
+ * brings the file contents into the loaded data.
+ */
+static void benchWrites(const BenchOptions& options, StorageHandler& storage, size_t rows) {
+    auto makeTransaction = []() {
+        Transaction transaction(-1250, "food", "benchmark lunch", "cash");
+        transaction.date = BASE_DATE;
+        return transaction;
+    };
+    Transaction warmup = makeTransaction();
+    if (storage.storeTransaction(warmup) != 0 || storage.deleteTransaction(warmup.id) != 0) {
+        std::cerr << "Error: could not write the benchmark ledger." << std::endl;
+        return;
+    }
+
+    std::vector<TransactionId> stored;
+    measure(options, "storeTransaction", "", rows, 1, nullptr, [&]() {
+        Transaction transaction = makeTransaction();
+        if (storage.storeTransaction(transaction) == 0)
+            stored.push_back(transaction.id);
+    });
+    size_t next = 0;
+    measure(options, "deleteTransaction", "", rows, 1, nullptr,
+            [&]() { storage.deleteTransaction(stored[next++]); }, stored.size());
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            options.minTime = std::strtod(argv[++i], nullptr);
+        } else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else {
+            size_t rows = std::strtoull(argv[i], nullptr, 10);
+            if (rows == 0) {
+                std::cerr << "Usage: " << argv[0] << " [--min-time seconds] [--filter text] [rows ...]" << std::endl;
+                return 1;
+            }
+            options.sizes.push_back(rows);
+        }
+    }
+    if (options.sizes.empty())
+        options.sizes = {10000, 1000000, 10000000};
+
+    std::ostringstream discarded;
+    StreamRedirect quiet(discarded, std::cerr);
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "munnybud_bench";
+    std::cout << "benchmark\tparams\trows\truns\tbest_seconds\tmedian_seconds\titems_per_second" << std::endl;
+    for (size_t rows : options.sizes) {
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+        const std::string walletFile = (dir / "wallets.json").string();
+        const std::string transactionFile = (dir / "transactions.json").string();
+        std::ofstream(walletFile) << makeWallets();
+        std::ofstream(transactionFile) << makeLedger(rows);
+
+        benchLoad(options, transactionFile, rows);
+        {
+            json document = StorageHandler::loadFile(transactionFile);
+            const DateBuckets buckets = takeBuckets(document);
+            benchIndexes(options, buckets, rows);
+            benchIntersection(options, buckets, rows);
+        }
+        StorageHandler storage(walletFile, transactionFile);
+        benchQueries(options, storage, rows);
+        benchWrites(options, storage, rows);
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file ledger.hpp
+ * @brief Synthetic ledgers shared by the benchmarks
+ *
+ */
+
+#ifndef BENCH_LEDGER_HPP
+#define BENCH_LEDGER_HPP
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Wallet file listing the wallets of makeLedger, "default" first.
+ */
+inline std::string makeWallets() {
+    return "{\"default_wallet\": \"default\", \"wallets\": {\"default\": 0, \"cash\": 0, \"bank\": 0}}";
+}
+
+/**
+ * @brief Writes a ledger of the given number of transactions spread over the
+ * 3650 days from 2015-01-01, in the layout of the transaction file, with one
+ * bucket per calendar date. Categories, wallets and description words are
+ * drawn uniformly from small sets, and one transaction in four carries one of
+ * the tags "work", "trip" or "shared".
+ * The same number of rows always gives the same ledger.
+ */
+inline std::string makeLedger(size_t rows) {
+    static const char* categories[] = {"food", "rent", "fun", "food/groceries", "travel", "salary"};
+    static const char* walletNames[] = {"default", "cash", "bank"};
+    static const char* words[] = {"coffee", "lunch", "taxi", "market", "cinema", "flight", "books", "repair"};
+    std::mt19937 random(1);
+    std::map<int, std::vector<size_t>> byDay;
+    for (size_t id = 1; id <= rows; id++)
+        byDay[random() % 3650].push_back(id);
+
+    const std::chrono::sys_days first{std::chrono::year(2015) / 1 / 1};
+    std::string text = "{\"metadata\": {\"currentID\": " + std::to_string(rows) +
+                       ", \"tags\": [\"work\", \"trip\", \"shared\"]}, \"data\": {";
+    bool firstDay = true;
+    for (const auto& [day, ids] : byDay) {
+        const std::chrono::year_month_day ymd{first + std::chrono::days(day)};
+        char date[24];
+        std::snprintf(date, sizeof(date), "%04d-%02u-%02u", static_cast<int>(ymd.year()),
+                      static_cast<unsigned>(ymd.month()), static_cast<unsigned>(ymd.day()));
+        text += firstDay ? "\"" : ", \"";
+        text += date;
+        text += "\": [";
+        firstDay = false;
+        for (size_t i = 0; i < ids.size(); i++) {
+            int amount = static_cast<int>(random() % 100000 + 100) * (random() % 4 == 0 ? 1 : -1);
+            text += i == 0 ? "{" : ", {";
+            text += "\"id\": " + std::to_string(ids[i]) + ", \"amount\": " + std::to_string(amount) +
+                    ", \"category\": \"" + categories[random() % 6] + "\", \"description\": \"" +
+                    words[random() % 8] + " " + std::to_string(ids[i]) + "\", \"wallet\": \"" +
+                    walletNames[random() % 3] + "\"";
+            if (random() % 4 == 0)
+                text += ", \"tags\": [" + std::to_string(random() % 3) + "]";
+            text += "}";
+        }
+        text += "]";
+    }
+    text += "}}";
+    return text;
+}
+
+#endif
@@ -0,0 +1,98 @@
+/**
+ * @file scaling.cpp
+ * @brief Measures how the parallel parts of munnybud scale with the number of
+ * executor threads: chunked parsing, the index build and the stats aggregation
+ *
+ * Usage: munnybud_bench_scaling [rows] [max threads]
+ * Prints one tab-separated line per stage and thread count:
+ * stage, threads, seconds, speedup over one thread.
+ */
+
+#include "executor.hpp"
+#include "indexmanager.hpp"
+#include "loader.hpp"
+#include "storage.hpp"
+#include "ledger.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Best time of a few runs, in seconds.
+ */
+static double timeBest(const std::function<void()>& run) {
+    double best = 0;
+    for (int i = 0; i < 3; i++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (i == 0 || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    size_t rows = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t maxThreads = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : Executor::defaultThreads();
+    if (rows == 0 || maxThreads == 0) {
+        std::cerr << "Usage: " << argv[0] << " [rows] [max threads]" << std::endl;
+        return 1;
+    }
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "munnybud_bench_scaling";
+    std::filesystem::create_directories(dir);
+    const std::string walletFile = (dir / "wallets.json").string();
+    const std::string transactionFile = (dir / "transactions.json").string();
+    const std::string text = makeLedger(rows);
+    std::ofstream(walletFile) << makeWallets();
+    std::ofstream(transactionFile) << text;
+
+    std::vector<size_t> counts;
+    for (size_t threads = 1; threads < maxThreads; threads *= 2)
+        counts.push_back(threads);
+    counts.push_back(maxThreads);
+
+    std::map<std::string, double> single;
+    auto report = [&](const std::string& stage, size_t threads, double seconds) {
+        if (threads == 1)
+            single[stage] = seconds;
+        double speedup = single.count(stage) ? single[stage] / seconds : 0;
+        std::cout << stage << '\t' << threads << '\t' << seconds << '\t' << speedup << std::endl;
+    };
+
+    std::cout << "stage\tthreads\tseconds\tspeedup" << std::endl;
+    for (size_t threads : counts) {
+        Executor::configure(threads);
+
+        json document;
+        report("parse", threads, timeBest([&]() { document = parseChunked(text); }));
+
+        report("index", threads, timeBest([&]() {
+            IndexManager indexes;
+            indexes.populateAllIdxs(document);
+        }));
+
+        StorageHandler storage(walletFile, transactionFile);
+        ViewQuery query;
+        query.range = 0;
+        std::map<std::string, AmountHistogram> perCategory;
+        AmountHistogram overall;
+        storage.computeStats(query, false, true, perCategory, overall); // builds the indexes
+        report("stats", threads, timeBest([&]() {
+            perCategory.clear();
+            overall = AmountHistogram();
+            storage.computeStats(query, false, true, perCategory, overall);
+        }));
+    }
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
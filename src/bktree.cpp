@@ -0,0 +1,93 @@
+/**
+ * @file bktree.cpp
+ * @brief Implementation file for the BK-tree used for typo-tolerant lookups of
+ * categories, wallets and description words
+ *
+ */
+
+#include "bktree.hpp"
+#include <algorithm>
+#include <cstdlib>
+
+/**
+ * @brief Levenshtein distance between two words (insertions, deletions and
+ * substitutions all cost 1), computed with two rows of the usual DP table.
+ *
+ * @param a first word
+ * @param b second word
+ * @return int the edit distance
+ */
+int BKTree::editDistance(const std::string& a, const std::string& b) {
+    const std::string& shorter = a.size() < b.size() ? a : b;
+    const std::string& longer = a.size() < b.size() ? b : a;
+    std::vector<int> previous(shorter.size() + 1), current(shorter.size() + 1);
+    for (size_t j = 0; j <= shorter.size(); j++)
+        previous[j] = static_cast<int>(j);
+
+    for (size_t i = 1; i <= longer.size(); i++) {
+        current[0] = static_cast<int>(i);
+        for (size_t j = 1; j <= shorter.size(); j++) {
+            int substitution = previous[j - 1] + (longer[i - 1] != shorter[j - 1]);
+            current[j] = std::min({previous[j] + 1, current[j - 1] + 1, substitution});
+        }
+        previous.swap(current);
+    }
+    return previous[shorter.size()];
+}
+
+/**
+ * @brief Adds a word to the tree. Words already in the tree are ignored.
+ *
+ * @param word the word to add
+ */
+void BKTree::insert(const std::string& word) {
+    if (nodes.empty()) {
+        nodes.push_back({word, {}});
+        return;
+    }
+
+    size_t current = 0;
+    while (true) {
+        int distance = editDistance(word, nodes[current].word);
+        if (distance == 0)
+            return;
+        const auto& children = nodes[current].children;
+        auto it = std::find_if(children.begin(), children.end(),
+                               [distance](const std::pair<int, size_t>& child) { return child.first == distance; });
+        if (it == children.end()) {
+            nodes.mutate(current).children.emplace_back(distance, nodes.size());
+            nodes.push_back({word, {}});
+            return;
+        }
+        current = it->second;
+    }
+}
+
+/**
+ * @brief Finds every word within maxDistance edits of the given word.
+ *
+ * @param word the (possibly misspelled) word
+ * @param maxDistance maximum edit distance of a match
+ * @return std::vector<std::pair<int, std::string>> (distance, word) pairs,
+ * closest first and alphabetical among equal distances
+ */
+std::vector<std::pair<int, std::string>> BKTree::search(const std::string& word, int maxDistance) const {
+    std::vector<std::pair<int, std::string>> matches;
+    if (nodes.empty())
+        return matches;
+
+    std::vector<size_t> pending{0};
+    while (!pending.empty()) {
+        const Node& node = nodes[pending.back()];
+        pending.pop_back();
+        int distance = editDistance(word, node.word);
+        if (distance <= maxDistance)
+            matches.emplace_back(distance, node.word);
+        for (const auto& [edge, child] : node.children) {
+            if (std::abs(edge - distance) <= maxDistance)
+                pending.push_back(child);
+        }
+    }
+    std::sort(matches.begin(), matches.end());
+    return matches;
+}
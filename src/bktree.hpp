@@ -0,0 +1,44 @@
+/**
+ * @file bktree.hpp
+ * @brief Header file for the BK-tree used for typo-tolerant lookups of
+ * categories, wallets and description words
+ *
+ */
+
+#ifndef BKTREE_HPP
+#define BKTREE_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "chunked.hpp"
+
+/**
+* @class
+* @brief Burkhard-Keller tree over a vocabulary, keyed by edit distance.
+*
+* Every child edge is labelled with the distance between the child and its
+* parent, so a query with a maximum distance k only has to follow the edges
+* labelled [d - k, d + k], where d is the distance to the current node. This
+* skips most of the vocabulary for small k.
+* Nodes are stored in shared chunks, so a copy of the tree is cheap and an
+* insert into it only copies the chunks of the nodes it changes.
+*/
+class BKTree {
+public:
+    void insert(const std::string& word);
+    std::vector<std::pair<int, std::string>> search(const std::string& word, int maxDistance) const;
+    void clear() { nodes.clear(); }
+    bool empty() const { return nodes.empty(); }
+
+    static int editDistance(const std::string& a, const std::string& b);
+
+private:
+    struct Node {
+        std::string word;
+        std::vector<std::pair<int, size_t>> children; // (distance to this node, child index)
+    };
+    ChunkedVector<Node, 256> nodes;
+};
+
+#endif
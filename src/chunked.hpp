@@ -0,0 +1,566 @@
+/**
+ * @file chunked.hpp
+ * @brief Header file for the copy-on-write containers the indexes are made of,
+ * so that the versions of a ledger share everything a write did not touch
+ *
+ */
+
+#ifndef CHUNKED_HPP
+#define CHUNKED_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Rows per chunk of the columns, also the batch size of the filters.
+ */
+inline constexpr size_t ROWS_PER_CHUNK = 4096;
+
+/**
+* @class
+* @brief Value shared between copies until one of them writes to it.
+*
+* Reads go through the shared value. write() first gives the caller its own
+* copy if another version still refers to the value, so a copy of the owner
+* costs a reference count. Only one thread may write to a given owner (the
+* writers of a ledger are serialized), and shared values are never modified,
+* so readers of other versions need no locking.
+* An empty value is not allocated at all.
+*/
+template <typename T>
+class CopyOnWrite {
+public:
+    const T& operator*() const { return value ? *value : empty(); }
+    const T* operator->() const { return &**this; }
+
+    /**
+     * @brief The value for modification, copied first if it is shared.
+     */
+    T& write() {
+        if (!value)
+            value = std::make_shared<T>();
+        else if (value.use_count() > 1)
+            value = std::make_shared<T>(*value);
+        return *value;
+    }
+    void reset() { value.reset(); }
+
+    /**
+     * @brief Replaces the value, leaving the versions sharing the old one alone.
+     */
+    CopyOnWrite& operator=(T replacement) {
+        value = std::make_shared<T>(std::move(replacement));
+        return *this;
+    }
+
+private:
+    std::shared_ptr<T> value; // null while empty
+
+    static const T& empty() {
+        static const T instance;
+        return instance;
+    }
+};
+
+/**
+* @class
+* @brief Hash map split in a fixed number of copy-on-write shards, for maps
+* with many keys (the text index). A write copies only the shard of its key.
+*/
+template <typename Key, typename Value, size_t Shards = 1024>
+class ShardedMap {
+public:
+    using Map = std::unordered_map<Key, Value>;
+
+    /**
+     * @brief The value of a key, nullptr if the key is not in the map.
+     */
+    const Value* find(const Key& key) const {
+        const Map& shard = *shards[shardOf(key)];
+        auto it = shard.find(key);
+        return it == shard.end() ? nullptr : &it->second;
+    }
+
+    /**
+     * @brief The value of a key for modification, default constructed if the
+     * key is new. Copies the shard of the key if it is shared.
+     */
+    Value& write(const Key& key) { return shards[shardOf(key)].write()[key]; }
+
+    void erase(const Key& key) {
+        CopyOnWrite<Map>& shard = shards[shardOf(key)];
+        if (shard->count(key))
+            shard.write().erase(key);
+    }
+
+    void clear() {
+        for (CopyOnWrite<Map>& shard : shards)
+            shard.reset();
+    }
+
+    /**
+     * @brief Calls visit(key, value) for every entry, in no particular order.
+     */
+    template <typename Visit>
+    void forEach(Visit&& visit) const {
+        for (const CopyOnWrite<Map>& shard : shards) {
+            for (const auto& [key, value] : *shard)
+                visit(key, value);
+        }
+    }
+
+private:
+    std::array<CopyOnWrite<Map>, Shards> shards;
+
+    static size_t shardOf(const Key& key) {
+        // the hashes of small keys (trigrams) are the keys themselves, mix them first
+        return static_cast<size_t>((std::hash<Key>{}(key) * 0x9E3779B97F4A7C15ull) >> 32) % Shards;
+    }
+};
+
+/**
+* @class
+* @brief Vector stored in fixed-size chunks that copies share.
+*
+* Copying the vector copies one pointer per chunk. Appending copies only the
+* last chunk, and only if another copy still refers to it; mutate() does the
+* same for the chunk of the element. Every chunk is contiguous, so a run of
+* up to ChunkSize elements starting at a multiple of ChunkSize can be read
+* through a plain pointer. Chunks can also be borrowed from memory the vector
+* does not own (a mapped index segment), they are copied on the first write.
+*/
+template <typename T, size_t ChunkSize>
+class ChunkedVector {
+public:
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t i) const { return chunks[i / ChunkSize].data[i % ChunkSize]; }
+    const T& back() const { return (*this)[count - 1]; }
+
+    void push_back(const T& value) {
+        if (count % ChunkSize == 0)
+            chunks.emplace_back();
+        std::vector<T>& last = writable(chunks.size() - 1, count % ChunkSize);
+        last.push_back(value);
+        chunks.back().data = last.data();
+        count++;
+    }
+
+    /**
+     * @brief Appends n contiguous values.
+     */
+    void append(const T* values, size_t n) {
+        while (n > 0) {
+            if (count % ChunkSize == 0)
+                chunks.emplace_back();
+            const size_t used = count % ChunkSize;
+            const size_t take = std::min(n, ChunkSize - used);
+            std::vector<T>& last = writable(chunks.size() - 1, used);
+            last.insert(last.end(), values, values + take);
+            chunks.back().data = last.data();
+            count += take;
+            values += take;
+            n -= take;
+        }
+    }
+
+    /**
+     * @brief Appends n contiguous values without copying them: the chunks
+     * point into the values, and hold the owner to keep them alive. Copies
+     * them instead if the vector does not end on a chunk boundary.
+     */
+    void borrow(const T* values, size_t n, const std::shared_ptr<const void>& owner) {
+        if (count % ChunkSize != 0) {
+            append(values, n);
+            return;
+        }
+        for (size_t first = 0; first < n; first += ChunkSize)
+            chunks.push_back({nullptr, values + first, owner});
+        count += n;
+    }
+
+    /**
+     * @brief The element at i for modification, its chunk copied first if shared.
+     */
+    T& mutate(size_t i) {
+        const size_t chunk = i / ChunkSize;
+        const size_t used = chunk + 1 < chunks.size() ? ChunkSize : count - chunk * ChunkSize;
+        return writable(chunk, used)[i % ChunkSize];
+    }
+
+    void clear() {
+        chunks.clear();
+        count = 0;
+    }
+
+private:
+    struct Chunk {
+        std::shared_ptr<std::vector<T>> owned;
+        const T* data = nullptr;
+        std::shared_ptr<const void> borrowed; // owner of data when not owned
+    };
+    std::vector<Chunk> chunks;
+    size_t count = 0;
+
+    /**
+     * @brief The storage of a chunk holding its first `used` elements, replaced
+     * by a private copy if another vector shares it or it is borrowed.
+     */
+    std::vector<T>& writable(size_t chunk, size_t used) {
+        Chunk& target = chunks[chunk];
+        if (!target.owned || target.owned.use_count() > 1) {
+            auto copy = std::make_shared<std::vector<T>>();
+            copy->reserve(ChunkSize); // appends never move the elements
+            copy->assign(target.data, target.data + used);
+            target.owned = std::move(copy);
+            target.data = target.owned->data();
+            target.borrowed.reset();
+        }
+        return *target.owned;
+    }
+};
+
+/**
+* @class
+* @brief One variable-length list of values per row (tags, description bytes),
+* in chunks of ChunkSize rows that copies share like those of ChunkedVector.
+* Each chunk holds the values of its rows back to back and one offset more
+* than it has rows. The offsets of a borrowed chunk index into the values of
+* every chunk borrowed with it, so they need not start at 0.
+*/
+template <typename T, size_t ChunkSize>
+class ChunkedLists {
+public:
+    size_t size() const { return count; }
+
+    std::span<const T> operator[](size_t i) const {
+        const Chunk& chunk = chunks[i / ChunkSize];
+        const size_t row = i % ChunkSize;
+        return {chunk.values + chunk.offsets[row], static_cast<size_t>(chunk.offsets[row + 1] - chunk.offsets[row])};
+    }
+
+    void push_back(const T* values, size_t n) {
+        if (count % ChunkSize == 0)
+            chunks.emplace_back();
+        Lists& last = writable(chunks.size() - 1, count % ChunkSize);
+        last.values.insert(last.values.end(), values, values + n);
+        last.offsets.push_back(last.values.size());
+        chunks.back().offsets = last.offsets.data();
+        chunks.back().values = last.values.data();
+        count++;
+    }
+
+    /**
+     * @brief Appends n lists without copying them, like ChunkedVector::borrow.
+     *
+     * @param offsets n + 1 offsets into values, list i spanning [offsets[i], offsets[i + 1])
+     */
+    void borrow(const std::uint64_t* offsets, const T* values, size_t n, const std::shared_ptr<const void>& owner) {
+        if (count % ChunkSize != 0) {
+            for (size_t i = 0; i < n; i++)
+                push_back(values + offsets[i], static_cast<size_t>(offsets[i + 1] - offsets[i]));
+            return;
+        }
+        for (size_t first = 0; first < n; first += ChunkSize)
+            chunks.push_back({nullptr, offsets + first, values, owner});
+        count += n;
+    }
+
+    void clear() {
+        chunks.clear();
+        count = 0;
+    }
+
+private:
+    struct Lists {
+        std::vector<std::uint64_t> offsets{0};
+        std::vector<T> values;
+    };
+    struct Chunk {
+        std::shared_ptr<Lists> owned;
+        const std::uint64_t* offsets = nullptr;
+        const T* values = nullptr;
+        std::shared_ptr<const void> borrowed; // owner of offsets and values when not owned
+    };
+    std::vector<Chunk> chunks;
+    size_t count = 0;
+
+    Lists& writable(size_t chunk, size_t used) {
+        Chunk& target = chunks[chunk];
+        if (!target.owned || target.owned.use_count() > 1) {
+            auto copy = std::make_shared<Lists>();
+            copy->offsets.reserve(ChunkSize + 1);
+            if (used > 0) {
+                const std::uint64_t base = target.offsets[0];
+                for (size_t row = 1; row <= used; row++)
+                    copy->offsets.push_back(target.offsets[row] - base);
+                copy->values.assign(target.values + base, target.values + target.offsets[used]);
+            }
+            target.owned = std::move(copy);
+            target.offsets = target.owned->offsets.data();
+            target.values = target.owned->values.data();
+            target.borrowed.reset();
+        }
+        return *target.owned;
+    }
+};
+
+/**
+* @class
+* @brief Sorted sequence (the postings of an index key, the amount index)
+* stored in chunks of at most ChunkSize values that copies share.
+*
+* An insert or erase copies only the chunk it lands in, and only if that
+* chunk is shared or borrowed; a chunk that grows past ChunkSize is split in
+* two. The iterators are random access, so the standard binary searches and
+* merges work on it as on a sorted vector.
+*/
+template <typename T, size_t ChunkSize = ROWS_PER_CHUNK>
+class SortedChunks {
+    struct Chunk {
+        std::shared_ptr<std::vector<T>> owned;
+        const T* data = nullptr;
+        size_t count = 0;
+        std::shared_ptr<const void> borrowed; // owner of data when not owned
+    };
+
+public:
+    class const_iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator() = default;
+
+        reference operator*() const { return list->chunks[chunk].data[offset]; }
+        pointer operator->() const { return &**this; }
+        reference operator[](difference_type n) const { return *(*this + n); }
+
+        const_iterator& operator++() {
+            if (++offset == list->chunks[chunk].count) {
+                chunk++;
+                offset = 0;
+            }
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator old = *this;
+            ++*this;
+            return old;
+        }
+        const_iterator& operator--() {
+            if (offset == 0)
+                offset = list->chunks[--chunk].count;
+            offset--;
+            return *this;
+        }
+        const_iterator operator--(int) {
+            const_iterator old = *this;
+            --*this;
+            return old;
+        }
+        const_iterator& operator+=(difference_type n) { return *this = list->at(position() + n); }
+        const_iterator& operator-=(difference_type n) { return *this = list->at(position() - n); }
+        friend const_iterator operator+(const_iterator it, difference_type n) { return it += n; }
+        friend const_iterator operator+(difference_type n, const_iterator it) { return it += n; }
+        friend const_iterator operator-(const_iterator it, difference_type n) { return it -= n; }
+        difference_type operator-(const const_iterator& other) const { return position() - other.position(); }
+
+        bool operator==(const const_iterator& other) const { return chunk == other.chunk && offset == other.offset; }
+        auto operator<=>(const const_iterator& other) const { return position() <=> other.position(); }
+
+    private:
+        friend class SortedChunks;
+        const SortedChunks* list = nullptr;
+        size_t chunk = 0;
+        size_t offset = 0;
+
+        const_iterator(const SortedChunks* list, size_t chunk, size_t offset)
+            : list(list), chunk(chunk), offset(offset) {}
+
+        difference_type position() const {
+            return static_cast<difference_type>(chunk < list->chunks.size() ? list->starts[chunk] + offset
+                                                                            : list->total);
+        }
+    };
+
+    size_t size() const { return total; }
+    bool empty() const { return total == 0; }
+    const_iterator begin() const { return {this, 0, 0}; }
+    const_iterator end() const { return {this, chunks.size(), 0}; }
+
+    /**
+     * @brief First value not less than the given one.
+     */
+    const_iterator lower_bound(const T& value) const {
+        auto chunk = std::partition_point(chunks.begin(), chunks.end(),
+                                          [&value](const Chunk& c) { return c.data[c.count - 1] < value; });
+        if (chunk == chunks.end())
+            return end();
+        return {this, static_cast<size_t>(chunk - chunks.begin()),
+                static_cast<size_t>(std::lower_bound(chunk->data, chunk->data + chunk->count, value) - chunk->data)};
+    }
+
+    /**
+     * @brief First value greater than the given one.
+     */
+    const_iterator upper_bound(const T& value) const {
+        auto chunk = std::partition_point(chunks.begin(), chunks.end(),
+                                          [&value](const Chunk& c) { return !(value < c.data[c.count - 1]); });
+        if (chunk == chunks.end())
+            return end();
+        return {this, static_cast<size_t>(chunk - chunks.begin()),
+                static_cast<size_t>(std::upper_bound(chunk->data, chunk->data + chunk->count, value) - chunk->data)};
+    }
+
+    bool contains(const T& value) const {
+        const_iterator it = lower_bound(value);
+        return it != end() && !(value < *it);
+    }
+
+    /**
+     * @brief Inserts a value after the equal ones already there.
+     */
+    void insert(const T& value) {
+        size_t chunk = upper_bound(value).chunk;
+        if (chunk == chunks.size()) {
+            // past the last value: fill the last chunk, then start a new one
+            if (chunks.empty() || chunks.back().count >= ChunkSize) {
+                chunks.emplace_back();
+                starts.push_back(total);
+            }
+            chunk = chunks.size() - 1;
+        }
+        std::vector<T>& values = writable(chunk);
+        values.insert(std::upper_bound(values.begin(), values.end(), value), value);
+        sync(chunk);
+        total++;
+        if (values.size() > ChunkSize)
+            split(chunk);
+        restart(chunk + 1);
+    }
+
+    /**
+     * @brief Removes one value equal to the given one.
+     *
+     * @return bool false if there was none
+     */
+    bool erase(const T& value) {
+        const_iterator it = lower_bound(value);
+        if (it == end() || value < *it)
+            return false;
+        std::vector<T>& values = writable(it.chunk);
+        values.erase(values.begin() + static_cast<std::ptrdiff_t>(it.offset));
+        total--;
+        if (values.empty()) {
+            chunks.erase(chunks.begin() + static_cast<std::ptrdiff_t>(it.chunk));
+            starts.erase(starts.begin() + static_cast<std::ptrdiff_t>(it.chunk));
+        } else {
+            sync(it.chunk);
+        }
+        restart(it.chunk);
+        return true;
+    }
+
+    /**
+     * @brief Replaces the contents by already sorted values.
+     */
+    void assign(const T* values, size_t n) {
+        clear();
+        for (size_t first = 0; first < n; first += ChunkSize) {
+            const size_t take = std::min(ChunkSize, n - first);
+            Chunk& chunk = chunks.emplace_back();
+            chunk.owned = std::make_shared<std::vector<T>>(values + first, values + first + take);
+            starts.push_back(first);
+            sync(chunks.size() - 1);
+        }
+        total = n;
+    }
+    void assign(const std::vector<T>& values) { assign(values.data(), values.size()); }
+
+    /**
+     * @brief Replaces the contents by already sorted values without copying
+     * them, like ChunkedVector::borrow.
+     */
+    void borrow(const T* values, size_t n, const std::shared_ptr<const void>& owner) {
+        clear();
+        for (size_t first = 0; first < n; first += ChunkSize) {
+            chunks.push_back({nullptr, values + first, std::min(ChunkSize, n - first), owner});
+            starts.push_back(first);
+        }
+        total = n;
+    }
+
+    void clear() {
+        chunks.clear();
+        starts.clear();
+        total = 0;
+    }
+
+private:
+    std::vector<Chunk> chunks;
+    std::vector<size_t> starts; // position of the first value of each chunk
+    size_t total = 0;
+
+    const_iterator at(std::ptrdiff_t position) const {
+        if (static_cast<size_t>(position) >= total)
+            return end();
+        const size_t chunk =
+            static_cast<size_t>(std::upper_bound(starts.begin(), starts.end(), static_cast<size_t>(position)) -
+                                starts.begin()) - 1;
+        return {this, chunk, static_cast<size_t>(position) - starts[chunk]};
+    }
+
+    std::vector<T>& writable(size_t chunk) {
+        Chunk& target = chunks[chunk];
+        if (!target.owned || target.owned.use_count() > 1) {
+            auto copy = std::make_shared<std::vector<T>>();
+            copy->reserve(ChunkSize + 1);
+            copy->assign(target.data, target.data + target.count);
+            target.owned = std::move(copy);
+            target.borrowed.reset();
+        }
+        return *target.owned;
+    }
+
+    void sync(size_t chunk) {
+        chunks[chunk].data = chunks[chunk].owned->data();
+        chunks[chunk].count = chunks[chunk].owned->size();
+    }
+
+    void split(size_t chunk) {
+        std::vector<T>& values = *chunks[chunk].owned;
+        const size_t half = values.size() / 2;
+        Chunk upper;
+        upper.owned = std::make_shared<std::vector<T>>(values.begin() + static_cast<std::ptrdiff_t>(half), values.end());
+        values.erase(values.begin() + static_cast<std::ptrdiff_t>(half), values.end());
+        sync(chunk);
+        chunks.insert(chunks.begin() + static_cast<std::ptrdiff_t>(chunk) + 1, std::move(upper));
+        starts.insert(starts.begin() + static_cast<std::ptrdiff_t>(chunk) + 1, 0);
+        sync(chunk + 1);
+    }
+
+    /**
+     * @brief Recomputes the start positions from the given chunk on.
+     */
+    void restart(size_t chunk) {
+        for (size_t c = std::max<size_t>(chunk, 1); c < chunks.size(); c++)
+            starts[c] = starts[c - 1] + chunks[c - 1].count;
+        if (!chunks.empty())
+            starts[0] = 0;
+    }
+};
+
+#endif
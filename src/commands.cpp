@@ -1,6 +1,13 @@
 #include "commands.hpp"
+#include "executor.hpp"
 #include "utils.hpp"
 #include "interface.hpp"
+#include "server.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <limits>
+#include <optional>
 #include <ostream>
 
 void setupAddCmd(argparse::ArgumentParser& add_cmd) {
@@ -32,6 +39,11 @@ void setupAddCmd(argparse::ArgumentParser& add_cmd) {
     add_cmd.add_argument("-w", "--wallet")
         .help("Wallet to charge expense from")
         .default_value(std::string("default"));
+
+    add_cmd.add_argument("-t", "--tag")
+        .help("Tag to attach to the transaction (e.g. reimbursable). Can be repeated")
+        .append()
+        .default_value(std::vector<std::string>());
     return;
 }
 
@@ -41,7 +53,7 @@ void setupViewCmd(argparse::ArgumentParser& view_cmd) {
         .default_value(std::string("")); // this will get replaced with the current date if no other filters are used
 
     view_cmd.add_argument("-r", "--range")
-        .help("The range in days of the transactions to show. 1 will show the base day only, 2 will show week, 3 will show month")
+        .help("The range in days of the transactions to show. 1 will show the base day only, 2 will show week, 3 will show month, 0 will show all dates")
         .default_value(1)
         .scan<'i', int>();
 
@@ -53,28 +65,133 @@ void setupViewCmd(argparse::ArgumentParser& view_cmd) {
         .help("Use this to filter results by a certain wallet")
         .default_value(std::string(""));
 
+    view_cmd.add_argument("-f", "--search")
+        .help("Use this to only show transactions whose label contains this text (case-insensitive)")
+        .default_value(std::string(""));
+
+    view_cmd.add_argument("--min")
+        .help("Use this to only show transactions with an amount (in cents) of at least this value. Expenses are negative")
+        .scan<'i', int>();
+
+    view_cmd.add_argument("--max")
+        .help("Use this to only show transactions with an amount (in cents) of at most this value. Expenses are negative")
+        .scan<'i', int>();
+
+    view_cmd.add_argument("--type")
+        .help("Use this to only show expenses or incomes")
+        .default_value(std::string(""))
+        .action([](const std::string& type) {
+                if (type != "expense" && type != "income") {
+                    throw std::invalid_argument("Invalid type: must be 'expense' or 'income'");
+                }
+                return type;
+        });
+
+    view_cmd.add_argument("--weekday")
+        .help("Use this to only show transactions made on certain days of the week (mon, tue, wed, thu, fri, sat, sun). Can be repeated")
+        .append()
+        .default_value(std::vector<std::string>());
+
+    view_cmd.add_argument("--tag")
+        .help("Use this to only show transactions with this tag. Can be repeated, all of them are required")
+        .append()
+        .default_value(std::vector<std::string>());
+
+    view_cmd.add_argument("--any-tag")
+        .help("Use this to only show transactions with at least one of these tags. Can be repeated")
+        .append()
+        .default_value(std::vector<std::string>());
+
+    view_cmd.add_argument("--no-tag")
+        .help("Use this to hide transactions with this tag. Can be repeated")
+        .append()
+        .default_value(std::vector<std::string>());
+
+    view_cmd.add_argument("--where")
+        .help("Filter expression, e.g. \"amount < -5000 and category in (food, rent) and not wallet = cash\". "
+              "Fields: amount (cents), date, weekday, category, wallet, id, length (of the label), type (expense/income)")
+        .default_value(std::string(""));
+
     view_cmd.add_argument("-g", "--group")
-        .help("Use this to group the results. They are grouped by date by default, but you can also group by category or wallet")
+        .help("Use this to group the results. They are grouped by date by default, but you can also group by category or wallet, or use none for a flat list")
         .default_value(std::string("date"))
         .action([](const std::string& groupBy) {
-                if (groupBy != "date" && groupBy != "category" && groupBy != "wallet") {
-                    throw std::invalid_argument("Invalid groupBy: must be 'date', 'wallet' or 'category'");
+                if (groupBy != "date" && groupBy != "category" && groupBy != "wallet" && groupBy != "none") {
+                    throw std::invalid_argument("Invalid groupBy: must be 'date', 'wallet', 'category' or 'none'");
                 }
                 return groupBy;
         });
 
+    view_cmd.add_argument("-s", "--sort")
+        .help("Use this to sort the transactions inside each group by date, amount, size (absolute amount), id or category")
+        .default_value(std::string("id"))
+        .action([](const std::string& sortBy) {
+                if (sortBy != "date" && sortBy != "amount" && sortBy != "size" && sortBy != "id" && sortBy != "category") {
+                    throw std::invalid_argument("Invalid sort: must be 'date', 'amount', 'size', 'id' or 'category'");
+                }
+                return sortBy;
+        });
+
+    view_cmd.add_argument("--desc")
+        .help("Sort in descending order")
+        .flag();
+
+    view_cmd.add_argument("-t", "--top")
+        .help("Only show the N biggest transactions (by absolute amount). Sorted by size unless --sort is given")
+        .default_value(0)
+        .scan<'i', int>();
+
+    view_cmd.add_argument("--by")
+        .help("Use with --top to pick the N biggest transactions of each category or wallet")
+        .default_value(std::string(""))
+        .action([](const std::string& topBy) {
+                if (topBy != "category" && topBy != "wallet") {
+                    throw std::invalid_argument("Invalid by: must be 'category' or 'wallet'");
+                }
+                return topBy;
+        });
+
+    return;
+}
+
+void setupStatsCmd(argparse::ArgumentParser& stats_cmd) {
+    stats_cmd.add_argument("-d", "--date")
+        .help("The base date of the transactions to summarize.")
+        .default_value(std::string(""));
+
+    stats_cmd.add_argument("-r", "--range")
+        .help("The range of the transactions to summarize. 1 is the base day only, 2 is week, 3 is month, 0 (default) is all dates")
+        .default_value(0)
+        .scan<'i', int>();
+
+    stats_cmd.add_argument("-c", "--category")
+        .help("Use this to only summarize a certain category.")
+        .default_value(std::string(""));
+
+    stats_cmd.add_argument("-w", "--wallet")
+        .help("Use this to only summarize a certain wallet")
+        .default_value(std::string(""));
+
+    stats_cmd.add_argument("-i", "--income")
+        .help("Summarize incomes instead of expenses")
+        .flag();
+
+    stats_cmd.add_argument("--tree")
+        .help("Show categories as a tree (food/groceries under food), with the amounts of subcategories rolled up into their parents")
+        .flag();
+
     return;
 }
 
 int handleSetupCmd() {
-    std::cout << "Seting up wallets..." << std::endl;
+    outStream() << "Seting up wallets..." << std::endl;
     if (StorageHandler::setupWallets("../wallets.json") != 0)
         return -1;
-    std::cout << "Done!" << std::endl;
-    std::cout << "Setting up transaction file..." << std::endl;
+    outStream() << "Done!" << std::endl;
+    outStream() << "Setting up transaction file..." << std::endl;
     if (StorageHandler::setupTransactions("../transactions.json") != 0)
         return -1;
-    std::cout << "Done!" << std::endl;
+    outStream() << "Done!" << std::endl;
     return 0;
 }
 
@@ -86,63 +203,277 @@ int handleAddCmd(argparse::ArgumentParser& add_cmd, StorageHandler& storageHandl
     std::string label = add_cmd.get<std::string>("--label");
     std::string date = add_cmd.get<std::string>("--date");
     std::string wallet = add_cmd.get<std::string>("--wallet");
+    std::vector<std::string> tags = add_cmd.get<std::vector<std::string>>("--tag");
     if (transaction == "expense") {
         Transaction tx(-amount, category, label, wallet);
         tx.date = date;
-        if (storageHandler.storeTransaction(tx) < 0)
+        if (storageHandler.storeTransaction(tx, tags) < 0)
             return -1;
     } else {
         Transaction tx(amount, category, label, wallet);
         tx.date = date;
-        if (storageHandler.storeTransaction(tx) < 0)
+        if (storageHandler.storeTransaction(tx, tags) < 0)
             return -1;
     }
 
-    std::cout << "Amount: " << amount << std::endl;
-    std::cout << "Transaction stored!\n";
+    outStream() << "Amount: " << amount << std::endl;
+    outStream() << "Transaction stored!\n";
+    return 0;
+}
+
+/**
+ * @brief Reads the filters and ordering of a 'view' command line into a query.
+ *
+ * @return int -1 on an invalid argument, 0 on success
+ */
+static int readViewQuery(argparse::ArgumentParser& view_cmd, ViewQuery& query) {
+    query.baseDate = view_cmd.get<std::string>("--date");
+    query.range = view_cmd.get<int>("--range");
+    query.wallet = view_cmd.get<std::string>("--wallet");
+    query.category = view_cmd.get<std::string>("--category");
+    query.search = view_cmd.get<std::string>("--search");
+    query.minAmount = view_cmd.present<int>("--min");
+    query.maxAmount = view_cmd.present<int>("--max");
+    query.type = view_cmd.get<std::string>("--type");
+    for (const std::string& weekday : view_cmd.get<std::vector<std::string>>("--weekday")) {
+        int isoWeekday = parseWeekday(weekday);
+        if (isoWeekday == 0) {
+            errStream() << "Invalid weekday: " << weekday << "\n";
+            return -1;
+        }
+        query.weekdays.push_back(isoWeekday);
+    }
+    query.allTags = view_cmd.get<std::vector<std::string>>("--tag");
+    query.anyTags = view_cmd.get<std::vector<std::string>>("--any-tag");
+    query.noTags = view_cmd.get<std::vector<std::string>>("--no-tag");
+    std::string where = view_cmd.get<std::string>("--where");
+    if (!where.empty()) {
+        try {
+            query.where = parseExpression(where);
+        } catch (const std::invalid_argument& err) {
+            errStream() << err.what() << std::endl;
+            return -1;
+        }
+    }
+    query.groupBy = view_cmd.get<std::string>("--group");
+    query.sortBy = view_cmd.get<std::string>("--sort");
+    query.descending = view_cmd.get<bool>("--desc");
+    query.top = view_cmd.get<int>("--top");
+    query.topBy = view_cmd.get<std::string>("--by");
+    if (query.top < 0) {
+        errStream() << "Invalid top: must be a positive number\n";
+        return -1;
+    }
+    if (query.top > 0) {
+        if (!query.topBy.empty())
+            query.groupBy = query.topBy;
+        else if (!view_cmd.is_used("--group"))
+            query.groupBy = "none";
+        if (!view_cmd.is_used("--sort")) {
+            query.sortBy = "size";
+            query.descending = true;
+        }
+    }
     return 0;
 }
 
 int handleViewCmd(argparse::ArgumentParser& view_cmd, StorageHandler& storageHandler) {
-    std::string date = view_cmd.get<std::string>("--date");
-    int rng = view_cmd.get<int>("--range");
-    std::string wallet = view_cmd.get<std::string>("--wallet");
-    std::string category = view_cmd.get<std::string>("--category");
-    std::string groupBy = view_cmd.get<std::string>("--group");
-    std::unordered_map<std::string, std::vector<Transaction>> result;
-
-    if (storageHandler.retrieveTransactions(date, rng, wallet, category, result, groupBy) < 0)   {
-        std::cout << "No expenses made in specified range.\n";
+    ViewQuery query;
+    if (readViewQuery(view_cmd, query) < 0)
         return -1;
+    // flat lists are streamed, so rows are printed as soon as they are found
+    if (query.groupBy == "none") {
+        try {
+            Generator<const Transaction*> rows = storageHandler.streamTransactions(query);
+            if (printStream(rows, storageHandler.getTagNames()) == 0) {
+                outStream() << "No expenses made in specified range.\n";
+                return -1;
+            }
+        } catch (const std::invalid_argument& err) {
+            errStream() << err.what() << std::endl;
+            return -1;
+        }
+        return 0;
     }
 
-    printResultsGrouped(groupBy, result);
+    TransactionGroups result;
+
+    try {
+        if (storageHandler.retrieveTransactions(query, result) < 0)   {
+            outStream() << "No expenses made in specified range.\n";
+            return -1;
+        }
+    } catch (const std::invalid_argument& err) {
+        errStream() << err.what() << std::endl;
+        return -1;
+    }
+
+    printResultsGrouped(query.groupBy, result, storageHandler.getTagNames());
     return 0;
 }
 
-int handleQuickInput(int argc, char* argv[]) {
+/**
+ * @brief Runs a 'view' command over a ledger too big to load. Every listing is
+ * streamed, grouped ones included, since the rows come out of an external sort.
+ */
+int handleViewCmd(argparse::ArgumentParser& view_cmd, OutOfCoreLedger& ledger) {
+    ViewQuery query;
+    if (readViewQuery(view_cmd, query) < 0)
+        return -1;
+    try {
+        Generator<const Transaction*> rows = ledger.streamTransactions(query);
+        if (printStreamGrouped(query.groupBy, rows, ledger.getTagNames()) == 0) {
+            outStream() << "No expenses made in specified range.\n";
+            return -1;
+        }
+    } catch (const std::invalid_argument& err) {
+        errStream() << err.what() << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads the filters of a 'stats' command line into a query.
+ */
+static void readStatsQuery(argparse::ArgumentParser& stats_cmd, ViewQuery& query) {
+    query.baseDate = stats_cmd.get<std::string>("--date");
+    query.range = stats_cmd.get<int>("--range");
+    query.wallet = stats_cmd.get<std::string>("--wallet");
+    query.category = stats_cmd.get<std::string>("--category");
+}
+
+int handleStatsCmd(argparse::ArgumentParser& stats_cmd, StorageHandler& storageHandler) {
+    ViewQuery query;
+    readStatsQuery(stats_cmd, query);
+    bool income = stats_cmd.get<bool>("--income");
+    bool tree = stats_cmd.get<bool>("--tree");
+    std::map<std::string, AmountHistogram> perCategory;
+    AmountHistogram overall;
+
+    if (storageHandler.computeStats(query, income, tree, perCategory, overall) < 0) {
+        outStream() << (income ? "No incomes" : "No expenses") << " made in specified range.\n";
+        return -1;
+    }
+
+    printStats(income, tree, perCategory, overall);
+    return 0;
+}
+
+/**
+ * @brief Runs a 'stats' command over a ledger too big to load.
+ */
+int handleStatsCmd(argparse::ArgumentParser& stats_cmd, OutOfCoreLedger& ledger) {
+    ViewQuery query;
+    readStatsQuery(stats_cmd, query);
+    bool income = stats_cmd.get<bool>("--income");
+    bool tree = stats_cmd.get<bool>("--tree");
+    std::map<std::string, AmountHistogram> perCategory;
+    AmountHistogram overall;
+
+    if (ledger.computeStats(query, income, tree, perCategory, overall) < 0) {
+        outStream() << (income ? "No incomes" : "No expenses") << " made in specified range.\n";
+        return -1;
+    }
+
+    printStats(income, tree, perCategory, overall);
+    return 0;
+}
+
+/**
+ * @brief Parses a size in bytes, with an optional K, M or G suffix (powers of
+ * 1024), e.g. 512M.
+ *
+ * @return bool false if the text is not a size
+ */
+static bool parseByteSize(const std::string& text, size_t& bytes) {
+    size_t value = 0;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() || end == text.data())
+        return false;
+    std::string suffix(end, text.data() + text.size());
+    for (char& c : suffix)
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    if (!suffix.empty() && suffix.back() == 'B' && suffix.size() <= 2)
+        suffix.pop_back();
+    int shift = 0;
+    if (suffix == "K")
+        shift = 10;
+    else if (suffix == "M")
+        shift = 20;
+    else if (suffix == "G")
+        shift = 30;
+    else if (!suffix.empty())
+        return false;
+    if (value > (std::numeric_limits<size_t>::max() >> shift))
+        return false;
+    bytes = value << shift;
+    return true;
+}
+
+/**
+ * @brief Whether the command line asks for help or the version, which argparse
+ * answers by itself.
+ */
+static bool isHelpRequest(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help" || arg == "-v" || arg == "--version")
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Parses and runs one command line.
+ *
+ * @param argc argument count
+ * @param argv arguments, argv[0] being the program name
+ * @param sharedStorage the ledger kept loaded by the server, or nullptr to load
+ * it for this command only
+ * @return int -1 on error, 0 on success
+ */
+int runCommand(int argc, char* argv[], StorageHandler* sharedStorage) {
+    // --help/--version must not exit the server
+    const bool exitOnHelp = sharedStorage == nullptr;
+    const auto defaults = argparse::default_arguments::all;
+
     // program root command
-    argparse::ArgumentParser program("munnybud");
+    argparse::ArgumentParser program("munnybud", "1.0", defaults, exitOnHelp);
+    program.add_argument("-j", "--threads")
+        .help("Threads used to load, index and query (default: $MUNNYBUD_THREADS or one per core). "
+              "Ignored by commands sent to the server")
+        .scan<'u', size_t>();
+    program.add_argument("--memory-limit")
+        .help("Answer 'view' and 'stats' within this much memory (e.g. 512M, 2G) by streaming the "
+              "transaction file instead of loading it. Ignored by other commands and by the server");
 
     // 'setup' subcommand
-    argparse::ArgumentParser stp_cmd("setup");
+    argparse::ArgumentParser stp_cmd("setup", "1.0", defaults, exitOnHelp);
+
+    // 'serve' subcommand
+    argparse::ArgumentParser serve_cmd("serve", "1.0", defaults, exitOnHelp);
 
     // 'add' subcommand
-    argparse::ArgumentParser add_cmd("add");
+    argparse::ArgumentParser add_cmd("add", "1.0", defaults, exitOnHelp);
     setupAddCmd(add_cmd);
     
     // 'delete' subcommand
-    argparse::ArgumentParser del_cmd("delete");
+    argparse::ArgumentParser del_cmd("delete", "1.0", defaults, exitOnHelp);
     del_cmd.add_argument("id")
         .help("ID of the transaction to delete")
-        .scan<'i', int>();
+        .scan<'i', TransactionId>();
 
     // 'view' subcommand
-    argparse::ArgumentParser view_cmd("view");
+    argparse::ArgumentParser view_cmd("view", "1.0", defaults, exitOnHelp);
     setupViewCmd(view_cmd);
     
+    // 'stats' subcommand
+    argparse::ArgumentParser stats_cmd("stats", "1.0", defaults, exitOnHelp);
+    setupStatsCmd(stats_cmd);
+
     // 'balance' subcommand
-    argparse::ArgumentParser balance_cmd("balance");
+    argparse::ArgumentParser balance_cmd("balance", "1.0", defaults, exitOnHelp);
     balance_cmd.add_argument("-w", "--wallet")
         .help("The wallet you want to consult")
         .default_value(std::string("default"));
@@ -151,25 +482,65 @@ int handleQuickInput(int argc, char* argv[]) {
     program.add_subparser(balance_cmd);
     program.add_subparser(add_cmd);
     program.add_subparser(view_cmd);
+    program.add_subparser(stats_cmd);
     program.add_subparser(del_cmd);
     program.add_subparser(stp_cmd);
+    program.add_subparser(serve_cmd);
     
     // parse arguments
     try {
         program.parse_args(argc, argv);
     } catch (const std::exception& err) {
-        std::cerr << err.what() << std::endl;
-        std::cerr << program;
+        errStream() << err.what() << std::endl;
+        errStream() << program;
         return -1;
     }
+    if (isHelpRequest(argc, argv))
+        return 0;
+
+    // the server keeps the executor it was started with
+    if (auto threads = program.present<size_t>("--threads"); threads && !sharedStorage) {
+        if (*threads == 0) {
+            errStream() << "Error: --threads must be at least 1." << std::endl;
+            return -1;
+        }
+        Executor::configure(*threads);
+    }
     
-    // handle 'setup' subcommand
-    if (program.is_subcommand_used("setup")) {
-        return handleSetupCmd(); 
+    // handle 'setup' and 'serve' subcommands, which never run inside the server
+    if (program.is_subcommand_used("setup") || program.is_subcommand_used("serve")) {
+        if (sharedStorage) {
+            errStream() << "Error: this command cannot be sent to the server." << std::endl;
+            return -1;
+        }
+        if (program.is_subcommand_used("setup"))
+            return handleSetupCmd();
+        return runServer(SERVER_SOCKET_PATH, "../wallets.json", "../transactions.json", runCommand);
     }
     
+    // queries over ledgers too big to load stream the file instead
+    if (auto limit = program.present<std::string>("--memory-limit"); limit && !sharedStorage &&
+        (program.is_subcommand_used("view") || program.is_subcommand_used("stats"))) {
+        size_t memoryLimit = 0;
+        if (!parseByteSize(*limit, memoryLimit) || memoryLimit < OutOfCoreLedger::MIN_MEMORY_LIMIT) {
+            errStream() << "Error: --memory-limit must be a size of at least 1M." << std::endl;
+            return -1;
+        }
+        try {
+            OutOfCoreLedger ledger("../transactions.json", memoryLimit);
+            if (program.is_subcommand_used("view"))
+                return handleViewCmd(view_cmd, ledger);
+            return handleStatsCmd(stats_cmd, ledger);
+        } catch (const std::exception& err) {
+            errStream() << err.what() << std::endl;
+            return -1;
+        }
+    }
+
     // other subcommands require a storageHandler to be constructed!
-    StorageHandler storageHandler("../wallets.json", "../transactions.json");
+    std::optional<StorageHandler> localStorage;
+    StorageHandler& storageHandler =
+        sharedStorage ? *sharedStorage : localStorage.emplace("../wallets.json", "../transactions.json");
 
     // handle 'add' subcommand
     if (program.is_subcommand_used("add")) {
@@ -178,19 +549,43 @@ int handleQuickInput(int argc, char* argv[]) {
     // handle 'view' subcommand
     } else if (program.is_subcommand_used("view")) {
         return handleViewCmd(view_cmd, storageHandler);
+
+    // handle 'stats' subcommand
+    } else if (program.is_subcommand_used("stats")) {
+        return handleStatsCmd(stats_cmd, storageHandler);
     
     // handle 'balance' subcommand
     } else if (program.is_subcommand_used("balance")) {
         std::string wallet = balance_cmd.get<std::string>("--wallet");
         float balance = storageHandler.retrieveBalance(wallet);
-        std::cout << "Your current balance: " << balance << std::endl;
+        outStream() << "Your current balance: " << balance << std::endl;
 
     // handle 'delete' subcommand
     } else if (program.is_subcommand_used("delete")) {
-        int id = del_cmd.get<int>("id");
+        TransactionId id = del_cmd.get<TransactionId>("id");
         if (storageHandler.deleteTransaction(id) < 0) {
             return -1;
         }
     }
     return 0;
 }
+
+/**
+ * @brief Entry point of the command line interface. Commands that only need
+ * the ledger are forwarded to 'munnybud serve' when one is running, and run
+ * in this process otherwise.
+ *
+ * @param argc argument count
+ * @param argv arguments
+ * @return int -1 on error, 0 on success
+ */
+int handleQuickInput(int argc, char* argv[]) {
+    static const std::vector<std::string> forwarded = {"add", "view", "stats", "balance", "delete"};
+    if (argc > 1 && !isHelpRequest(argc, argv) &&
+        std::find(forwarded.begin(), forwarded.end(), argv[1]) != forwarded.end()) {
+        int exitCode;
+        if (forwardToServer(SERVER_SOCKET_PATH, std::vector<std::string>(argv + 1, argv + argc), exitCode))
+            return exitCode;
+    }
+    return runCommand(argc, argv, nullptr);
+}
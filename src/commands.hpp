@@ -3,11 +3,17 @@
 
 #include "argparse.hpp"
 #include "storage.hpp"
+#include "outofcore.hpp"
 
 int handleQuickInput(int argc, char* argv[]);
+int runCommand(int argc, char* argv[], StorageHandler* sharedStorage);
 void setupAddCmd(argparse::ArgumentParser& add_cmd);
 void setupViewCmd(argparse::ArgumentParser& view_cmd);
+void setupStatsCmd(argparse::ArgumentParser& stats_cmd);
 int handleSetupCmd();
 int handleAddCmd(argparse::ArgumentParser& add_cmd, StorageHandler& storageHandler);
 int handleViewCmd(argparse::ArgumentParser& view_cmd, StorageHandler& storageHandler);
+int handleStatsCmd(argparse::ArgumentParser& stats_cmd, StorageHandler& storageHandler);
+int handleViewCmd(argparse::ArgumentParser& view_cmd, OutOfCoreLedger& ledger);
+int handleStatsCmd(argparse::ArgumentParser& stats_cmd, OutOfCoreLedger& ledger);
 #endif
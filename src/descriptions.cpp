@@ -0,0 +1,41 @@
+/**
+ * @file descriptions.cpp
+ * @brief Implementation file for the description heap
+ *
+ */
+
+#include "descriptions.hpp"
+
+/**
+ * @brief Stores the description of the next row.
+ *
+ * @param text the description
+ */
+void DescriptionHeap::add(std::string_view text) {
+    rows.push_back(text.data(), text.size());
+}
+
+/**
+ * @brief Appends every description of another heap. Row r of the other heap
+ * becomes row r + size() of this one.
+ *
+ * @param other the heap to copy
+ */
+void DescriptionHeap::append(const DescriptionHeap& other) {
+    for (size_t row = 0; row < other.size(); row++)
+        add(other.get(row));
+}
+
+/**
+ * @brief Appends the descriptions of a string section without copying them,
+ * see ChunkedLists::borrow.
+ *
+ * @param offsets count + 1 offsets into bytes
+ * @param bytes the description bytes, back to back
+ * @param count the number of descriptions
+ * @param owner keeps the section alive
+ */
+void DescriptionHeap::borrow(const std::uint64_t* offsets, const char* bytes, size_t count,
+                             const std::shared_ptr<const void>& owner) {
+    rows.borrow(offsets, bytes, count, owner);
+}
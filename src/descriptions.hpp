@@ -0,0 +1,49 @@
+/**
+ * @file descriptions.hpp
+ * @brief Header file for the description heap, the cold storage of the
+ * transaction descriptions held by the indexes
+ *
+ */
+
+#ifndef DESCRIPTIONS_HPP
+#define DESCRIPTIONS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include "chunked.hpp"
+
+/**
+* @class
+* @brief Append-only store of descriptions, one per row of the columns.
+*
+* Descriptions are only read to render results and to build or check the text
+* index, so they are kept apart from the other columns. Filters, stats and
+* sorts then never pull description bytes into the cache, and the descriptions
+* cost a few buffers instead of an allocation each. The bytes of a chunk of
+* rows are stored back to back with an offsets array, the layout of the string
+* sections of the index segment, and the versions of a ledger share the chunks.
+* The heap of an attached segment reads the descriptions in place.
+*/
+class DescriptionHeap {
+public:
+    void add(std::string_view text);
+    void append(const DescriptionHeap& other);
+    void borrow(const std::uint64_t* offsets, const char* bytes, size_t count, const std::shared_ptr<const void>& owner);
+    void clear() { rows.clear(); }
+
+    /**
+     * @brief The description of a row, valid while the heap is not changed.
+     */
+    std::string_view get(size_t row) const {
+        std::span<const char> text = rows[row];
+        return std::string_view(text.data(), text.size());
+    }
+    size_t size() const { return rows.size(); }
+
+private:
+    ChunkedLists<char, ROWS_PER_CHUNK> rows;
+};
+
+#endif
@@ -0,0 +1,234 @@
+/**
+ * @file executor.cpp
+ * @brief Implementation file for the work-stealing executor
+ *
+ */
+
+#include "executor.hpp"
+
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+
+/**
+ * @brief The executor the calling thread is a worker of, and the index of its
+ * deque. Threads outside every pool have no executor.
+ */
+static thread_local Executor* currentExecutor = nullptr;
+static thread_local size_t currentWorker = 0;
+
+static std::mutex sharedMutex;
+static std::unique_ptr<Executor> sharedExecutor;
+
+/**
+ * @brief Starts threads - 1 workers, the caller of wait being the last thread.
+ *
+ * @param threads number of threads, 0 for defaultThreads()
+ */
+Executor::Executor(size_t threads) {
+    if (threads == 0)
+        threads = defaultThreads();
+    for (size_t i = 0; i < threads; i++)
+        workers.push_back(std::make_unique<Worker>());
+    for (size_t i = 1; i < threads; i++)
+        this->threads.emplace_back(&Executor::workerLoop, this, i);
+}
+
+Executor::~Executor() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+/**
+ * @brief Thread count used when none is configured: the MUNNYBUD_THREADS
+ * environment variable if it is a positive number, the number of cores otherwise.
+ *
+ * @return size_t the thread count
+ */
+size_t Executor::defaultThreads() {
+    if (const char* value = std::getenv("MUNNYBUD_THREADS")) {
+        size_t threads = 0;
+        auto [end, error] = std::from_chars(value, value + std::strlen(value), threads);
+        if (error == std::errc() && *end == '\0' && threads > 0)
+            return threads;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * @brief The executor shared by the whole process, created on first use.
+ *
+ * @return Executor& the shared executor
+ */
+Executor& Executor::shared() {
+    std::lock_guard<std::mutex> lock(sharedMutex);
+    if (!sharedExecutor)
+        sharedExecutor = std::make_unique<Executor>(defaultThreads());
+    return *sharedExecutor;
+}
+
+/**
+ * @brief Replaces the shared executor by one with the given thread count.
+ * Must not be called while anything runs on the shared executor.
+ *
+ * @param threads number of threads, 0 for defaultThreads()
+ */
+void Executor::configure(size_t threads) {
+    std::lock_guard<std::mutex> lock(sharedMutex);
+    sharedExecutor.reset();
+    sharedExecutor = std::make_unique<Executor>(threads);
+}
+
+/**
+ * @brief Runs every task and waits for all of them. The first exception
+ * thrown by a task is rethrown.
+ *
+ * @param tasks the tasks to run
+ */
+void Executor::runAll(const std::vector<std::function<void()>>& tasks) {
+    if (tasks.empty())
+        return;
+    TaskGroup group(*this);
+    for (size_t i = 0; i + 1 < tasks.size(); i++)
+        group.run(tasks[i]);
+    group.run(tasks.back());
+    group.wait();
+}
+
+/**
+ * @brief Queues a task on the deque of the calling worker, or on the shared
+ * deque when called from outside the pool.
+ */
+void Executor::push(std::function<void()> task) {
+    Worker& worker = *workers[currentExecutor == this ? currentWorker : 0];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queued.fetch_add(1, std::memory_order_release);
+    }
+    wake.notify_one();
+}
+
+/**
+ * @brief Runs one queued task: the newest one of the calling worker's own
+ * deque, or else the oldest one of another deque.
+ *
+ * @return bool false if every deque was empty
+ */
+bool Executor::runOne() {
+    if (queued.load(std::memory_order_acquire) == 0)
+        return false;
+    const bool isWorker = currentExecutor == this;
+    const size_t self = isWorker ? currentWorker : 0;
+    std::function<void()> task;
+    if (isWorker) {
+        Worker& own = *workers[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+        }
+    }
+    for (size_t i = 0; !task && i < workers.size(); i++) {
+        size_t victim = (self + i + (isWorker ? 1 : 0)) % workers.size();
+        Worker& other = *workers[victim];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.tasks.empty()) {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+        }
+    }
+    if (!task)
+        return false;
+    queued.fetch_sub(1, std::memory_order_acq_rel);
+    task();
+    return true;
+}
+
+/**
+ * @brief Runs queued tasks until the group is done, sleeping while there is
+ * nothing to run.
+ */
+void Executor::waitFor(const TaskGroup& group) {
+    while (!group.isDone()) {
+        if (runOne())
+            continue;
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [&]() { return group.isDone() || queued.load(std::memory_order_acquire) > 0; });
+    }
+}
+
+/**
+ * @brief Wakes every sleeping thread, after a group is done.
+ */
+void Executor::notifyAll() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_all();
+}
+
+void Executor::workerLoop(size_t index) {
+    currentExecutor = this;
+    currentWorker = index;
+    while (true) {
+        if (runOne())
+            continue;
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this]() { return stopping || queued.load(std::memory_order_acquire) > 0; });
+        if (stopping && queued.load(std::memory_order_acquire) == 0)
+            return;
+    }
+}
+
+/**
+ * @brief Waits for the tasks still running, without rethrowing their errors,
+ * since they may use the caller's stack.
+ */
+TaskGroup::~TaskGroup() {
+    executor.waitFor(*this);
+}
+
+/**
+ * @brief Queues a task of the group.
+ *
+ * @param task the task to run
+ */
+void TaskGroup::run(std::function<void()> task) {
+    pending.fetch_add(1, std::memory_order_relaxed);
+    executor.push([this, &owner = executor, task = std::move(task)]() {
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error)
+                error = std::current_exception();
+        }
+        // the group may be gone as soon as pending drops to 0
+        if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            owner.notifyAll();
+    });
+}
+
+/**
+ * @brief Runs queued tasks until every task of the group is done. The first
+ * exception thrown by a task is rethrown.
+ */
+void TaskGroup::wait() {
+    executor.waitFor(*this);
+    std::exception_ptr first;
+    {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        std::swap(first, error);
+    }
+    if (first)
+        std::rethrow_exception(first);
+}
@@ -0,0 +1,176 @@
+/**
+ * @file executor.hpp
+ * @brief Header file for the work-stealing executor shared by the loader, the
+ * index builds and the queries
+ *
+ */
+
+#ifndef EXECUTOR_HPP
+#define EXECUTOR_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskGroup;
+
+/**
+* @class
+* @brief Fixed pool of worker threads, each with its own deque of tasks.
+*
+* A worker pushes and pops tasks at the back of its own deque, so nested work
+* stays on the thread (and in the cache) that created it, and steals from the
+* front of the other deques when its own is empty. Tasks submitted by threads
+* outside the pool go to a shared deque that every worker steals from.
+* A thread waiting for a TaskGroup runs queued tasks instead of blocking, so
+* the caller counts as one of the threads: an executor of n threads starts
+* n - 1 workers, and with a single thread everything runs on the caller.
+*
+* Tasks must not block on anything but a TaskGroup (sockets and the queues of
+* the load pipeline have their own threads).
+*/
+class Executor {
+public:
+    explicit Executor(size_t threads);
+    ~Executor();
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    static Executor& shared();
+    static void configure(size_t threads);
+    static size_t defaultThreads();
+
+    size_t concurrency() const { return workers.size(); }
+
+    void runAll(const std::vector<std::function<void()>>& tasks);
+
+    /**
+     * @brief Calls body(first, last) over subranges of [begin, end) of at
+     * least grain elements, in parallel. Ranges are split in halves, one half
+     * pushed for others to steal and the other one split further, so the work
+     * spreads out however uneven it is.
+     *
+     * @param begin first index
+     * @param end one past the last index
+     * @param grain smallest range worth a task of its own
+     * @param body function called with each subrange
+     */
+    template <typename Body>
+    void parallelFor(size_t begin, size_t end, size_t grain, const Body& body);
+
+    /**
+     * @brief Maps [begin, end) in chunks of at least grain elements in parallel
+     * and combines the results of the chunks in index order, so the result is
+     * the same as a sequential fold for any associative combine.
+     *
+     * @param begin first index
+     * @param end one past the last index
+     * @param grain smallest chunk worth a task of its own
+     * @param identity result of an empty range
+     * @param map function returning the result of a chunk (first, last)
+     * @param combine function merging two results, the left one first
+     * @return T the combined result
+     */
+    template <typename T, typename Map, typename Combine>
+    T parallelReduce(size_t begin, size_t end, size_t grain, T identity, const Map& map, const Combine& combine);
+
+private:
+    friend class TaskGroup;
+
+    /**
+    * @struct
+    * @brief Deque of one worker. Slot 0 is the shared deque of outside threads.
+    */
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> queued{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void push(std::function<void()> task);
+    bool runOne();
+    void waitFor(const TaskGroup& group);
+    void notifyAll();
+    void workerLoop(size_t index);
+};
+
+/**
+* @class
+* @brief Set of tasks run on an executor that can be waited for together.
+* The first exception thrown by a task is rethrown by wait.
+*/
+class TaskGroup {
+public:
+    explicit TaskGroup(Executor& _executor) : executor(_executor) {}
+    ~TaskGroup();
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void run(std::function<void()> task);
+    void wait();
+    bool isDone() const { return pending.load(std::memory_order_acquire) == 0; }
+
+private:
+    Executor& executor;
+    std::atomic<size_t> pending{0};
+    std::mutex errorMutex;
+    std::exception_ptr error;
+};
+
+template <typename Body>
+void Executor::parallelFor(size_t begin, size_t end, size_t grain, const Body& body) {
+    grain = std::max<size_t>(grain, 1);
+    if (end <= begin)
+        return;
+    if (end - begin <= grain || concurrency() == 1) {
+        body(begin, end);
+        return;
+    }
+    TaskGroup group(*this);
+    std::function<void(size_t, size_t)> split = [&](size_t first, size_t last) {
+        while (last - first > grain) {
+            size_t middle = first + (last - first) / 2;
+            group.run([&split, middle, last]() { split(middle, last); });
+            last = middle;
+        }
+        body(first, last);
+    };
+    split(begin, end);
+    group.wait();
+}
+
+template <typename T, typename Map, typename Combine>
+T Executor::parallelReduce(size_t begin, size_t end, size_t grain, T identity, const Map& map, const Combine& combine) {
+    grain = std::max<size_t>(grain, 1);
+    if (end <= begin)
+        return identity;
+    // a few chunks per thread leaves room for stealing when chunks are uneven
+    size_t chunks = std::min((end - begin + grain - 1) / grain, concurrency() * 4);
+    size_t chunkSize = (end - begin + chunks - 1) / chunks;
+    chunks = (end - begin + chunkSize - 1) / chunkSize;
+    std::vector<T> results(chunks, identity);
+    parallelFor(0, chunks, 1, [&](size_t first, size_t last) {
+        for (size_t c = first; c < last; c++)
+            results[c] = map(begin + c * chunkSize, std::min(end, begin + (c + 1) * chunkSize));
+    });
+    T result = std::move(identity);
+    for (T& chunk : results)
+        result = combine(std::move(result), std::move(chunk));
+    return result;
+}
+
+#endif
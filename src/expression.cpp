@@ -0,0 +1,520 @@
+/**
+ * @file expression.cpp
+ * @brief Implementation file for the filter expression language of 'view --where':
+ * the parser and the compiled filter program evaluated over the columns
+ *
+ */
+
+#include "expression.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <limits>
+#include <stdexcept>
+
+// rows evaluated per batch, a multiple of 64 so batches start on a mask word, and
+// a divisor of the chunk size so a batch never spans two chunks of the shared columns
+static constexpr size_t BATCH_ROWS = 4096;
+static_assert(BATCH_ROWS % 64 == 0 && ROWS_PER_CHUNK % BATCH_ROWS == 0);
+
+/**
+* @struct
+* @brief Token of a filter expression
+*/
+struct ExprToken {
+    enum class Type { Word, Quoted, LParen, RParen, Comma, Op, End };
+    Type type;
+    std::string text;
+};
+
+/**
+* @brief Splits a filter expression into tokens: parentheses, commas,
+* comparison operators, quoted strings and bare words (anything else up to
+* a space or one of the previous characters).
+*/
+static std::vector<ExprToken> tokenizeExpression(const std::string& text) {
+    std::vector<ExprToken> tokens;
+    size_t i = 0;
+    while (i < text.size()) {
+        char c = text[i];
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            i++;
+        } else if (c == '(') {
+            tokens.push_back({ExprToken::Type::LParen, "("});
+            i++;
+        } else if (c == ')') {
+            tokens.push_back({ExprToken::Type::RParen, ")"});
+            i++;
+        } else if (c == ',') {
+            tokens.push_back({ExprToken::Type::Comma, ","});
+            i++;
+        } else if (c == '=' || c == '<' || c == '>' || c == '!') {
+            std::string op(1, c);
+            if (i + 1 < text.size() && text[i + 1] == '=')
+                op.push_back('=');
+            if (op == "!")
+                throw std::invalid_argument("Invalid filter expression: expected '!=' at position " + std::to_string(i));
+            tokens.push_back({ExprToken::Type::Op, op == "==" ? "=" : op});
+            i += op.size();
+        } else if (c == '\'' || c == '"') {
+            size_t end = text.find(c, i + 1);
+            if (end == std::string::npos)
+                throw std::invalid_argument("Invalid filter expression: unterminated string");
+            tokens.push_back({ExprToken::Type::Quoted, text.substr(i + 1, end - i - 1)});
+            i = end + 1;
+        } else {
+            size_t end = i;
+            while (end < text.size() && !std::isspace(static_cast<unsigned char>(text[end])) &&
+                   std::string("(),=<>!'\"").find(text[end]) == std::string::npos)
+                end++;
+            tokens.push_back({ExprToken::Type::Word, text.substr(i, end - i)});
+            i = end;
+        }
+    }
+    tokens.push_back({ExprToken::Type::End, ""});
+    return tokens;
+}
+
+/**
+* @struct
+* @brief Recursive descent parser of filter expressions.
+*
+* expr       := and ('or' and)*
+* and        := unary ('and' unary)*
+* unary      := 'not' unary | '(' expr ')' | comparison
+* comparison := field op value | field 'in' '(' value (',' value)* ')'
+*/
+struct ExprParser {
+    std::vector<ExprToken> tokens;
+    size_t pos = 0;
+
+    const ExprToken& peek() const { return tokens[pos]; }
+
+    bool isKeyword(const std::string& keyword) const {
+        if (peek().type != ExprToken::Type::Word || peek().text.size() != keyword.size())
+            return false;
+        for (size_t i = 0; i < keyword.size(); i++) {
+            if (std::tolower(static_cast<unsigned char>(peek().text[i])) != keyword[i])
+                return false;
+        }
+        return true;
+    }
+
+    [[noreturn]] void fail(const std::string& expected) const {
+        std::string found = peek().type == ExprToken::Type::End ? "end of expression" : "'" + peek().text + "'";
+        throw std::invalid_argument("Invalid filter expression: expected " + expected + " but found " + found);
+    }
+
+    std::unique_ptr<ExprNode> parseOr() {
+        auto left = parseAnd();
+        while (isKeyword("or")) {
+            pos++;
+            auto node = std::make_unique<ExprNode>();
+            node->kind = ExprNode::Kind::Or;
+            node->children.push_back(std::move(left));
+            node->children.push_back(parseAnd());
+            left = std::move(node);
+        }
+        return left;
+    }
+
+    std::unique_ptr<ExprNode> parseAnd() {
+        auto left = parseUnary();
+        while (isKeyword("and")) {
+            pos++;
+            auto node = std::make_unique<ExprNode>();
+            node->kind = ExprNode::Kind::And;
+            node->children.push_back(std::move(left));
+            node->children.push_back(parseUnary());
+            left = std::move(node);
+        }
+        return left;
+    }
+
+    std::unique_ptr<ExprNode> parseUnary() {
+        if (isKeyword("not")) {
+            pos++;
+            auto node = std::make_unique<ExprNode>();
+            node->kind = ExprNode::Kind::Not;
+            node->children.push_back(parseUnary());
+            return node;
+        }
+        if (peek().type == ExprToken::Type::LParen) {
+            pos++;
+            auto node = parseOr();
+            if (peek().type != ExprToken::Type::RParen)
+                fail("')'");
+            pos++;
+            return node;
+        }
+        return parseComparison();
+    }
+
+    std::string parseValue() {
+        if (peek().type != ExprToken::Type::Word && peek().type != ExprToken::Type::Quoted)
+            fail("a value");
+        return tokens[pos++].text;
+    }
+
+    std::unique_ptr<ExprNode> parseComparison() {
+        static const std::vector<std::string> fields = {"amount", "date", "weekday", "category", "wallet", "id",
+                                                        "length", "type"};
+        if (peek().type != ExprToken::Type::Word)
+            fail("a field");
+        auto node = std::make_unique<ExprNode>();
+        node->field = tokens[pos].text;
+        std::transform(node->field.begin(), node->field.end(), node->field.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        if (std::find(fields.begin(), fields.end(), node->field) == fields.end())
+            throw std::invalid_argument("Invalid filter expression: unknown field '" + tokens[pos].text +
+                                        "' (fields: amount, date, weekday, category, wallet, id, length, type)");
+        pos++;
+
+        if (isKeyword("in")) {
+            pos++;
+            node->op = "in";
+            if (peek().type != ExprToken::Type::LParen)
+                fail("'('");
+            pos++;
+            node->values.push_back(parseValue());
+            while (peek().type == ExprToken::Type::Comma) {
+                pos++;
+                node->values.push_back(parseValue());
+            }
+            if (peek().type != ExprToken::Type::RParen)
+                fail("')'");
+            pos++;
+            return node;
+        }
+
+        if (peek().type != ExprToken::Type::Op)
+            fail("a comparison operator");
+        node->op = tokens[pos++].text;
+        node->values.push_back(parseValue());
+        return node;
+    }
+};
+
+/**
+* @brief Parses a filter expression such as
+* "amount < -5000 and category in (food, rent) and not wallet = cash".
+* Keywords are case-insensitive. Amounts are in cents and dates in YYYY-MM-DD.
+*
+* @param text the expression
+* @return std::unique_ptr<ExprNode> the root of the expression tree
+*/
+std::unique_ptr<ExprNode> parseExpression(const std::string& text) {
+    ExprParser parser{tokenizeExpression(text)};
+    auto root = parser.parseOr();
+    if (parser.peek().type != ExprToken::Type::End)
+        parser.fail("'and', 'or' or the end of the expression");
+    return root;
+}
+
+/**
+* @brief Flattens the top-level AND chain of an expression into its terms.
+* Each term can then be handled separately (pushed down to an index or compiled).
+*
+* @param node the expression root
+* @param conjuncts vector to be filled with the terms
+*/
+void splitConjuncts(const ExprNode& node, std::vector<const ExprNode*>& conjuncts) {
+    if (node.kind == ExprNode::Kind::And) {
+        for (const auto& child : node.children)
+            splitConjuncts(*child, conjuncts);
+    } else {
+        conjuncts.push_back(&node);
+    }
+}
+
+/**
+* @brief Parses an integer constant of a comparison
+*/
+static int parseIntegerValue(const ExprNode& node, const std::string& value) {
+    int result = 0;
+    auto [end, err] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (err != std::errc() || end != value.data() + value.size())
+        throw std::invalid_argument("Invalid filter expression: '" + value + "' is not a valid " + node.field);
+    return result;
+}
+
+/**
+* @brief Parses a transaction id constant of a comparison
+*/
+static TransactionId parseIdValue(const ExprNode& node, const std::string& value) {
+    TransactionId result = 0;
+    auto [end, err] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (err != std::errc() || end != value.data() + value.size())
+        throw std::invalid_argument("Invalid filter expression: '" + value + "' is not a valid " + node.field);
+    return result;
+}
+
+/**
+* @brief Converts a constant of a comparison to the integer stored in the column
+*/
+static int columnValue(const ExprNode& node, const std::string& value) {
+    if (node.field == "date") {
+        try {
+            return dayNumber(value);
+        } catch (const std::runtime_error&) {
+            throw std::invalid_argument("Invalid filter expression: '" + value + "' is not a valid date (YYYY-MM-DD)");
+        }
+    }
+    if (node.field == "weekday") {
+        int weekday = parseWeekday(value);
+        if (weekday == 0)
+            weekday = parseIntegerValue(node, value);
+        return weekday;
+    }
+    return parseIntegerValue(node, value);
+}
+
+const int* FilterProgram::columnData(const ColumnBatch& batch, Column column) {
+    switch (column) {
+        case Column::Id: // 64-bit, read by run() directly
+        case Column::Amount:
+            return batch.amounts;
+        case Column::Day:
+            return batch.days;
+        case Column::Weekday:
+            return batch.weekdays;
+        case Column::Category:
+            return batch.categories;
+        case Column::Wallet:
+            return batch.wallets;
+        case Column::DescriptionLength:
+            return batch.descriptionLengths;
+    }
+    return batch.amounts;
+}
+
+/**
+* @brief Emits the instruction(s) of a single comparison, converting the
+* constants into the representation of the column
+*/
+void FilterProgram::emitCompare(const ExprNode& node, const NameIds& categoryIds, const NameIds& walletIds) {
+    const int minColumnInt = std::numeric_limits<int>::min();
+    const int maxColumnInt = std::numeric_limits<int>::max();
+
+    if (node.field == "category" || node.field == "wallet") {
+        if (node.op != "=" && node.op != "!=" && node.op != "in")
+            throw std::invalid_argument("Invalid filter expression: " + node.field + " only supports =, != and in");
+        const NameIds& ids = node.field == "category" ? categoryIds : walletIds;
+        Instruction instruction{OpCode::In};
+        instruction.column = node.field == "category" ? Column::Category : Column::Wallet;
+        for (const std::string& value : node.values) {
+            auto it = ids.find(value);
+            if (it != ids.end())
+                instruction.values.push_back(it->second);
+        }
+        if (node.field == "category") {
+            // a category also matches its subcategories
+            for (const auto& [name, id] : ids) {
+                for (const std::string& value : node.values) {
+                    if (name.size() > value.size() && name.compare(0, value.size(), value) == 0 && name[value.size()] == '/')
+                        instruction.values.push_back(id);
+                }
+            }
+        }
+        program.push_back(std::move(instruction));
+        if (node.op == "!=")
+            program.push_back({OpCode::Not});
+        return;
+    }
+
+    if (node.field == "type") {
+        const std::string& value = node.values[0];
+        if ((node.op != "=" && node.op != "!=") || (value != "expense" && value != "income"))
+            throw std::invalid_argument("Invalid filter expression: type can only be compared to expense or income with = or !=");
+        Instruction instruction{OpCode::Range, Column::Amount};
+        instruction.low = value == "expense" ? minColumnInt : 1;
+        instruction.high = value == "expense" ? -1 : maxColumnInt;
+        program.push_back(std::move(instruction));
+        if (node.op == "!=")
+            program.push_back({OpCode::Not});
+        return;
+    }
+
+    Column column = Column::Id;
+    if (node.field == "amount")
+        column = Column::Amount;
+    else if (node.field == "date")
+        column = Column::Day;
+    else if (node.field == "weekday")
+        column = Column::Weekday;
+    else if (node.field == "length")
+        column = Column::DescriptionLength;
+
+    Instruction instruction{OpCode::Range, column};
+    if (node.op == "in" && column == Column::Id) {
+        // ids are sparse and 64-bit, so each one is a one-value range
+        for (size_t i = 0; i < node.values.size(); i++) {
+            const TransactionId id = parseIdValue(node, node.values[i]);
+            instruction.low = id;
+            instruction.high = id;
+            program.push_back(instruction);
+            if (i > 0)
+                program.push_back({OpCode::Or});
+        }
+        return;
+    }
+    if (node.op == "in") {
+        instruction.op = OpCode::In;
+        for (const std::string& value : node.values)
+            instruction.values.push_back(columnValue(node, value));
+        program.push_back(std::move(instruction));
+        return;
+    }
+
+    const std::int64_t minInt = column == Column::Id ? std::numeric_limits<TransactionId>::min() : minColumnInt;
+    const std::int64_t maxInt = column == Column::Id ? std::numeric_limits<TransactionId>::max() : maxColumnInt;
+    std::int64_t value = column == Column::Id ? parseIdValue(node, node.values[0]) : columnValue(node, node.values[0]);
+    instruction.low = minInt;
+    instruction.high = maxInt;
+    if (node.op == "=" || node.op == "!=") {
+        instruction.low = value;
+        instruction.high = value;
+    } else if (node.op == "<") {
+        // low > high selects nothing, which is right for "< INT_MIN"
+        instruction.high = value == minInt ? minInt : value - 1;
+        if (value == minInt)
+            instruction.low = maxInt;
+    } else if (node.op == "<=") {
+        instruction.high = value;
+    } else if (node.op == ">") {
+        instruction.low = value == maxInt ? maxInt : value + 1;
+        if (value == maxInt)
+            instruction.high = minInt;
+    } else if (node.op == ">=") {
+        instruction.low = value;
+    }
+    program.push_back(std::move(instruction));
+    if (node.op == "!=")
+        program.push_back({OpCode::Not});
+}
+
+/**
+* @brief Emits the postfix instructions of an expression node
+*/
+void FilterProgram::emit(const ExprNode& node, const NameIds& categoryIds, const NameIds& walletIds) {
+    switch (node.kind) {
+        case ExprNode::Kind::And:
+        case ExprNode::Kind::Or:
+            emit(*node.children[0], categoryIds, walletIds);
+            for (size_t i = 1; i < node.children.size(); i++) {
+                emit(*node.children[i], categoryIds, walletIds);
+                program.push_back({node.kind == ExprNode::Kind::And ? OpCode::And : OpCode::Or});
+            }
+            break;
+        case ExprNode::Kind::Not:
+            emit(*node.children[0], categoryIds, walletIds);
+            program.push_back({OpCode::Not});
+            break;
+        case ExprNode::Kind::Compare:
+            emitCompare(node, categoryIds, walletIds);
+            break;
+    }
+}
+
+/**
+* @brief Compiles the AND of the given expression terms into a filter program.
+* Names are resolved against the interned category/wallet ids of the columns,
+* so the program is only valid for those columns.
+*
+* @param conjuncts the terms, all of which have to match
+* @param columns the columns the program will run on
+* @return FilterProgram the compiled program (empty when there are no terms)
+*/
+FilterProgram FilterProgram::compile(const std::vector<const ExprNode*>& conjuncts, const TransactionColumns& columns) {
+    return compile(conjuncts, columns.categoryIds, columns.walletIds);
+}
+
+/**
+* @brief Compiles the AND of the given expression terms for the shared columns
+* of the indexes, resolving names against their name tables.
+*/
+FilterProgram FilterProgram::compile(const std::vector<const ExprNode*>& conjuncts, const SharedColumns& columns) {
+    return compile(conjuncts, columns.categoryNames->ids, columns.walletNames->ids);
+}
+
+FilterProgram FilterProgram::compile(const std::vector<const ExprNode*>& conjuncts, const NameIds& categoryIds,
+                                     const NameIds& walletIds) {
+    FilterProgram compiled;
+    for (size_t i = 0; i < conjuncts.size(); i++) {
+        compiled.emit(*conjuncts[i], categoryIds, walletIds);
+        if (i > 0)
+            compiled.program.push_back({OpCode::And});
+    }
+
+    size_t depth = 0;
+    for (const Instruction& instruction : compiled.program) {
+        if (instruction.op == OpCode::Range || instruction.op == OpCode::In)
+            depth++;
+        else if (instruction.op == OpCode::And || instruction.op == OpCode::Or)
+            depth--;
+        compiled.stackDepth = std::max(compiled.stackDepth, depth);
+    }
+    return compiled;
+}
+
+/**
+* @brief Runs the program over every row of the columns.
+*
+* @param columns the columns the program was compiled for
+* @return SelectionMask the rows for which the expression is true
+*/
+SelectionMask FilterProgram::run(const TransactionColumns& columns) const {
+    return runBatches(columns);
+}
+
+/**
+* @brief Runs the program over every row of the shared columns of the indexes,
+* removed rows included.
+*/
+SelectionMask FilterProgram::run(const SharedColumns& columns) const {
+    return runBatches(columns);
+}
+
+template <typename Columns>
+SelectionMask FilterProgram::runBatches(const Columns& columns) const {
+    const size_t rows = columns.size();
+    if (program.empty())
+        return fullMask(rows);
+
+    SelectionMask result = emptyMask(rows);
+    std::vector<SelectionMask> stack(stackDepth);
+    for (size_t begin = 0; begin < rows; begin += BATCH_ROWS) {
+        const size_t count = std::min(BATCH_ROWS, rows - begin);
+        const ColumnBatch batch = columns.batch(begin);
+        size_t top = 0;
+        for (const Instruction& instruction : program) {
+            switch (instruction.op) {
+                case OpCode::Range:
+                    if (instruction.column == Column::Id)
+                        maskRange(batch.ids, count, instruction.low, instruction.high, stack[top++]);
+                    else
+                        maskRange(columnData(batch, instruction.column), count,
+                                  static_cast<int>(instruction.low), static_cast<int>(instruction.high), stack[top++]);
+                    break;
+                case OpCode::In:
+                    maskIn(columnData(batch, instruction.column), count, instruction.values,
+                           stack[top++]);
+                    break;
+                case OpCode::And:
+                    top--;
+                    maskAnd(stack[top - 1], stack[top]);
+                    break;
+                case OpCode::Or:
+                    top--;
+                    maskOr(stack[top - 1], stack[top]);
+                    break;
+                case OpCode::Not:
+                    maskNot(stack[top - 1], count);
+                    break;
+            }
+        }
+        std::copy(stack[0].begin(), stack[0].end(), result.begin() + static_cast<std::ptrdiff_t>(begin / 64));
+    }
+    return result;
+}
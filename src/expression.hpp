@@ -0,0 +1,84 @@
+/**
+ * @file expression.hpp
+ * @brief Header file for the filter expression language of 'view --where':
+ * the parser and the compiled filter program evaluated over the columns
+ *
+ */
+
+#ifndef EXPRESSION_HPP
+#define EXPRESSION_HPP
+
+#include "filter.hpp"
+#include "indexmanager.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+* @struct
+* @brief Node of a parsed filter expression.
+* Comparisons hold a field, an operator ("=", "!=", "<", "<=", ">", ">=" or "in")
+* and their values, the other kinds only hold children.
+*/
+struct ExprNode {
+    enum class Kind { And, Or, Not, Compare };
+    Kind kind = Kind::Compare;
+    std::string field;
+    std::string op;
+    std::vector<std::string> values;
+    std::vector<std::unique_ptr<ExprNode>> children;
+};
+
+std::unique_ptr<ExprNode> parseExpression(const std::string& text);
+void splitConjuncts(const ExprNode& node, std::vector<const ExprNode*>& conjuncts);
+
+/**
+* @class
+* @brief A filter expression compiled into a flat postfix program.
+*
+* Every comparison becomes a single column instruction with its constants
+* already converted (cents, day numbers, interned category/wallet ids), so
+* evaluation never looks at strings. The program runs over batches of rows:
+* each instruction produces the selection mask of the whole batch, and the
+* boolean operators combine masks word by word.
+* It runs over the columns of a partial build or of an out-of-core batch
+* (TransactionColumns) as well as over the shared columns of the indexes.
+*/
+class FilterProgram {
+public:
+    static FilterProgram compile(const std::vector<const ExprNode*>& conjuncts, const TransactionColumns& columns);
+    static FilterProgram compile(const std::vector<const ExprNode*>& conjuncts, const SharedColumns& columns);
+    SelectionMask run(const TransactionColumns& columns) const;
+    SelectionMask run(const SharedColumns& columns) const;
+    bool empty() const { return program.empty(); }
+
+private:
+    enum class OpCode { Range, In, And, Or, Not };
+    enum class Column { Id, Amount, Day, Weekday, Category, Wallet, DescriptionLength };
+    struct Instruction {
+        OpCode op;
+        Column column;
+        std::int64_t low = 0; // wide enough for the id column
+        std::int64_t high = 0;
+        std::vector<int> values;
+
+        Instruction(OpCode code, Column col = Column::Id) : op(code), column(col) {}
+    };
+
+    using NameIds = std::unordered_map<std::string, int>;
+
+    std::vector<Instruction> program;
+    size_t stackDepth = 0;
+
+    static FilterProgram compile(const std::vector<const ExprNode*>& conjuncts, const NameIds& categoryIds,
+                                 const NameIds& walletIds);
+    template <typename Columns>
+    SelectionMask runBatches(const Columns& columns) const;
+    void emit(const ExprNode& node, const NameIds& categoryIds, const NameIds& walletIds);
+    void emitCompare(const ExprNode& node, const NameIds& categoryIds, const NameIds& walletIds);
+    static const int* columnData(const ColumnBatch& batch, Column column);
+};
+
+#endif
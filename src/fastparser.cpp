@@ -0,0 +1,433 @@
+/**
+ * @file fastparser.cpp
+ * @brief Implementation file for the fast path parser of the transaction file
+ *
+ * The scanning primitives look at 32 (AVX2) or 16 (SSE2) bytes at a time: each
+ * block is compared against the interesting characters and the resulting
+ * byte mask is turned into a bitmask, whose lowest set bit is the next match.
+ *
+ */
+
+#include "fastparser.hpp"
+
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <string>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX2__)
+using Block = __m256i;
+static const size_t BLOCK_SIZE = 32;
+static inline Block loadBlock(const char* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+static inline Block equalTo(Block block, char c) { return _mm256_cmpeq_epi8(block, _mm256_set1_epi8(c)); }
+static inline Block either(Block a, Block b) { return _mm256_or_si256(a, b); }
+static inline Block signedBelow(Block block, char c) { return _mm256_cmpgt_epi8(_mm256_set1_epi8(c), block); }
+static inline std::uint32_t bitsOf(Block block) { return static_cast<std::uint32_t>(_mm256_movemask_epi8(block)); }
+#elif defined(__SSE2__)
+using Block = __m128i;
+static const size_t BLOCK_SIZE = 16;
+static inline Block loadBlock(const char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+static inline Block equalTo(Block block, char c) { return _mm_cmpeq_epi8(block, _mm_set1_epi8(c)); }
+static inline Block either(Block a, Block b) { return _mm_or_si128(a, b); }
+static inline Block signedBelow(Block block, char c) { return _mm_cmplt_epi8(block, _mm_set1_epi8(c)); }
+static inline std::uint32_t bitsOf(Block block) { return static_cast<std::uint32_t>(_mm_movemask_epi8(block)); }
+#endif
+
+/**
+ * @brief Returns the position of the first byte at or after pos for which
+ * isMatch holds, or npos. blockMatches computes the same test for a whole
+ * block as a bitmask.
+ */
+template <typename BlockMatches, typename ByteMatches>
+static inline size_t scanFor(std::string_view text, size_t pos, BlockMatches blockMatches, ByteMatches isMatch) {
+#if defined(__AVX2__) || defined(__SSE2__)
+    for (; pos + BLOCK_SIZE <= text.size(); pos += BLOCK_SIZE) {
+        std::uint32_t bits = blockMatches(loadBlock(text.data() + pos));
+        if (bits)
+            return pos + static_cast<size_t>(std::countr_zero(bits));
+    }
+#else
+    (void)blockMatches;
+#endif
+    for (; pos < text.size(); pos++) {
+        if (isMatch(text[pos]))
+            return pos;
+    }
+    return std::string_view::npos;
+}
+
+static inline bool isSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+/**
+ * @brief Skips json whitespace.
+ *
+ * @return size_t the position of the first other character (text.size() if none)
+ */
+size_t skipSpaces(std::string_view text, size_t pos) {
+    // short runs (a single space after ':' or ',') are the common case
+    if (pos < text.size() && !isSpace(text[pos]))
+        return pos;
+    size_t found = scanFor(
+        text, pos,
+        [](auto block) {
+            auto spaces = either(either(equalTo(block, ' '), equalTo(block, '\n')),
+                                 either(equalTo(block, '\r'), equalTo(block, '\t')));
+            return ~bitsOf(spaces) & ((std::uint64_t(1) << BLOCK_SIZE) - 1);
+        },
+        [](char c) { return !isSpace(c); });
+    return found == std::string_view::npos ? text.size() : found;
+}
+
+/**
+ * @brief Finds the next quote or backslash, which is all that matters when
+ * skipping over a string.
+ */
+size_t findQuoteOrEscape(std::string_view text, size_t pos) {
+    return scanFor(
+        text, pos, [](auto block) { return bitsOf(either(equalTo(block, '"'), equalTo(block, '\\'))); },
+        [](char c) { return c == '"' || c == '\\'; });
+}
+
+/**
+ * @brief Finds the next quote or bracket, which is all that matters when
+ * skipping over a nested value.
+ */
+size_t findBracketOrQuote(std::string_view text, size_t pos) {
+    return scanFor(
+        text, pos,
+        [](auto block) {
+            auto brackets = either(either(equalTo(block, '{'), equalTo(block, '}')),
+                                   either(equalTo(block, '['), equalTo(block, ']')));
+            return bitsOf(either(brackets, equalTo(block, '"')));
+        },
+        [](char c) { return c == '"' || c == '{' || c == '}' || c == '[' || c == ']'; });
+}
+
+/**
+ * @brief Finds the next byte inside a string that needs attention: the closing
+ * quote, an escape, a control character (invalid in json) or a non-ASCII byte
+ * (which must be checked to be valid UTF-8). Control and non-ASCII bytes are
+ * exactly the bytes below 0x20 when compared as signed.
+ */
+static size_t findStringSpecial(std::string_view text, size_t pos) {
+    return scanFor(
+        text, pos,
+        [](auto block) {
+            return bitsOf(either(either(equalTo(block, '"'), equalTo(block, '\\')), signedBelow(block, 0x20)));
+        },
+        [](char c) { return c == '"' || c == '\\' || static_cast<signed char>(c) < 0x20; });
+}
+
+/**
+ * @brief Checks one UTF-8 sequence starting at pos the way nlohmann does
+ * (shortest form, no surrogates, at most U+10FFFF).
+ *
+ * @return size_t its length, 0 if it is invalid
+ */
+static size_t utf8Length(std::string_view text, size_t pos) {
+    auto at = [&](size_t i) { return pos + i < text.size() ? static_cast<unsigned char>(text[pos + i]) : 0u; };
+    auto continuation = [&](size_t i) { return (at(i) & 0xC0) == 0x80; };
+    unsigned lead = at(0);
+    if (lead >= 0xC2 && lead <= 0xDF)
+        return continuation(1) ? 2 : 0;
+    if (lead >= 0xE0 && lead <= 0xEF) {
+        unsigned second = at(1);
+        if ((lead == 0xE0 && second < 0xA0) || (lead == 0xED && second > 0x9F))
+            return 0;
+        return continuation(1) && continuation(2) ? 3 : 0;
+    }
+    if (lead >= 0xF0 && lead <= 0xF4) {
+        unsigned second = at(1);
+        if ((lead == 0xF0 && second < 0x90) || (lead == 0xF4 && second > 0x8F))
+            return 0;
+        return continuation(1) && continuation(2) && continuation(3) ? 4 : 0;
+    }
+    return 0;
+}
+
+static bool parseHex4(std::string_view text, size_t pos, unsigned& value) {
+    if (pos + 4 > text.size())
+        return false;
+    value = 0;
+    for (size_t i = 0; i < 4; i++) {
+        char c = text[pos + i];
+        value <<= 4;
+        if (c >= '0' && c <= '9')
+            value |= static_cast<unsigned>(c - '0');
+        else if (c >= 'a' && c <= 'f')
+            value |= static_cast<unsigned>(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            value |= static_cast<unsigned>(c - 'A' + 10);
+        else
+            return false;
+    }
+    return true;
+}
+
+static void appendUtf8(std::string& out, unsigned code) {
+    if (code < 0x80) {
+        out += static_cast<char>(code);
+    } else if (code < 0x800) {
+        out += static_cast<char>(0xC0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out += static_cast<char>(0xE0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (code >> 18));
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+}
+
+/**
+ * @brief Decodes the string starting at pos (a quote) into out. Plain runs are
+ * copied in one go, only escapes and non-ASCII bytes are looked at one by one.
+ *
+ * @return bool false if the string is not valid json
+ */
+static bool parseString(std::string_view text, size_t& pos, std::string& out) {
+    if (pos >= text.size() || text[pos] != '"')
+        return false;
+    pos++;
+    out.clear();
+    while (true) {
+        size_t special = findStringSpecial(text, pos);
+        if (special == std::string_view::npos)
+            return false;
+        out.append(text.data() + pos, special - pos);
+        pos = special;
+        unsigned char c = static_cast<unsigned char>(text[pos]);
+        if (c == '"') {
+            pos++;
+            return true;
+        }
+        if (c >= 0x80) {
+            size_t length = utf8Length(text, pos);
+            if (length == 0)
+                return false;
+            out.append(text.data() + pos, length);
+            pos += length;
+            continue;
+        }
+        if (c != '\\' || pos + 1 >= text.size())
+            return false; // control character
+        char escape = text[pos + 1];
+        pos += 2;
+        switch (escape) {
+        case '"': out += '"'; break;
+        case '\\': out += '\\'; break;
+        case '/': out += '/'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u': {
+            unsigned code;
+            if (!parseHex4(text, pos, code))
+                return false;
+            pos += 4;
+            if (code >= 0xD800 && code <= 0xDBFF) {
+                unsigned low;
+                if (pos + 2 > text.size() || text[pos] != '\\' || text[pos + 1] != 'u' ||
+                    !parseHex4(text, pos + 2, low) || low < 0xDC00 || low > 0xDFFF)
+                    return false;
+                pos += 6;
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            } else if (code >= 0xDC00 && code <= 0xDFFF) {
+                return false;
+            }
+            appendUtf8(out, code);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief Parses an object key. Keys without escapes (all of ours) are returned
+ * as a view of the text instead of being copied.
+ */
+static bool parseKey(std::string_view text, size_t& pos, std::string_view& key, std::string& scratch) {
+    if (pos < text.size() && text[pos] == '"') {
+        size_t special = findStringSpecial(text, pos + 1);
+        if (special != std::string_view::npos && text[special] == '"') {
+            key = text.substr(pos + 1, special - pos - 1);
+            pos = special + 1;
+            return true;
+        }
+    }
+    if (!parseString(text, pos, scratch))
+        return false;
+    key = scratch;
+    return true;
+}
+
+/**
+ * @brief Parses an integer with from_chars. Only json integers are accepted:
+ * no leading zeros, and anything that continues as a float is left to the
+ * general parser, like values that do not fit the integer type.
+ */
+template<typename Integer>
+static bool parseInt(std::string_view text, size_t& pos, Integer& value) {
+    const char* begin = text.data() + pos;
+    const char* end = text.data() + text.size();
+    const char* digits = begin < end && *begin == '-' ? begin + 1 : begin;
+    if (digits + 1 < end && digits[0] == '0' && digits[1] >= '0' && digits[1] <= '9')
+        return false;
+    auto [next, error] = std::from_chars(begin, end, value);
+    if (error != std::errc() || next == digits)
+        return false;
+    if (next < end && (*next == '.' || *next == 'e' || *next == 'E'))
+        return false;
+    pos = static_cast<size_t>(next - text.data());
+    return true;
+}
+
+static bool expect(std::string_view text, size_t& pos, char c) {
+    pos = skipSpaces(text, pos);
+    if (pos >= text.size() || text[pos] != c)
+        return false;
+    pos++;
+    return true;
+}
+
+/**
+ * @brief Parses the tag array of a transaction.
+ */
+static bool parseTags(std::string_view text, size_t& pos, std::vector<int>& tags) {
+    tags.clear();
+    if (!expect(text, pos, '['))
+        return false;
+    pos = skipSpaces(text, pos);
+    if (pos < text.size() && text[pos] == ']') {
+        pos++;
+        return true;
+    }
+    while (true) {
+        int tag;
+        pos = skipSpaces(text, pos);
+        if (!parseInt(text, pos, tag))
+            return false;
+        tags.push_back(tag);
+        pos = skipSpaces(text, pos);
+        if (pos >= text.size())
+            return false;
+        if (text[pos++] == ']')
+            return true;
+        if (text[pos - 1] != ',')
+            return false;
+    }
+}
+
+/**
+ * @brief Parses one transaction object. Every key must be one written by
+ * Transaction::toJson, and id, amount, category, description and wallet must
+ * all be present.
+ */
+static bool parseTransaction(std::string_view text, size_t& pos, Transaction& transaction, std::string& scratch) {
+    if (!expect(text, pos, '{'))
+        return false;
+    enum : unsigned { ID = 1, AMOUNT = 2, CATEGORY = 4, DESCRIPTION = 8, WALLET = 16 };
+    unsigned seen = 0;
+    transaction.tags.clear();
+    pos = skipSpaces(text, pos);
+    if (pos < text.size() && text[pos] == '}')
+        return false;
+    while (true) {
+        std::string_view key;
+        pos = skipSpaces(text, pos);
+        if (!parseKey(text, pos, key, scratch) || !expect(text, pos, ':'))
+            return false;
+        pos = skipSpaces(text, pos);
+        bool ok;
+        if (key == "id") {
+            ok = parseInt(text, pos, transaction.id);
+            seen |= ID;
+        } else if (key == "amount") {
+            ok = parseInt(text, pos, transaction.amount);
+            seen |= AMOUNT;
+        } else if (key == "category") {
+            ok = parseString(text, pos, transaction.category);
+            seen |= CATEGORY;
+        } else if (key == "description") {
+            ok = parseString(text, pos, transaction.description);
+            seen |= DESCRIPTION;
+        } else if (key == "wallet") {
+            ok = parseString(text, pos, transaction.wallet);
+            seen |= WALLET;
+        } else if (key == "tags") {
+            ok = parseTags(text, pos, transaction.tags);
+        } else {
+            return false;
+        }
+        if (!ok)
+            return false;
+        pos = skipSpaces(text, pos);
+        if (pos >= text.size())
+            return false;
+        if (text[pos++] == '}')
+            break;
+        if (text[pos - 1] != ',')
+            return false;
+    }
+    return seen == (ID | AMOUNT | CATEGORY | DESCRIPTION | WALLET);
+}
+
+/**
+ * @brief Parses a date bucket (the json array of the transactions of one
+ * date) straight into Transaction records, without building a json document.
+ *
+ * Only the exact schema written by Transaction::toJson is accepted. Anything
+ * else (unknown keys, floats, missing fields, or malformed json) makes it give
+ * up so the caller can hand the bucket to nlohmann, which either handles it
+ * or reports the error. The dates of the records are not set.
+ *
+ * @param text the bucket, from its opening to its closing bracket
+ * @param transactions the parsed transactions are appended to it; on failure it
+ * is restored to its previous size
+ * @return bool true if the bucket fits the schema
+ */
+bool parseTransactionBucket(std::string_view text, std::vector<Transaction>& transactions) {
+    const size_t initialSize = transactions.size();
+    auto fail = [&]() {
+        transactions.erase(transactions.begin() + static_cast<std::ptrdiff_t>(initialSize), transactions.end());
+        return false;
+    };
+
+    size_t pos = 0;
+    std::string scratch;
+    if (!expect(text, pos, '['))
+        return fail();
+    pos = skipSpaces(text, pos);
+    if (pos < text.size() && text[pos] == ']') {
+        pos++;
+    } else {
+        while (true) {
+            Transaction& transaction = transactions.emplace_back();
+            if (!parseTransaction(text, pos, transaction, scratch))
+                return fail();
+            pos = skipSpaces(text, pos);
+            if (pos >= text.size())
+                return fail();
+            if (text[pos++] == ']')
+                break;
+            if (text[pos - 1] != ',')
+                return fail();
+        }
+    }
+    if (skipSpaces(text, pos) != text.size())
+        return fail();
+    return true;
+}
@@ -0,0 +1,23 @@
+/**
+ * @file fastparser.hpp
+ * @brief Header file for the fast path parser of the transaction file: SIMD
+ * scanning primitives and a parser specialized for the bucket schema written
+ * by Transaction::toJson
+ *
+ */
+
+#ifndef FASTPARSER_HPP
+#define FASTPARSER_HPP
+
+#include "transaction.hpp"
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+size_t skipSpaces(std::string_view text, size_t pos);
+size_t findQuoteOrEscape(std::string_view text, size_t pos);
+size_t findBracketOrQuote(std::string_view text, size_t pos);
+bool parseTransactionBucket(std::string_view text, std::vector<Transaction>& transactions);
+
+#endif
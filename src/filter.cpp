@@ -0,0 +1,206 @@
+/**
+ * @file filter.cpp
+ * @brief Implementation file for the column filters, which evaluate predicates
+ * over whole columns of transaction data and produce selection bitmasks
+ *
+ */
+
+#include "filter.hpp"
+#include <algorithm>
+#include <bit>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Creates a mask with no row selected
+ */
+SelectionMask emptyMask(size_t rows) {
+    return SelectionMask((rows + 63) / 64, 0);
+}
+
+/**
+ * @brief Creates a mask with every row selected (and the padding bits clear)
+ */
+SelectionMask fullMask(size_t rows) {
+    SelectionMask mask((rows + 63) / 64, ~std::uint64_t(0));
+    if (rows % 64)
+        mask.back() = (std::uint64_t(1) << (rows % 64)) - 1;
+    return mask;
+}
+
+/**
+ * @brief Builds the bits of one 64 row word: bit i is set when
+ * low <= column[i] <= high. The range test is a single unsigned compare of
+ * (value - low) against (high - low), done 8 (AVX2) or 4 (SSE2) lanes at a time.
+ */
+static std::uint64_t rangeWord(const int* column, size_t count, std::uint32_t low, std::uint32_t width) {
+    std::uint64_t word = 0;
+    size_t i = 0;
+#if defined(__AVX2__)
+    // AVX2 has no unsigned compare either, so both sides are biased by 2^31
+    const __m256i bias = _mm256_set1_epi32(static_cast<int>(0x80000000u));
+    const __m256i lowVec = _mm256_set1_epi32(static_cast<int>(low));
+    const __m256i limit = _mm256_set1_epi32(static_cast<int>(width ^ 0x80000000u));
+    for (; i + 8 <= count; i += 8) {
+        __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(column + i));
+        __m256i offset = _mm256_xor_si256(_mm256_sub_epi32(values, lowVec), bias);
+        __m256i outside = _mm256_cmpgt_epi32(offset, limit);
+        std::uint64_t bits = static_cast<std::uint32_t>(~_mm256_movemask_ps(_mm256_castsi256_ps(outside))) & 0xffu;
+        word |= bits << i;
+    }
+#elif defined(__SSE2__)
+    const __m128i bias = _mm_set1_epi32(static_cast<int>(0x80000000u));
+    const __m128i lowVec = _mm_set1_epi32(static_cast<int>(low));
+    const __m128i limit = _mm_set1_epi32(static_cast<int>(width ^ 0x80000000u));
+    for (; i + 4 <= count; i += 4) {
+        __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(column + i));
+        __m128i offset = _mm_xor_si128(_mm_sub_epi32(values, lowVec), bias);
+        __m128i outside = _mm_cmpgt_epi32(offset, limit);
+        std::uint64_t bits = static_cast<std::uint32_t>(~_mm_movemask_ps(_mm_castsi128_ps(outside))) & 0xfu;
+        word |= bits << i;
+    }
+#endif
+    for (; i < count; i++) {
+        std::uint32_t offset = static_cast<std::uint32_t>(column[i]) - low;
+        word |= static_cast<std::uint64_t>(offset <= width) << i;
+    }
+    return word;
+}
+
+/**
+ * @brief Selects the rows whose value is in [low, high].
+ *
+ * @param column the column values, one per row
+ * @param rows number of rows
+ * @param low lowest value (inclusive)
+ * @param high highest value (inclusive)
+ * @param mask the resulting mask (overwritten)
+ */
+void maskRange(const int* column, size_t rows, int low, int high, SelectionMask& mask) {
+    mask.assign((rows + 63) / 64, 0);
+    if (low > high)
+        return;
+    std::uint32_t lowBits = static_cast<std::uint32_t>(low);
+    std::uint32_t width = static_cast<std::uint32_t>(high) - lowBits;
+    for (size_t w = 0; w < mask.size(); w++) {
+        size_t begin = w * 64;
+        mask[w] = rangeWord(column + begin, std::min<size_t>(64, rows - begin), lowBits, width);
+    }
+}
+
+/**
+ * @brief Selects the rows whose value is in [low, high], for 64-bit columns.
+ * Same single unsigned compare per row, left to the compiler to vectorize.
+ *
+ * @param column the column values, one per row
+ * @param rows number of rows
+ * @param low lowest value (inclusive)
+ * @param high highest value (inclusive)
+ * @param mask the resulting mask (overwritten)
+ */
+void maskRange(const std::int64_t* column, size_t rows, std::int64_t low, std::int64_t high, SelectionMask& mask) {
+    mask.assign((rows + 63) / 64, 0);
+    if (low > high)
+        return;
+    const std::uint64_t lowBits = static_cast<std::uint64_t>(low);
+    const std::uint64_t width = static_cast<std::uint64_t>(high) - lowBits;
+    for (size_t w = 0; w < mask.size(); w++) {
+        const size_t begin = w * 64;
+        const size_t count = std::min<size_t>(64, rows - begin);
+        std::uint64_t word = 0;
+        for (size_t i = 0; i < count; i++)
+            word |= static_cast<std::uint64_t>(static_cast<std::uint64_t>(column[begin + i]) - lowBits <= width) << i;
+        mask[w] = word;
+    }
+}
+
+/**
+ * @brief Largest lookup table span per accepted value. Wider value sets, such
+ * as a few far apart amounts, are binary searched instead of tabled.
+ */
+static const long long MAX_TABLE_SPAN_PER_VALUE = 64;
+
+/**
+ * @brief Selects the rows whose value is one of the given values.
+ * A few values are tested as one-value ranges, a lot of them through a
+ * lookup table when they are dense (the small dictionary ids), and by binary
+ * search in the sorted values otherwise.
+ *
+ * @param column the column values, one per row
+ * @param rows number of rows
+ * @param values the accepted values
+ * @param mask the resulting mask (overwritten)
+ */
+void maskIn(const int* column, size_t rows, const std::vector<int>& values, SelectionMask& mask) {
+    mask.assign((rows + 63) / 64, 0);
+    if (values.empty())
+        return;
+
+    if (values.size() <= 4) {
+        SelectionMask single;
+        for (int value : values) {
+            maskRange(column, rows, value, value, single);
+            maskOr(mask, single);
+        }
+        return;
+    }
+
+    auto [lowest, highest] = std::minmax_element(values.begin(), values.end());
+    const long long span = static_cast<long long>(*highest) - *lowest + 1;
+    if (span > MAX_TABLE_SPAN_PER_VALUE * static_cast<long long>(values.size())) {
+        std::vector<int> sorted = values;
+        std::sort(sorted.begin(), sorted.end());
+        for (size_t i = 0; i < rows; i++) {
+            if (std::binary_search(sorted.begin(), sorted.end(), column[i]))
+                maskSet(mask, i);
+        }
+        return;
+    }
+
+    std::vector<unsigned char> accepted(static_cast<size_t>(span), 0);
+    for (int value : values)
+        accepted[static_cast<size_t>(static_cast<long long>(value) - *lowest)] = 1;
+    for (size_t i = 0; i < rows; i++) {
+        long long offset = static_cast<long long>(column[i]) - *lowest;
+        if (offset >= 0 && offset < span && accepted[static_cast<size_t>(offset)])
+            maskSet(mask, i);
+    }
+}
+
+/**
+ * @brief mask = mask AND other
+ */
+void maskAnd(SelectionMask& mask, const SelectionMask& other) {
+    for (size_t w = 0; w < mask.size(); w++)
+        mask[w] &= other[w];
+}
+
+/**
+ * @brief mask = mask OR other
+ */
+void maskOr(SelectionMask& mask, const SelectionMask& other) {
+    for (size_t w = 0; w < mask.size(); w++)
+        mask[w] |= other[w];
+}
+
+/**
+ * @brief Inverts a mask, leaving the padding bits after the last row clear
+ */
+void maskNot(SelectionMask& mask, size_t rows) {
+    for (std::uint64_t& word : mask)
+        word = ~word;
+    if (rows % 64)
+        mask.back() &= (std::uint64_t(1) << (rows % 64)) - 1;
+}
+
+/**
+ * @brief Number of selected rows
+ */
+size_t maskCount(const SelectionMask& mask) {
+    size_t count = 0;
+    for (std::uint64_t word : mask)
+        count += static_cast<size_t>(std::popcount(word));
+    return count;
+}
@@ -0,0 +1,36 @@
+/**
+ * @file filter.hpp
+ * @brief Header file for the column filters, which evaluate predicates over
+ * whole columns of transaction data and produce selection bitmasks
+ *
+ */
+
+#ifndef FILTER_HPP
+#define FILTER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// one bit per row, row i is bit (i % 64) of word (i / 64)
+using SelectionMask = std::vector<std::uint64_t>;
+
+SelectionMask emptyMask(size_t rows);
+SelectionMask fullMask(size_t rows);
+void maskRange(const int* column, size_t rows, int low, int high, SelectionMask& mask);
+void maskRange(const std::int64_t* column, size_t rows, std::int64_t low, std::int64_t high, SelectionMask& mask);
+void maskIn(const int* column, size_t rows, const std::vector<int>& values, SelectionMask& mask);
+void maskAnd(SelectionMask& mask, const SelectionMask& other);
+void maskOr(SelectionMask& mask, const SelectionMask& other);
+void maskNot(SelectionMask& mask, size_t rows);
+size_t maskCount(const SelectionMask& mask);
+
+inline bool maskTest(const SelectionMask& mask, size_t row) {
+    return (mask[row >> 6] >> (row & 63)) & 1;
+}
+
+inline void maskSet(SelectionMask& mask, size_t row) {
+    mask[row >> 6] |= std::uint64_t(1) << (row & 63);
+}
+
+#endif
@@ -0,0 +1,108 @@
+/**
+ * @file generator.hpp
+ * @brief Header file for the coroutine generator used to stream query results
+ * through a pipeline of stages
+ *
+ */
+
+#ifndef GENERATOR_HPP
+#define GENERATOR_HPP
+
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+/**
+* @class
+* @brief Lazy sequence of values produced by a coroutine with co_yield.
+*
+* Nothing runs until the first value is asked for, and the coroutine is
+* suspended at every co_yield until the next one is, so a chain of generators
+* only ever holds the values in flight: a stage never runs ahead of the one
+* consuming it. Yielded values are not copied, the consumer sees them in place
+* until it advances. An exception thrown by the coroutine is rethrown to the
+* consumer.
+*/
+template <typename T>
+class Generator {
+public:
+    struct promise_type {
+        const T* current = nullptr;
+        std::exception_ptr error;
+
+        Generator get_return_object() { return Generator(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        std::suspend_always yield_value(const T& value) noexcept {
+            current = std::addressof(value);
+            return {};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    /**
+    * @class
+    * @brief Input iterator over the values, advancing resumes the coroutine.
+    */
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = T;
+
+        iterator() = default;
+        explicit iterator(std::coroutine_handle<promise_type> _handle) : handle(_handle) {}
+
+        const T& operator*() const { return *handle.promise().current; }
+        const T* operator->() const { return handle.promise().current; }
+        iterator& operator++() {
+            resume(handle);
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+        bool operator==(std::default_sentinel_t) const { return !handle || handle.done(); }
+
+    private:
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    Generator() = default;
+    Generator(Generator&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Generator& operator=(Generator&& other) noexcept {
+        if (this != &other) {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    Generator(const Generator&) = delete;
+    Generator& operator=(const Generator&) = delete;
+    ~Generator() {
+        if (handle)
+            handle.destroy();
+    }
+
+    iterator begin() {
+        if (handle)
+            resume(handle);
+        return iterator(handle);
+    }
+    std::default_sentinel_t end() const { return std::default_sentinel; }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit Generator(std::coroutine_handle<promise_type> _handle) : handle(_handle) {}
+
+    static void resume(std::coroutine_handle<promise_type> handle) {
+        handle.resume();
+        if (handle.done() && handle.promise().error)
+            std::rethrow_exception(std::exchange(handle.promise().error, nullptr));
+    }
+};
+
+#endif
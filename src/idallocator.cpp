@@ -0,0 +1,75 @@
+/**
+ * @file idallocator.cpp
+ * @brief Implementation file for the transaction id allocator
+ *
+ */
+
+#include "idallocator.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+/**
+ * @brief Tells the allocator the highest id found in the loaded ledger. Ids
+ * are always reserved above it, which covers ledgers written before the id
+ * mark existed.
+ *
+ * @param highest the highest id in the ledger
+ */
+void IdAllocator::observe(TransactionId highest) {
+    std::lock_guard<std::mutex> guard(mutex);
+    floor = std::max(floor, highest);
+    if (nextId <= floor)
+        nextId = blockEnd; // the rest of the block may be taken already
+}
+
+/**
+ * @brief Reserves count contiguous ids by moving the id mark. Takes the
+ * exclusive lock unless it is already held (during a pessimistic commit).
+ * Must be called with the mutex held.
+ *
+ * @param count number of ids, at least 1
+ * @return TransactionId the first reserved id, -1 on error
+ */
+TransactionId IdAllocator::reserveRange(TransactionId count) {
+    const bool lockHere = !ledgerLock.isHeld();
+    if (lockHere && !ledgerLock.lock(true))
+        return -1;
+    TransactionId first = -1;
+    TransactionId mark = ledgerLock.readIdMark();
+    if (mark >= 0) {
+        TransactionId base = std::max(mark, floor);
+        if (base <= std::numeric_limits<TransactionId>::max() - count) {
+            if (ledgerLock.writeIdMark(base + count))
+                first = base + 1;
+        } else {
+            errStream() << "Error: transaction ids are exhausted." << std::endl;
+        }
+    }
+    if (lockHere)
+        ledgerLock.unlock();
+    if (first < 0)
+        errStream() << "Error: could not reserve transaction ids." << std::endl;
+    return first;
+}
+
+/**
+ * @brief Returns a new transaction id, reserving a new block when the current
+ * one is used up.
+ *
+ * @return TransactionId the id, -1 on error
+ */
+TransactionId IdAllocator::next() {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (nextId >= blockEnd) {
+        TransactionId first = reserveRange(blockSize);
+        if (first < 0)
+            return -1;
+        nextId = first;
+        blockEnd = first + blockSize;
+        blockSize = std::min(blockSize * 2, MAX_BLOCK);
+    }
+    return nextId++;
+}
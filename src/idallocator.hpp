@@ -0,0 +1,50 @@
+/**
+ * @file idallocator.hpp
+ * @brief Header file for the transaction id allocator, which hands out ids
+ * from blocks reserved in the ledger lock file
+ *
+ */
+
+#ifndef IDALLOCATOR_HPP
+#define IDALLOCATOR_HPP
+
+#include "ledgerlock.hpp"
+#include "transaction.hpp"
+
+#include <cstddef>
+#include <mutex>
+
+/**
+* @class
+* @brief Hands out transaction ids from blocks reserved in the ledger lock file.
+*
+* A reservation moves the id mark of the lock file under its exclusive lock, so
+* ids are unique between threads and processes without coordinating through
+* the ledger itself. Ids left in a block when the process exits are never used,
+* which only leaves a gap. Blocks start at a single id and double while the
+* process keeps allocating, so a one-shot command does not skip ids and a
+* long-lived server rarely has to take the lock.
+*/
+class IdAllocator {
+public:
+    explicit IdAllocator(LedgerLock& _ledgerLock) : ledgerLock(_ledgerLock) {}
+    IdAllocator(const IdAllocator&) = delete;
+    IdAllocator& operator=(const IdAllocator&) = delete;
+
+    void observe(TransactionId highest);
+    TransactionId next();
+
+private:
+    static const TransactionId MAX_BLOCK = 4096;
+
+    LedgerLock& ledgerLock;
+    std::mutex mutex;
+    TransactionId floor = 0;     // highest id known to be in the ledger
+    TransactionId nextId = 0;    // the current block is [nextId, blockEnd)
+    TransactionId blockEnd = 0;
+    TransactionId blockSize = 1;
+
+    TransactionId reserveRange(TransactionId count);
+};
+
+#endif
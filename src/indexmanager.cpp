@@ -1,129 +1,905 @@
 #include "indexmanager.hpp"
+#include "utils.hpp"
+#include "executor.hpp"
+#include <algorithm>
+#include <functional>
+#include <bit>
+#include <cctype>
+#include <iterator>
+#include <limits>
 
 /**
- * @brief fallback function
- * 
- * @param transactions 
+ * @brief Day of the week of a day number, 1 = Monday ... 7 = Sunday.
  */
-void IndexManager::populateIdIdx(json& transactions) {
-    transactionsById.clear();
-    for (const auto& [date, txList] : transactions["data"].items()) {
-        for (const auto& tx : txList) {
-            Transaction txObj(tx);
-            txObj.date = date;
-            transactionsById.try_emplace(txObj.id, txObj);
-        }
+static int weekdayOf(int day) {
+    return (day % 7 + 10) % 7 + 1; // 1970-01-01 was a Thursday
+}
+
+/**
+ * @brief Removes every row and name from the columns
+ */
+void TransactionColumns::clear() {
+    ids.clear();
+    amounts.clear();
+    days.clear();
+    weekdays.clear();
+    categories.clear();
+    wallets.clear();
+    descriptionLengths.clear();
+    categoryNames.clear();
+    walletNames.clear();
+    categoryIds.clear();
+    walletIds.clear();
+}
+
+/**
+ * @brief Appends a transaction as a new row, interning its category and wallet.
+ *
+ * @param transaction the transaction to append
+ * @param day the day number of its date
+ */
+void TransactionColumns::append(const Transaction& transaction, int day) {
+    ids.push_back(transaction.id);
+    amounts.push_back(transaction.amount);
+    days.push_back(day);
+    weekdays.push_back(weekdayOf(day));
+    categories.push_back(internCategory(transaction.category));
+    wallets.push_back(internWallet(transaction.wallet));
+    descriptionLengths.push_back(static_cast<int>(transaction.description.size()));
+}
+
+/**
+ * @brief Returns the id of a category name, adding it to the name table if needed
+ */
+int TransactionColumns::internCategory(const std::string& category) {
+    auto [it, inserted] = categoryIds.try_emplace(category, static_cast<int>(categoryNames.size()));
+    if (inserted)
+        categoryNames.push_back(category);
+    return it->second;
+}
+
+/**
+ * @brief Returns the id of a wallet name, adding it to the name table if needed
+ */
+int TransactionColumns::internWallet(const std::string& wallet) {
+    auto [it, inserted] = walletIds.try_emplace(wallet, static_cast<int>(walletNames.size()));
+    if (inserted)
+        walletNames.push_back(wallet);
+    return it->second;
+}
+
+/**
+ * @brief The columns from the given row on.
+ */
+ColumnBatch TransactionColumns::batch(size_t begin) const {
+    return {ids.data() + begin,        amounts.data() + begin, days.data() + begin,
+            weekdays.data() + begin,   categories.data() + begin, wallets.data() + begin,
+            descriptionLengths.data() + begin};
+}
+
+/**
+ * @brief Returns the id of a name, adding it to the table if needed
+ */
+int NameTable::intern(const std::string& name) {
+    auto [it, inserted] = ids.try_emplace(name, static_cast<int>(names.size()));
+    if (inserted)
+        names.push_back(name);
+    return it->second;
+}
+
+/**
+ * @brief Returns the id of a name, copying the table only if the name is new
+ * and the table is shared.
+ */
+static int internName(CopyOnWrite<NameTable>& table, const std::string& name) {
+    auto it = table->ids.find(name);
+    if (it != table->ids.end())
+        return it->second;
+    return table.write().intern(name);
+}
+
+/**
+ * @brief Appends a transaction as a new row. The caller adds it to rowsById.
+ *
+ * @param transaction the transaction, with its date set
+ * @param day the day number of its date
+ * @return size_t the row
+ */
+size_t SharedColumns::append(const Transaction& transaction, int day) {
+    const size_t row = size();
+    ids.push_back(transaction.id);
+    amounts.push_back(transaction.amount);
+    days.push_back(day);
+    weekdays.push_back(weekdayOf(day));
+    categories.push_back(internName(categoryNames, transaction.category));
+    wallets.push_back(internName(walletNames, transaction.wallet));
+    dates.push_back(internName(dateNames, transaction.date));
+    descriptionLengths.push_back(static_cast<int>(transaction.description.size()));
+    tags.push_back(transaction.tags.data(), transaction.tags.size());
+    descriptions.add(transaction.description);
+    return row;
+}
+
+/**
+ * @brief Marks a row as removed and drops it from rowsById.
+ */
+void SharedColumns::remove(size_t row) {
+    rowsById.erase({ids[row], row});
+    while (removed.size() <= row / 64)
+        removed.push_back(0);
+    removed.mutate(row / 64) |= std::uint64_t(1) << (row % 64);
+}
+
+/**
+ * @brief Removes every row and name.
+ */
+void SharedColumns::clear() {
+    ids.clear();
+    amounts.clear();
+    days.clear();
+    weekdays.clear();
+    categories.clear();
+    wallets.clear();
+    dates.clear();
+    descriptionLengths.clear();
+    tags.clear();
+    descriptions.clear();
+    categoryNames.reset();
+    walletNames.reset();
+    dateNames.reset();
+    rowsById.clear();
+    removed.clear();
+}
+
+/**
+ * @brief The row of a transaction, if it is in the columns and not removed.
+ */
+std::optional<size_t> SharedColumns::rowOf(TransactionId id) const {
+    auto it = rowsById.lower_bound({id, 0});
+    if (it == rowsById.end() || it->first != id)
+        return std::nullopt;
+    return static_cast<size_t>(it->second);
+}
+
+/**
+ * @brief Mask of every row that is not removed.
+ */
+SelectionMask SharedColumns::liveMask() const {
+    SelectionMask mask = fullMask(size());
+    for (size_t w = 0; w < removed.size(); w++)
+        mask[w] &= ~removed[w];
+    return mask;
+}
+
+/**
+ * @brief The columns from the given row to the end of its chunk.
+ */
+ColumnBatch SharedColumns::batch(size_t begin) const {
+    return {&ids[begin],       &amounts[begin], &days[begin],
+            &weekdays[begin],  &categories[begin], &wallets[begin],
+            &descriptionLengths[begin]};
+}
+
+/**
+ * @brief The transaction of a row, description and tags included, for the
+ * results that get rendered.
+ */
+Transaction SharedColumns::transaction(size_t row) const {
+    Transaction transaction;
+    transaction.id = ids[row];
+    transaction.amount = amounts[row];
+    transaction.category = category(row);
+    transaction.description = descriptions.get(row);
+    transaction.wallet = wallet(row);
+    transaction.date = date(row);
+    std::span<const int> rowTags = tags[row];
+    transaction.tags.assign(rowTags.begin(), rowTags.end());
+    return transaction;
+}
+
+/**
+ * @brief Moves the date buckets out of the "data" object of a transaction
+ * file, leaving an empty object in their place.
+ *
+ * @param document the parsed transaction file
+ * @return DateBuckets the buckets, none if "data" is missing or not an object
+ */
+DateBuckets takeBuckets(json& document) {
+    DateBuckets buckets;
+    auto data = document.find("data");
+    if (data == document.end() || !data->is_object())
+        return buckets;
+    for (auto& [date, bucket] : data->items())
+        buckets.emplace(date, std::make_shared<const json>(std::move(bucket)));
+    *data = json::object();
+    return buckets;
+}
+
+/**
+ * @brief Sorts ids, drops the repeated ones and adds them to postings.
+ */
+static void addPostings(Postings& postings, std::vector<TransactionId> ids) {
+    ids.insert(ids.end(), postings.begin(), postings.end());
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    postings.assign(ids);
+}
+
+/**
+ * @brief Builds the postings of every name of a column, over the live rows.
+ *
+ * @param index the index to fill, empty
+ * @param columns the columns
+ * @param keys the column of name ids
+ * @param names the names of those ids
+ */
+template <typename Index>
+static void buildPostings(Index& index, const SharedColumns& columns, const SharedColumns::Column<int>& keys,
+                          const NameTable& names) {
+    std::vector<std::vector<TransactionId>> ids(names.names.size());
+    for (size_t row = 0; row < columns.size(); row++) {
+        if (!columns.isRemoved(row))
+            ids[static_cast<size_t>(keys[row])].push_back(columns.ids[row]);
+    }
+    for (size_t name = 0; name < ids.size(); name++) {
+        if (!ids[name].empty())
+            addPostings(index[names.names[name]], std::move(ids[name]));
     }
-    isIdIdxPopulated = true;
+}
+
+/**
+ * @brief Removes an id from the postings of a key, and the key once it has none left.
+ *
+ * @return bool whether the key was removed
+ */
+template <typename Index>
+static bool removePosting(CopyOnWrite<Index>& index, const std::string& key, TransactionId id) {
+    if (!index->count(key))
+        return false;
+    Index& writable = index.write();
+    auto it = writable.find(key);
+    it->second.erase(id);
+    if (!it->second.empty())
+        return false;
+    writable.erase(it);
+    return true;
 }
 
 /**
  * @brief fallback function
  * 
- * @param transactions 
+ * @param buckets 
  */
-void IndexManager::populateWalletIdx(json& transactions) {
-    transactionsById.clear();
-    transactionsByWallet.clear();
-    for (const auto& [date, txList] : transactions["data"].items()) {
-        for (const auto& tx : txList) {
-            Transaction txObj(tx);
-            txObj.date = date;
-            transactionsById.try_emplace(txObj.id, txObj);
-            transactionsByWallet[txObj.wallet].insert(txObj.id);
-        }
-    }
-    isIdIdxPopulated = true;
+void IndexManager::populateWalletIdx(const DateBuckets& buckets) {
+    if (!isColumnsPopulated)
+        populateColumns(buckets);
+    transactionsByWallet.reset();
+    isWalletVocabPopulated = false;
+    buildPostings(transactionsByWallet.write(), columns, columns.wallets, *columns.walletNames);
     isWalletIdxPopulated = true;
 }
 
 /**
  * @brief fallback function
  * 
- * @param transactions 
+ * @param buckets 
  */
-void IndexManager::populateCategoryIndex(json& transactions) {
-    transactionsById.clear();
-    transactionsByCategory.clear();
-    for (const auto& [date, txList] : transactions["data"].items()) {
-        for (const auto& tx : txList) {
-            Transaction txObj(tx);
-            txObj.date = date;
-            transactionsById.try_emplace(txObj.id, txObj);
-            transactionsByCategory[txObj.category].insert(txObj.id);
-        }
-    }
-    isIdIdxPopulated = true;
+void IndexManager::populateCategoryIndex(const DateBuckets& buckets) {
+    if (!isColumnsPopulated)
+        populateColumns(buckets);
+    transactionsByCategory.reset();
+    isCategoryVocabPopulated = false;
+    buildPostings(transactionsByCategory.write(), columns, columns.categories, *columns.categoryNames);
     isCategoryIdxPopulated = true;
 }
 
 /**
  * @brief fallback function
  * 
- * @param transactions 
+ * @param buckets 
  */
-void IndexManager::populateDateHash(json& transactions) {
-    transactionsById.clear();
-    transactionsByDateHashed.clear();
-    for (const auto& [date, txList] : transactions["data"].items()) {
-        for (const auto& tx : txList) {
-            Transaction txObj(tx);
-            txObj.date = date;
-            transactionsById.try_emplace(txObj.id, txObj);
-            transactionsByDateHashed[txObj.date].insert(txObj.id);
-        }
-    }
-    isIdIdxPopulated = true;
+void IndexManager::populateDateHash(const DateBuckets& buckets) {
+    if (!isColumnsPopulated)
+        populateColumns(buckets);
+    transactionsByDateHashed.reset();
+    buildPostings(transactionsByDateHashed.write(), columns, columns.dates, *columns.dateNames);
     isDateHashPopulated = true;
 }
 
 /**
  * @brief fallback function
  * 
- * @param transactions 
+ * @param buckets 
  */
-void IndexManager::populateDateMap(json& transactions) {
-    transactionsById.clear();
-    transactionsByDateMap.clear();
-    for (const auto& [date, txList] : transactions["data"].items()) {
-        for (const auto& tx : txList) {
-            Transaction txObj(tx);
-            txObj.date = date;
-            transactionsById.try_emplace(txObj.id, txObj);
-            transactionsByDateMap[txObj.date].insert(txObj.id);
+void IndexManager::populateDateMap(const DateBuckets& buckets) {
+    if (!isColumnsPopulated)
+        populateColumns(buckets);
+    transactionsByDateMap.reset();
+    buildPostings(transactionsByDateMap.write(), columns, columns.dates, *columns.dateNames);
+    isDateMapPopulated = true;
+}
+
+/**
+ * @brief fallback function
+ * 
+ * @param buckets 
+ */
+void IndexManager::populateAmountIdx(const DateBuckets& buckets) {
+    if (!isColumnsPopulated)
+        populateColumns(buckets);
+    std::vector<std::pair<int, TransactionId>> entries;
+    entries.reserve(columns.size());
+    for (size_t row = 0; row < columns.size(); row++) {
+        if (!columns.isRemoved(row))
+            entries.emplace_back(columns.amounts[row], columns.ids[row]);
+    }
+    std::sort(entries.begin(), entries.end());
+    transactionsByAmount.assign(entries);
+    isAmountIdxPopulated = true;
+}
+
+/**
+ * @brief Lowercases a description (ASCII only) for case-insensitive matching.
+ */
+static std::string foldCase(std::string_view text) {
+    std::string folded(text);
+    for (char& c : folded)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return folded;
+}
+
+/**
+ * @brief Packs the three bytes starting at text[pos] into a trigram key.
+ */
+static std::uint32_t trigramAt(const std::string& text, size_t pos) {
+    return (static_cast<std::uint32_t>(static_cast<unsigned char>(text[pos])) << 16) |
+           (static_cast<std::uint32_t>(static_cast<unsigned char>(text[pos + 1])) << 8) |
+           static_cast<std::uint32_t>(static_cast<unsigned char>(text[pos + 2]));
+}
+
+/**
+ * @brief Splits a description into the keys of the text indexes: its distinct
+ * tokens (alphanumeric words) and its distinct trigrams, both sorted.
+ *
+ * @param description the description
+ * @param tokens receives the tokens
+ * @param trigrams receives the trigrams
+ */
+static void textKeys(std::string_view description, std::vector<std::string>& tokens,
+                     std::vector<std::uint32_t>& trigrams) {
+    std::string text = foldCase(description);
+    tokens.clear();
+    std::string token;
+    for (char c : text) {
+        if (std::isalnum(static_cast<unsigned char>(c))) {
+            token.push_back(c);
+        } else if (!token.empty()) {
+            tokens.push_back(token);
+            token.clear();
         }
     }
-    isIdIdxPopulated = true;
-    isDateMapPopulated = true;
+    if (!token.empty())
+        tokens.push_back(token);
+    std::sort(tokens.begin(), tokens.end());
+    tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+
+    trigrams.clear();
+    for (size_t i = 0; i + 3 <= text.size(); i++)
+        trigrams.push_back(trigramAt(text, i));
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
 }
 
 /**
- * @brief populates ALL indexes
+ * @brief Adds the tokens and trigrams of a newly stored description to the
+ * text indexes, and its new tokens to the word vocabulary when it is built.
+ *
+ * @param id the transaction
+ * @param description its description
+ */
+void IndexManager::addText(TransactionId id, std::string_view description) {
+    std::vector<std::string> tokens;
+    std::vector<std::uint32_t> trigrams;
+    textKeys(description, tokens, trigrams);
+    for (const std::string& token : tokens) {
+        Postings& ids = transactionsByToken.write(token);
+        if (ids.empty() && isTokenVocabPopulated)
+            tokenVocabulary.insert(token);
+        ids.insert(id);
+    }
+    for (std::uint32_t trigram : trigrams)
+        transactionsByTrigram.write(trigram).insert(id);
+}
+
+/**
+ * @brief Removes a description from the text indexes. A word left without
+ * transactions makes the word vocabulary stale.
+ *
+ * @param id the transaction
+ * @param description its description
+ */
+void IndexManager::removeText(TransactionId id, std::string_view description) {
+    std::vector<std::string> tokens;
+    std::vector<std::uint32_t> trigrams;
+    textKeys(description, tokens, trigrams);
+    for (const std::string& token : tokens) {
+        if (!transactionsByToken.find(token))
+            continue;
+        Postings& ids = transactionsByToken.write(token);
+        ids.erase(id);
+        if (ids.empty()) {
+            transactionsByToken.erase(token);
+            isTokenVocabPopulated = false;
+        }
+    }
+    for (std::uint32_t trigram : trigrams) {
+        if (!transactionsByTrigram.find(trigram))
+            continue;
+        Postings& ids = transactionsByTrigram.write(trigram);
+        ids.erase(id);
+        if (ids.empty())
+            transactionsByTrigram.erase(trigram);
+    }
+}
+
+/**
+ * @brief Builds the description indexes: a token index (alphanumeric words)
+ * and a trigram index used for substring queries.
+ * This one is not part of populateAllIdxs, it is only built when a text query
+ * is made since it is by far the most expensive one. The descriptions are
+ * taken from the columns, which are built first if needed.
+ * 
+ * @param buckets 
+ */
+void IndexManager::populateTextIdx(const DateBuckets& buckets) {
+    if (!isColumnsPopulated)
+        populateColumns(buckets);
+    transactionsByToken.clear();
+    transactionsByTrigram.clear();
+    isTokenVocabPopulated = false;
+
+    std::unordered_map<std::string, std::vector<TransactionId>> tokenIds;
+    std::unordered_map<std::uint32_t, std::vector<TransactionId>> trigramIds;
+    std::vector<std::string> tokens;
+    std::vector<std::uint32_t> trigrams;
+    for (size_t row = 0; row < columns.size(); row++) {
+        if (columns.isRemoved(row))
+            continue;
+        textKeys(columns.descriptions.get(row), tokens, trigrams);
+        for (const std::string& token : tokens)
+            tokenIds[token].push_back(columns.ids[row]);
+        for (std::uint32_t trigram : trigrams)
+            trigramIds[trigram].push_back(columns.ids[row]);
+    }
+    for (auto& [token, ids] : tokenIds)
+        addPostings(transactionsByToken.write(token), std::move(ids));
+    for (auto& [trigram, ids] : trigramIds)
+        addPostings(transactionsByTrigram.write(trigram), std::move(ids));
+    isTextIdxPopulated = true;
+}
+
+/**
+ * @brief Sets the bit of the given row in the bitmap of every given tag.
+ *
+ * @param tags the tag ids of the transaction
+ * @param row its row in the columns
+ */
+void IndexManager::addTags(const std::vector<int>& tags, size_t row) {
+    for (int tag : tags) {
+        if (tag < 0)
+            continue;
+        if (static_cast<size_t>(tag) >= transactionsByTag.size())
+            transactionsByTag.resize(static_cast<size_t>(tag) + 1);
+        SharedColumns::RowBitmap& bitmap = transactionsByTag[static_cast<size_t>(tag)];
+        while (bitmap.size() <= row / 64)
+            bitmap.push_back(0);
+        bitmap.mutate(row / 64) |= std::uint64_t(1) << (row % 64);
+    }
+}
+
+/**
+ * @brief fallback function
  * 
- * @param transactions 
- */
-void IndexManager::populateAllIdxs(json& transactions) {
-    transactionsById.clear();
-    transactionsByWallet.clear();
-    transactionsByCategory.clear();
-    transactionsByDateHashed.clear();
-    transactionsByDateMap.clear();
-    for (const auto& [date, txList] : transactions["data"].items()) {
-        for (const auto& tx : txList) {
+ * @param buckets 
+ */
+void IndexManager::populateColumns(const DateBuckets& buckets) {
+    clearAll();
+    for (const auto& [date, bucket] : buckets) {
+        int day = dayNumber(date);
+        for (const auto& tx : *bucket) {
             Transaction txObj(tx);
             txObj.date = date;
-            transactionsById.try_emplace(txObj.id, txObj);
-            transactionsByCategory[txObj.category].insert(txObj.id);
-            transactionsByWallet[txObj.wallet].insert(txObj.id);
-            transactionsByDateHashed[txObj.date].insert(txObj.id);
-            transactionsByDateMap[txObj.date].insert(txObj.id);
+            const size_t row = columns.append(txObj, day);
+            addTags(txObj.tags, row);
+            stagedRows.emplace_back(txObj.id, row);
+        }
+    }
+    finishRows();
+    isColumnsPopulated = true;
+}
+
+/**
+ * @brief Converts the transactions of one date bucket and adds them to the
+ * partial indexes. Only touches the partial, so workers can fill different
+ * partials concurrently.
+ *
+ * @param date the date of the bucket
+ * @param bucket the json array of its transactions
+ */
+void IndexPartial::addBucket(const std::string& date, const json& bucket) {
+    std::vector<Transaction> converted;
+    converted.reserve(bucket.size());
+    for (const auto& tx : bucket)
+        converted.emplace_back(tx);
+    addBucket(date, converted);
+}
+
+/**
+ * @brief Adds the already converted transactions of one date bucket to the
+ * partial indexes.
+ *
+ * @param date the date of the bucket
+ * @param bucket its transactions
+ */
+void IndexPartial::addBucket(const std::string& date, std::vector<Transaction>& bucket) {
+    int day = dayNumber(date);
+    std::vector<TransactionId>& dateIds = byDate.emplace_back(date, std::vector<TransactionId>()).second;
+    for (const Transaction& txObj : bucket) {
+        if (!txObj.tags.empty())
+            rowTags.emplace_back(columns.size(), txObj.tags);
+        columns.append(txObj, day);
+        descriptions.add(txObj.description);
+        byCategory[txObj.category].push_back(txObj.id);
+        byWallet[txObj.wallet].push_back(txObj.id);
+        dateIds.push_back(txObj.id);
+        byAmount.emplace_back(txObj.amount, txObj.id);
+    }
+}
+
+/**
+ * @brief Appends the rows of a partial to the columns, remapping its interned
+ * category and wallet ids to the global ones, and sets its tag bits. The rows
+ * are added to rowsById by finishRows.
+ */
+void IndexManager::mergeRows(const IndexPartial& partial) {
+    const TransactionColumns& part = partial.columns;
+    const size_t offset = columns.size();
+    const size_t count = part.size();
+    std::vector<int> categoryMap, walletMap;
+    for (const std::string& name : part.categoryNames)
+        categoryMap.push_back(internName(columns.categoryNames, name));
+    for (const std::string& name : part.walletNames)
+        walletMap.push_back(internName(columns.walletNames, name));
+
+    columns.ids.append(part.ids.data(), count);
+    columns.amounts.append(part.amounts.data(), count);
+    columns.days.append(part.days.data(), count);
+    columns.weekdays.append(part.weekdays.data(), count);
+    columns.descriptionLengths.append(part.descriptionLengths.data(), count);
+    std::vector<int> mapped(count);
+    for (size_t row = 0; row < count; row++)
+        mapped[row] = categoryMap[static_cast<size_t>(part.categories[row])];
+    columns.categories.append(mapped.data(), count);
+    for (size_t row = 0; row < count; row++)
+        mapped[row] = walletMap[static_cast<size_t>(part.wallets[row])];
+    columns.wallets.append(mapped.data(), count);
+    mapped.clear();
+    for (const auto& [date, ids] : partial.byDate)
+        mapped.insert(mapped.end(), ids.size(), internName(columns.dateNames, date));
+    columns.dates.append(mapped.data(), count);
+
+    auto tagged = partial.rowTags.begin();
+    for (size_t row = 0; row < count; row++) {
+        if (tagged != partial.rowTags.end() && tagged->first == row) {
+            columns.tags.push_back(tagged->second.data(), tagged->second.size());
+            addTags(tagged->second, offset + row);
+            ++tagged;
+        } else {
+            columns.tags.push_back(nullptr, 0);
         }
+        stagedRows.emplace_back(part.ids[row], offset + row);
     }
-    isIdIdxPopulated = true;
+    columns.descriptions.append(partial.descriptions);
+}
+
+/**
+ * @brief Adds the postings of a partial to the staged ones, until finishMerge.
+ */
+void IndexManager::stagePostings(const IndexPartial& partial) {
+    for (const auto& [category, ids] : partial.byCategory) {
+        std::vector<TransactionId>& staging = staged.byCategory[category];
+        staging.insert(staging.end(), ids.begin(), ids.end());
+    }
+    for (const auto& [wallet, ids] : partial.byWallet) {
+        std::vector<TransactionId>& staging = staged.byWallet[wallet];
+        staging.insert(staging.end(), ids.begin(), ids.end());
+    }
+    staged.byDate.insert(staged.byDate.end(), partial.byDate.begin(), partial.byDate.end());
+    staged.byAmount.insert(staged.byAmount.end(), partial.byAmount.begin(), partial.byAmount.end());
+}
+
+/**
+ * @brief Fills rowsById from the merged rows. A repeated id keeps its first
+ * row, the later ones are removed.
+ */
+void IndexManager::finishRows() {
+    std::sort(stagedRows.begin(), stagedRows.end());
+    size_t kept = 0;
+    for (size_t i = 0; i < stagedRows.size(); i++) {
+        if (kept > 0 && stagedRows[kept - 1].first == stagedRows[i].first)
+            columns.remove(static_cast<size_t>(stagedRows[i].second));
+        else
+            stagedRows[kept++] = stagedRows[i];
+    }
+    stagedRows.resize(kept);
+    std::vector<std::pair<TransactionId, std::uint64_t>> rows;
+    rows.swap(stagedRows);
+    for (const auto& entry : columns.rowsById)
+        rows.push_back(entry);
+    std::sort(rows.begin(), rows.end());
+    columns.rowsById.assign(rows);
+}
+
+/**
+ * @brief Adds the staged category postings.
+ */
+void IndexManager::finishCategories() {
+    auto& index = transactionsByCategory.write();
+    for (auto& [category, ids] : staged.byCategory)
+        addPostings(index[category], std::move(ids));
+}
+
+/**
+ * @brief Adds the staged wallet postings.
+ */
+void IndexManager::finishWallets() {
+    auto& index = transactionsByWallet.write();
+    for (auto& [wallet, ids] : staged.byWallet)
+        addPostings(index[wallet], std::move(ids));
+}
+
+/**
+ * @brief Adds the staged date postings to the hashed date index.
+ */
+void IndexManager::finishDateHash() {
+    auto& index = transactionsByDateHashed.write();
+    for (const auto& [date, ids] : staged.byDate)
+        addPostings(index[date], ids);
+}
+
+/**
+ * @brief Adds the staged date postings to the ordered date index.
+ */
+void IndexManager::finishDateMap() {
+    auto& index = transactionsByDateMap.write();
+    for (const auto& [date, ids] : staged.byDate)
+        addPostings(index[date], ids);
+}
+
+/**
+ * @brief Sorts the staged amounts into the amount index.
+ */
+void IndexManager::finishAmounts() {
+    std::vector<std::pair<int, TransactionId>>& entries = staged.byAmount;
+    entries.insert(entries.end(), transactionsByAmount.begin(), transactionsByAmount.end());
+    std::sort(entries.begin(), entries.end());
+    transactionsByAmount.assign(entries);
+}
+
+/**
+ * @brief Merges the partials built by the workers: the rows are appended by
+ * one task while another stages the postings, then finishMerge completes
+ * each index in its own task. Partials are always visited in bucket order so
+ * the result is the same as a serial build.
+ *
+ * @param partials the partial indexes, in bucket order
+ */
+void IndexManager::mergePartials(std::vector<IndexPartial>& partials) {
+    std::vector<std::function<void()>> merges;
+    merges.push_back([this, &partials]() {
+        for (const IndexPartial& partial : partials)
+            mergeRows(partial);
+    });
+    merges.push_back([this, &partials]() {
+        for (const IndexPartial& partial : partials)
+            stagePostings(partial);
+    });
+    Executor::shared().runAll(merges);
+    finishMerge();
+}
+
+/**
+ * @brief Merges a single partial, for builders that receive the partials one
+ * at a time. finishMerge must be called after the last one.
+ *
+ * @param partial the next partial, in bucket order
+ */
+void IndexManager::mergePartial(IndexPartial& partial) {
+    mergeRows(partial);
+    stagePostings(partial);
+}
+
+/**
+ * @brief Completes a build made of merged partials: sorts the staged postings
+ * into the indexes, one task per index, and marks the indexes as populated.
+ */
+void IndexManager::finishMerge() {
+    Executor::shared().runAll({
+        [this]() { finishRows(); },
+        [this]() { finishCategories(); },
+        [this]() { finishWallets(); },
+        [this]() { finishDateHash(); },
+        [this]() { finishDateMap(); },
+        [this]() { finishAmounts(); },
+    });
+    staged = IndexPartial();
     isWalletIdxPopulated = true;
     isCategoryIdxPopulated = true;
     isDateHashPopulated = true;
     isDateMapPopulated = true;
+    isAmountIdxPopulated = true;
+    isColumnsPopulated = true;
+}
+
+/**
+ * @brief Adds the category and its parents to the category vocabulary.
+ */
+void IndexManager::addCategoryWords(const std::string& category) {
+    // parent categories are valid names even without transactions of their own
+    for (size_t slash = category.find('/'); slash != std::string::npos; slash = category.find('/', slash + 1))
+        categoryVocabulary.insert(category.substr(0, slash));
+    categoryVocabulary.insert(category);
+}
+
+/**
+ * @brief Adds a newly stored transaction to every index that is currently
+ * built, so a long-lived process does not have to rebuild them after a write.
+ * A record with the same id is removed first. Only the chunks and postings
+ * the transaction lands in are copied, new names go into the vocabularies.
+ *
+ * @param transaction the transaction, with its date set
+ */
+void IndexManager::addTransaction(const Transaction& transaction) {
+    if (!isColumnsPopulated)
+        return;
+    const TransactionId id = transaction.id;
+    removeTransaction(id);
+    const size_t row = columns.append(transaction, dayNumber(transaction.date));
+    columns.rowsById.insert({id, row});
+    addTags(transaction.tags, row);
+    if (isWalletIdxPopulated) {
+        Postings& ids = transactionsByWallet.write()[transaction.wallet];
+        if (ids.empty() && isWalletVocabPopulated)
+            walletVocabulary.insert(transaction.wallet);
+        ids.insert(id);
+    }
+    if (isCategoryIdxPopulated) {
+        Postings& ids = transactionsByCategory.write()[transaction.category];
+        if (ids.empty() && isCategoryVocabPopulated)
+            addCategoryWords(transaction.category);
+        ids.insert(id);
+    }
+    if (isDateHashPopulated)
+        transactionsByDateHashed.write()[transaction.date].insert(id);
+    if (isDateMapPopulated)
+        transactionsByDateMap.write()[transaction.date].insert(id);
+    if (isAmountIdxPopulated)
+        transactionsByAmount.insert({transaction.amount, id});
+    if (isTextIdxPopulated)
+        addText(id, transaction.description);
+}
+
+/**
+ * @brief Removes a deleted transaction from every index that is currently
+ * built. Its row stays in the columns, marked as removed. A vocabulary goes
+ * stale only when a name loses its last transaction.
+ *
+ * @param id the transaction
+ * @return bool false if the indexes are not built or do not have it
+ */
+bool IndexManager::removeTransaction(TransactionId id) {
+    if (!isColumnsPopulated)
+        return false;
+    const std::optional<size_t> row = columns.rowOf(id);
+    if (!row)
+        return false;
+    if (isWalletIdxPopulated && removePosting(transactionsByWallet, columns.wallet(*row), id))
+        isWalletVocabPopulated = false;
+    if (isCategoryIdxPopulated && removePosting(transactionsByCategory, columns.category(*row), id))
+        isCategoryVocabPopulated = false;
+    if (isDateHashPopulated)
+        removePosting(transactionsByDateHashed, columns.date(*row), id);
+    if (isDateMapPopulated)
+        removePosting(transactionsByDateMap, columns.date(*row), id);
+    if (isAmountIdxPopulated)
+        transactionsByAmount.erase({columns.amounts[*row], id});
+    if (isTextIdxPopulated)
+        removeText(id, columns.descriptions.get(*row));
+    columns.remove(*row);
+    return true;
+}
+
+/**
+ * @brief Empties every index.
+ */
+void IndexManager::clearAll() {
+    columns.clear();
+    transactionsByWallet.reset();
+    transactionsByCategory.reset();
+    transactionsByDateHashed.reset();
+    transactionsByDateMap.reset();
+    transactionsByAmount.clear();
+    transactionsByToken.clear();
+    transactionsByTrigram.clear();
+    transactionsByTag.clear();
+    staged = IndexPartial();
+    stagedRows.clear();
+    invalidate();
+}
+
+/**
+ * @brief Marks every index as stale after the transactions were modified,
+ * so the next query rebuilds them.
+ */
+void IndexManager::invalidate() {
+    isWalletIdxPopulated = false;
+    isCategoryIdxPopulated = false;
+    isDateHashPopulated = false;
+    isDateMapPopulated = false;
+    isAmountIdxPopulated = false;
+    isTextIdxPopulated = false;
+    isColumnsPopulated = false;
+    isCategoryVocabPopulated = false;
+    isWalletVocabPopulated = false;
+    isTokenVocabPopulated = false;
+}
+
+/**
+ * @brief populates ALL indexes
+ *
+ * The date buckets are split in contiguous runs of roughly the same number of
+ * transactions, one per thread of the shared executor. Each task converts its
+ * buckets and builds its own partial indexes, which are then merged in parallel
+ * (one task per index). Small ledgers are built by a single worker on the calling thread.
+ * 
+ * @param buckets 
+ */
+void IndexManager::populateAllIdxs(const DateBuckets& buckets) {
+    clearAll();
+
+    std::vector<std::pair<const std::string*, const json*>> runs;
+    size_t total = 0;
+    for (const auto& [date, txList] : buckets) {
+        runs.emplace_back(&date, txList.get());
+        total += txList->size();
+    }
+
+    const size_t minTransactionsPerWorker = 1 << 14;
+    Executor& executor = Executor::shared();
+    size_t workers = std::min<size_t>(executor.concurrency(),
+                                      std::max<size_t>(1, total / minTransactionsPerWorker));
+    workers = std::min(workers, std::max<size_t>(1, runs.size()));
+
+    // contiguous bucket runs of about total / workers transactions each
+    std::vector<size_t> bounds{0};
+    size_t seen = 0;
+    for (size_t b = 0; b < runs.size() && bounds.size() < workers; b++) {
+        seen += runs[b].second->size();
+        if (seen * workers >= total * bounds.size())
+            bounds.push_back(b + 1);
+    }
+    bounds.push_back(runs.size());
+
+    std::vector<IndexPartial> partials(bounds.size() - 1);
+    std::vector<std::function<void()>> builds;
+    for (size_t w = 0; w + 1 < bounds.size(); w++) {
+        builds.push_back([&runs, &bounds, &partials, w]() {
+            for (size_t b = bounds[w]; b < bounds[w + 1]; b++)
+                partials[w].addBucket(*runs[b].first, *runs[b].second);
+        });
+    }
+    executor.runAll(builds);
+    mergePartials(partials);
 }
 
 /**
@@ -137,13 +913,13 @@ void IndexManager::populateAllIdxs(json& transactions) {
  * @param b The second unordered set.
  * @return A new unordered set containing the intersection of sets a and b.
  */
-std::unordered_set<int> IndexManager::twoSetIntersection(const std::unordered_set<int>& a, const std::unordered_set<int>& b) {
-    std::unordered_set<int> result;
+std::unordered_set<TransactionId> IndexManager::twoSetIntersection(const std::unordered_set<TransactionId>& a, const std::unordered_set<TransactionId>& b) {
+    std::unordered_set<TransactionId> result;
 
     const auto& smaller = a.size() < b.size() ? a : b;
-    const auto& larger = a.size() > b.size() ? a : b;
+    const auto& larger = a.size() < b.size() ? b : a;
 
-    for (int val : smaller) {
+    for (TransactionId val : smaller) {
         if (larger.count(val)) {
             result.insert(val);
         }
@@ -157,22 +933,283 @@ std::unordered_set<int> IndexManager::twoSetIntersection(const std::unordered_se
  *
  * Given a vector of unordered sets, this function returns a new set
  * containing only the elements common to all input sets.
- * It performs pairwise intersections starting from the first set.
- * It is NOT optimal. ordering the sets from smallest to biggest would be optimal !!!!!
+ * It performs pairwise intersections from the smallest set to the biggest,
+ * so every step works on the smallest possible intermediate result.
  *
  * @param sets A vector containing the unordered sets to intersect.
  * @return A new unordered set representing the common elements among all sets.
  */
-std::unordered_set<int> IndexManager::setIntersection(const std::vector<std::unordered_set<int>>& sets) {
+std::unordered_set<TransactionId> IndexManager::setIntersection(const std::vector<std::unordered_set<TransactionId>>& sets) {
     if (sets.empty()) return {};
     size_t nr_sets = sets.size();
 
-    std::unordered_set<int> result = sets[0];
+    std::vector<const std::unordered_set<TransactionId>*> ordered;
+    for (const auto& set : sets)
+        ordered.push_back(&set);
+    std::sort(ordered.begin(), ordered.end(),
+              [](const std::unordered_set<TransactionId>* a, const std::unordered_set<TransactionId>* b) { return a->size() < b->size(); });
+
+    std::unordered_set<TransactionId> result = *ordered[0];
     if (nr_sets == 1) return result;
 
-    for (size_t i = 1; i < nr_sets; i++) {
-        result = twoSetIntersection(result, sets[i]);
+    for (size_t i = 1; i < nr_sets && !result.empty(); i++) {
+        result = twoSetIntersection(result, *ordered[i]);
     }
 
     return result;
 }
+
+/**
+ * @brief Computes the intersection of multiple unordered sets, keeping only the
+ * ids whose row is selected in the mask.
+ *
+ * This is how the column filters are combined with the index postings. With no
+ * sets at all, every row selected by the mask is returned.
+ *
+ * @param sets A vector containing the unordered sets to intersect.
+ * @param mask Selection mask over the rows of the columns.
+ * @return A new unordered set with the common elements whose row is selected.
+ */
+std::unordered_set<TransactionId> IndexManager::setIntersection(const std::vector<std::unordered_set<TransactionId>>& sets, const SelectionMask& mask) {
+    std::unordered_set<TransactionId> result;
+    if (sets.empty()) {
+        for (size_t w = 0; w < mask.size(); w++) {
+            for (std::uint64_t word = mask[w]; word; word &= word - 1)
+                result.insert(columns.ids[w * 64 + static_cast<size_t>(std::countr_zero(word))]);
+        }
+        return result;
+    }
+
+    for (TransactionId id : setIntersection(sets)) {
+        std::optional<size_t> row = columns.rowOf(id);
+        if (row && maskTest(mask, *row))
+            result.insert(id);
+    }
+    return result;
+}
+
+/**
+ * @brief Combines the tag bitmaps: rows with every tag of allTags, at least one
+ * tag of anyTags (when not empty) and none of noTags. Everything is done a
+ * 64 bit word at a time.
+ *
+ * @param allTags tag ids that are all required
+ * @param anyTags tag ids of which at least one is required
+ * @param noTags tag ids that are excluded
+ * @return SelectionMask the selected rows
+ */
+SelectionMask IndexManager::tagMask(const std::vector<int>& allTags, const std::vector<int>& anyTags, const std::vector<int>& noTags) {
+    const size_t rows = columns.size();
+    // the bitmaps stop at the last row that has the tag
+    auto bitmap = [this, rows](int tag) {
+        SelectionMask mask = emptyMask(rows);
+        if (tag >= 0 && static_cast<size_t>(tag) < transactionsByTag.size()) {
+            const SharedColumns::RowBitmap& words = transactionsByTag[static_cast<size_t>(tag)];
+            for (size_t w = 0; w < words.size(); w++)
+                mask[w] = words[w];
+        }
+        return mask;
+    };
+
+    SelectionMask mask = fullMask(rows);
+    for (int tag : allTags)
+        maskAnd(mask, bitmap(tag));
+    if (!anyTags.empty()) {
+        SelectionMask any = emptyMask(rows);
+        for (int tag : anyTags)
+            maskOr(any, bitmap(tag));
+        maskAnd(mask, any);
+    }
+    for (int tag : noTags) {
+        const SelectionMask excluded = bitmap(tag);
+        for (size_t w = 0; w < mask.size(); w++)
+            mask[w] &= ~excluded[w];
+    }
+    return mask;
+}
+
+/**
+ * @brief Converts a set of ids (index postings) into a selection mask over the rows.
+ *
+ * @param ids the ids to select
+ * @return SelectionMask with the rows of those ids selected
+ */
+SelectionMask IndexManager::postingsMask(const std::unordered_set<TransactionId>& ids) {
+    SelectionMask mask = emptyMask(columns.size());
+    for (TransactionId id : ids) {
+        if (std::optional<size_t> row = columns.rowOf(id))
+            maskSet(mask, *row);
+    }
+    return mask;
+}
+
+/**
+ * @brief Finds the transactions whose amount is in [minAmount, maxAmount].
+ *
+ * The amount index is sorted by amount, so both ends of the range are found
+ * with a binary search and only the matching entries are visited.
+ *
+ * @param minAmount lowest amount in cents (inclusive)
+ * @param maxAmount highest amount in cents (inclusive)
+ * @return A new unordered set with the ids of the matching transactions.
+ */
+std::unordered_set<TransactionId> IndexManager::amountRange(int minAmount, int maxAmount) {
+    std::unordered_set<TransactionId> result;
+    if (minAmount > maxAmount)
+        return result;
+
+    auto low = transactionsByAmount.lower_bound(std::make_pair(minAmount, std::numeric_limits<TransactionId>::min()));
+    auto high = transactionsByAmount.upper_bound(std::make_pair(maxAmount, std::numeric_limits<TransactionId>::max()));
+    result.reserve(static_cast<size_t>(high - low));
+    for (auto it = low; it != high; ++it)
+        result.insert(it->second);
+    return result;
+}
+
+/**
+ * @brief Finds the transactions of a category and of all its subcategories.
+ *
+ * Categories are paths like "food/groceries/organic". In the ordered category
+ * index every descendant of "food" sorts between "food/" and "food0" ('0' is
+ * the character after '/'), so a subtree is the exact key plus one contiguous
+ * range and no other category key is visited.
+ *
+ * @param category the root of the subtree
+ * @return A new unordered set with the ids of the matching transactions.
+ */
+std::unordered_set<TransactionId> IndexManager::categorySubtree(const std::string& category) {
+    std::unordered_set<TransactionId> result;
+    auto exact = transactionsByCategory->find(category);
+    if (exact != transactionsByCategory->end())
+        result.insert(exact->second.begin(), exact->second.end());
+
+    auto low = transactionsByCategory->lower_bound(category + '/');
+    auto high = transactionsByCategory->lower_bound(category + static_cast<char>('/' + 1));
+    for (auto it = low; it != high; ++it)
+        result.insert(it->second.begin(), it->second.end());
+    return result;
+}
+
+/**
+ * @brief Finds the transactions whose description contains the given text
+ * (case-insensitive).
+ *
+ * Queries of 3 or more characters intersect the postings of every trigram of
+ * the query, smallest first, and then check the few remaining candidates.
+ * Shorter queries are matched against the token vocabulary instead.
+ *
+ * @param text the text to look for
+ * @return A new unordered set with the ids of the matching transactions.
+ */
+std::unordered_set<TransactionId> IndexManager::searchText(const std::string& text) {
+    std::unordered_set<TransactionId> result;
+    std::string query = foldCase(text);
+    if (query.empty())
+        return result;
+
+    if (query.size() < 3) {
+        transactionsByToken.forEach([&query, &result](const std::string& token, const Postings& ids) {
+            if (token.find(query) != std::string::npos)
+                result.insert(ids.begin(), ids.end());
+        });
+        return result;
+    }
+
+    std::vector<const Postings*> postings;
+    for (size_t i = 0; i + 3 <= query.size(); i++) {
+        const Postings* ids = transactionsByTrigram.find(trigramAt(query, i));
+        if (!ids)
+            return result;
+        postings.push_back(ids);
+    }
+    std::sort(postings.begin(), postings.end(),
+              [](const Postings* a, const Postings* b) { return a->size() < b->size(); });
+
+    std::vector<TransactionId> candidates(postings[0]->begin(), postings[0]->end());
+    std::vector<TransactionId> next;
+    for (size_t i = 1; i < postings.size() && !candidates.empty(); i++) {
+        next.clear();
+        std::set_intersection(candidates.begin(), candidates.end(), postings[i]->begin(), postings[i]->end(),
+                              std::back_inserter(next));
+        candidates.swap(next);
+    }
+
+    // trigrams only prove the pieces are there, not that they are in order
+    for (TransactionId id : candidates) {
+        std::optional<size_t> row = columns.rowOf(id);
+        if (row && foldCase(columns.descriptions.get(*row)).find(query) != std::string::npos)
+            result.insert(id);
+    }
+    return result;
+}
+
+/**
+ * @brief Builds the category vocabulary from the category index.
+ */
+void IndexManager::populateCategoryVocab() {
+    categoryVocabulary.clear();
+    for (const auto& [name, ids] : *transactionsByCategory)
+        addCategoryWords(name);
+    isCategoryVocabPopulated = true;
+}
+
+/**
+ * @brief Builds the wallet vocabulary from the wallet index.
+ */
+void IndexManager::populateWalletVocab() {
+    walletVocabulary.clear();
+    for (const auto& [name, ids] : *transactionsByWallet)
+        walletVocabulary.insert(name);
+    isWalletVocabPopulated = true;
+}
+
+/**
+ * @brief Builds the description word vocabulary from the token index.
+ */
+void IndexManager::populateTokenVocab() {
+    tokenVocabulary.clear();
+    transactionsByToken.forEach([this](const std::string& word, const Postings&) { tokenVocabulary.insert(word); });
+    isTokenVocabPopulated = true;
+}
+
+/**
+ * @brief Finds the categories within maxDistance edits of the given one.
+ * The category vocabulary is built from the category index on first use.
+ *
+ * @param category the (possibly misspelled) category
+ * @param maxDistance maximum edit distance of a suggestion
+ * @return (distance, category) pairs, closest first
+ */
+std::vector<std::pair<int, std::string>> IndexManager::suggestCategories(const std::string& category, int maxDistance) {
+    if (!isCategoryVocabPopulated)
+        populateCategoryVocab();
+    return categoryVocabulary.search(category, maxDistance);
+}
+
+/**
+ * @brief Finds the wallets within maxDistance edits of the given one.
+ * The wallet vocabulary is built from the wallet index on first use.
+ *
+ * @param wallet the (possibly misspelled) wallet
+ * @param maxDistance maximum edit distance of a suggestion
+ * @return (distance, wallet) pairs, closest first
+ */
+std::vector<std::pair<int, std::string>> IndexManager::suggestWallets(const std::string& wallet, int maxDistance) {
+    if (!isWalletVocabPopulated)
+        populateWalletVocab();
+    return walletVocabulary.search(wallet, maxDistance);
+}
+
+/**
+ * @brief Finds the description words within maxDistance edits of the given one.
+ * The word vocabulary is built from the token index on first use.
+ *
+ * @param token the (possibly misspelled) word, lowercase
+ * @param maxDistance maximum edit distance of a suggestion
+ * @return (distance, word) pairs, closest first
+ */
+std::vector<std::pair<int, std::string>> IndexManager::suggestTokens(const std::string& token, int maxDistance) {
+    if (!isTokenVocabPopulated)
+        populateTokenVocab();
+    return tokenVocabulary.search(foldCase(token), maxDistance);
+}
@@ -1,37 +1,236 @@
 #ifndef INDEXMANAGER_HPP
 #define INDEXMANAGER_HPP
 
+#include <cstdint>
+#include <memory>
+#include <optional>
 #include <unordered_map>
 #include <unordered_set>
 #include <map>
+#include <string_view>
+#include <vector>
 #include "transaction.hpp"
+#include "bktree.hpp"
+#include "chunked.hpp"
+#include "descriptions.hpp"
+#include "filter.hpp"
 #include "json.hpp"
 
 using json = nlohmann::json;
 
+/**
+* @struct
+* @brief Pointers to the values of consecutive rows in every column, from a
+* given row up to the end of its batch, for the filter programs.
+*/
+struct ColumnBatch {
+    const TransactionId* ids;
+    const int* amounts;
+    const int* days;
+    const int* weekdays;
+    const int* categories;
+    const int* wallets;
+    const int* descriptionLengths;
+};
+
+/**
+* @struct
+* @brief Column-wise copy of the transactions, one entry per row in every
+* vector, so that predicates can be evaluated over contiguous arrays.
+* Category and wallet names are stored as ids into the name tables.
+* Used for the partial builds and the out-of-core batches, the indexes keep
+* their rows in SharedColumns.
+*/
+struct TransactionColumns {
+    std::vector<TransactionId> ids;
+    std::vector<int> amounts;
+    std::vector<int> days;              // day numbers (days since 1970-01-01)
+    std::vector<int> weekdays;          // 1 = Monday ... 7 = Sunday
+    std::vector<int> categories;
+    std::vector<int> wallets;
+    std::vector<int> descriptionLengths;
+    std::vector<std::string> categoryNames;
+    std::vector<std::string> walletNames;
+    std::unordered_map<std::string, int> categoryIds;
+    std::unordered_map<std::string, int> walletIds;
+
+    size_t size() const { return ids.size(); }
+    void clear();
+    void append(const Transaction& transaction, int day);
+    int internCategory(const std::string& category);
+    int internWallet(const std::string& wallet);
+    ColumnBatch batch(size_t begin) const;
+};
+
+/**
+* @struct
+* @brief Interned names (categories, wallets, dates), an id per name in the
+* order they were first seen.
+*/
+struct NameTable {
+    std::vector<std::string> names;
+    std::unordered_map<std::string, int> ids;
+
+    int intern(const std::string& name);
+};
+
+/**
+* @class
+* @brief The indexed transactions, one row each, stored column-wise in chunks
+* of ROWS_PER_CHUNK rows that the versions of a ledger share.
+*
+* Rows are only ever appended. Removing a transaction marks its row as removed
+* and drops its id from rowsById, so the row numbers held by the tag bitmaps
+* and the filter masks stay valid. Appending copies the last chunk of each
+* column if it is shared, and a new name copies its name table.
+*/
+class SharedColumns {
+public:
+    template <typename T>
+    using Column = ChunkedVector<T, ROWS_PER_CHUNK>;
+    using RowBitmap = ChunkedVector<std::uint64_t, ROWS_PER_CHUNK / 64>;
+
+    Column<TransactionId> ids;
+    Column<int> amounts;
+    Column<int> days;               // day numbers (days since 1970-01-01)
+    Column<int> weekdays;           // 1 = Monday ... 7 = Sunday
+    Column<int> categories;         // ids into categoryNames
+    Column<int> wallets;            // ids into walletNames
+    Column<int> dates;              // ids into dateNames
+    Column<int> descriptionLengths;
+    ChunkedLists<int, ROWS_PER_CHUNK> tags;
+    DescriptionHeap descriptions;
+    CopyOnWrite<NameTable> categoryNames;
+    CopyOnWrite<NameTable> walletNames;
+    CopyOnWrite<NameTable> dateNames;
+    SortedChunks<std::pair<TransactionId, std::uint64_t>> rowsById; // (id, row) of every live row
+    RowBitmap removed;
+
+    size_t size() const { return ids.size(); }
+    size_t append(const Transaction& transaction, int day);
+    void remove(size_t row);
+    void clear();
+    std::optional<size_t> rowOf(TransactionId id) const;
+    bool isRemoved(size_t row) const { return row / 64 < removed.size() && (removed[row / 64] >> (row % 64) & 1); }
+    SelectionMask liveMask() const;
+    ColumnBatch batch(size_t begin) const;
+    Transaction transaction(size_t row) const;
+    const std::string& category(size_t row) const { return categoryNames->names[static_cast<size_t>(categories[row])]; }
+    const std::string& wallet(size_t row) const { return walletNames->names[static_cast<size_t>(wallets[row])]; }
+    const std::string& date(size_t row) const { return dateNames->names[static_cast<size_t>(dates[row])]; }
+};
+
+// postings of an index key: the ids of its transactions, sorted
+using Postings = SortedChunks<TransactionId>;
+
+// date buckets of the transaction file ("data"), each one shared by the
+// versions of the ledger that did not change it
+using DateBuckets = std::map<std::string, std::shared_ptr<const json>>;
+
+DateBuckets takeBuckets(json& document);
+
+/**
+* @struct
+* @brief Indexes built by one worker over a contiguous run of date buckets,
+* merged into the IndexManager once every worker is done. Row r of the
+* partial is row r of its columns, tags and descriptions.
+*/
+struct IndexPartial {
+    TransactionColumns columns;
+    std::vector<std::pair<size_t, std::vector<int>>> rowTags; // (row in columns, tag ids)
+    std::unordered_map<std::string, std::vector<TransactionId>> byCategory;
+    std::unordered_map<std::string, std::vector<TransactionId>> byWallet;
+    std::vector<std::pair<std::string, std::vector<TransactionId>>> byDate; // in row order
+    std::vector<std::pair<int, TransactionId>> byAmount;
+    DescriptionHeap descriptions;
+
+    void addBucket(const std::string& date, const json& bucket);
+    void addBucket(const std::string& date, std::vector<Transaction>& bucket);
+};
+
+/**
+* @class
+* @brief Every index over the transactions of a ledger.
+*
+* Copying an IndexManager is cheap: the columns, the postings of every key,
+* the text index and the vocabularies are all held in copy-on-write pieces,
+* so a copy shares them and a write to the copy only copies the pieces it
+* changes (a key's postings chunk, the last chunk of each column).
+*/
 class IndexManager {
 public:
-    std::unordered_map<int, Transaction> transactionsById;
-    std::unordered_map<std::string, std::unordered_set<int>> transactionsByWallet;
-    std::unordered_map<std::string, std::unordered_set<int>> transactionsByCategory;
-    std::unordered_map<std::string, std::unordered_set<int>> transactionsByDateHashed;
-    std::map<std::string, std::unordered_set<int>> transactionsByDateMap;
+    SharedColumns columns;
+    CopyOnWrite<std::unordered_map<std::string, Postings>> transactionsByWallet;
+    CopyOnWrite<std::map<std::string, Postings>> transactionsByCategory; // ordered, so subtrees are ranges
+    CopyOnWrite<std::unordered_map<std::string, Postings>> transactionsByDateHashed;
+    CopyOnWrite<std::map<std::string, Postings>> transactionsByDateMap;
+    SortedChunks<std::pair<int, TransactionId>> transactionsByAmount; // (amount, id)
+    ShardedMap<std::string, Postings> transactionsByToken;
+    ShardedMap<std::uint32_t, Postings> transactionsByTrigram;
+    std::vector<SharedColumns::RowBitmap> transactionsByTag; // per tag id, a bitmap over the rows
+    BKTree categoryVocabulary;
+    BKTree walletVocabulary;
+    BKTree tokenVocabulary;
 
-    bool isIdIdxPopulated = false;
     bool isWalletIdxPopulated = false;
     bool isCategoryIdxPopulated = false;
     bool isDateHashPopulated = false;
     bool isDateMapPopulated = false;
+    bool isAmountIdxPopulated = false;
+    bool isTextIdxPopulated = false;
+    bool isColumnsPopulated = false;
+    bool isCategoryVocabPopulated = false;
+    bool isWalletVocabPopulated = false;
+    bool isTokenVocabPopulated = false;
+
+    void populateWalletIdx(const DateBuckets& buckets);
+    void populateCategoryIndex(const DateBuckets& buckets);
+    void populateDateHash(const DateBuckets& buckets);
+    void populateDateMap(const DateBuckets& buckets);
+    void populateAmountIdx(const DateBuckets& buckets);
+    void populateTextIdx(const DateBuckets& buckets);
+    void populateColumns(const DateBuckets& buckets);
+    void populateAllIdxs(const DateBuckets& buckets);
+    void populateCategoryVocab();
+    void populateWalletVocab();
+    void populateTokenVocab();
+    void clearAll();
+    void invalidate();
+    void addTransaction(const Transaction& transaction);
+    bool removeTransaction(TransactionId id);
+    void mergePartials(std::vector<IndexPartial>& partials);
+    void mergePartial(IndexPartial& partial);
+    void finishMerge();
+    void addTags(const std::vector<int>& tags, size_t row);
+
+    std::unordered_set<TransactionId> twoSetIntersection(const std::unordered_set<TransactionId>& a, const std::unordered_set<TransactionId>& b);
+    std::unordered_set<TransactionId> setIntersection(const std::vector<std::unordered_set<TransactionId>>& sets);
+    std::unordered_set<TransactionId> setIntersection(const std::vector<std::unordered_set<TransactionId>>& sets, const SelectionMask& mask);
+    SelectionMask postingsMask(const std::unordered_set<TransactionId>& ids);
+    std::unordered_set<TransactionId> amountRange(int minAmount, int maxAmount);
+    std::unordered_set<TransactionId> categorySubtree(const std::string& category);
+    SelectionMask tagMask(const std::vector<int>& allTags, const std::vector<int>& anyTags, const std::vector<int>& noTags);
+    std::unordered_set<TransactionId> searchText(const std::string& text);
+
+    std::vector<std::pair<int, std::string>> suggestCategories(const std::string& category, int maxDistance);
+    std::vector<std::pair<int, std::string>> suggestWallets(const std::string& wallet, int maxDistance);
+    std::vector<std::pair<int, std::string>> suggestTokens(const std::string& token, int maxDistance);
 
-    void populateIdIdx(json& transactions);
-    void populateWalletIdx(json& transactions);
-    void populateCategoryIndex(json& transactions);
-    void populateDateHash(json& transactions);
-    void populateDateMap(json& transactions);
-    void populateAllIdxs(json& transactions);
+private:
+    IndexPartial staged; // postings of the merged partials, until finishMerge
+    std::vector<std::pair<TransactionId, std::uint64_t>> stagedRows; // (id, row) of the merged rows
 
-    std::unordered_set<int> twoSetIntersection(const std::unordered_set<int>& a, const std::unordered_set<int>& b);
-    std::unordered_set<int> setIntersection(const std::vector<std::unordered_set<int>>& sets);
+    void addCategoryWords(const std::string& category);
+    void addText(TransactionId id, std::string_view description);
+    void removeText(TransactionId id, std::string_view description);
+    void mergeRows(const IndexPartial& partial);
+    void stagePostings(const IndexPartial& partial);
+    void finishRows();
+    void finishCategories();
+    void finishWallets();
+    void finishDateHash();
+    void finishDateMap();
+    void finishAmounts();
 };
 
 #endif
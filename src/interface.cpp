@@ -1,73 +1,219 @@
 #include "interface.hpp"
+#include "utils.hpp"
+#include <algorithm>
 #include <cctype>
 #include <stdexcept>
 #include <iostream>
 
-void printResults(std::vector<Transaction>& results) {
-    for (const auto& transaction : results) {
-        std::cout << "Date: " << transaction.date << '\n';
-        std::cout << "ID: " << transaction.id << '\n';
-        std::cout << "Amount: " << std::fixed << std::setprecision(2) << transaction.amount / 100.0 << '\n';
-        std::cout << "Category: " << transaction.category << '\n';
-        std::cout << "Description: " << transaction.description << '\n';
-        std::cout << "Wallet: " << transaction.wallet << '\n';
-        std::cout << '\n';
+static void printTags(const Transaction& transaction, const std::vector<std::string>& tagNames) {
+    if (transaction.tags.empty())
+        return;
+    outStream() << "Tags: ";
+    for (size_t i = 0; i < transaction.tags.size(); i++) {
+        int tag = transaction.tags[i];
+        outStream() << (i ? ", " : "");
+        if (tag >= 0 && static_cast<size_t>(tag) < tagNames.size())
+            outStream() << tagNames[static_cast<size_t>(tag)];
+        else
+            outStream() << "#" << tag;
     }
+    outStream() << std::endl;
 }
 
-void printResultsGrouped(const std::string& groupBy, const std::unordered_map<std::string, std::vector<Transaction>>& groupedResults) {
+static void printTransaction(const Transaction& transaction, const std::vector<std::string>& tagNames) {
+    outStream() << "Date: " << transaction.date << '\n';
+    outStream() << "ID: " << transaction.id << '\n';
+    outStream() << "Amount: " << std::fixed << std::setprecision(2) << transaction.amount / 100.0 << '\n';
+    outStream() << "Category: " << transaction.category << '\n';
+    outStream() << "Description: " << transaction.description << '\n';
+    outStream() << "Wallet: " << transaction.wallet << '\n';
+    printTags(transaction, tagNames);
+    outStream() << '\n';
+}
+
+void printResults(const std::vector<Transaction>& results, const std::vector<std::string>& tagNames) {
+    for (const auto& transaction : results)
+        printTransaction(transaction, tagNames);
+}
+
+/**
+ * @brief Last stage of a streamed query: prints each row as soon as it is
+ * produced, in the same format as printResults.
+ *
+ * @param rows the transactions to print
+ * @param tagNames names of the tag ids
+ * @return size_t the number of rows printed
+ */
+size_t printStream(Generator<const Transaction*>& rows, const std::vector<std::string>& tagNames) {
+    size_t printed = 0;
+    for (const Transaction* transaction : rows) {
+        printTransaction(*transaction, tagNames);
+        printed++;
+    }
+    return printed;
+}
+
+void printResultsGrouped(const std::string& groupBy, const TransactionGroups& groupedResults, const std::vector<std::string>& tagNames) {
     if (groupBy == "date") {
-        printGroupedByDate(groupedResults);
+        printGroupedByDate(groupedResults, tagNames);
     } else if (groupBy == "category") {
-        printGroupedByCategory(groupedResults);
+        printGroupedByCategory(groupedResults, tagNames);
     } else if (groupBy == "wallet") {
-        printGroupedByWallet(groupedResults);
+        printGroupedByWallet(groupedResults, tagNames);
+    } else if (groupBy == "none") {
+        for (const auto& [key, transactions] : groupedResults)
+            printResults(transactions, tagNames);
     } else {
         throw std::runtime_error("Invalid grouping category: " + groupBy + "\n");
     }
 }
 
-void printGroupedByDate(const std::unordered_map<std::string, std::vector<Transaction>>& groupedResults) {
-    std::cout << "Expenses grouped by date: " << std::endl << std::endl;
+/**
+ * @brief Prints the title of a grouped listing.
+ */
+static void printGroupedTitle(const std::string& groupBy) {
+    if (groupBy == "date")
+        outStream() << "Expenses grouped by date: " << std::endl << std::endl;
+    else
+        outStream() << "Expenses grouped by " << groupBy << ": " << std::endl;
+}
+
+/**
+ * @brief Prints the header of one group of a grouped listing.
+ */
+static void printGroupHeader(const std::string& groupBy, const std::string& key) {
+    if (groupBy == "date")
+        outStream() << "Date: " << key << std::endl << std::endl;
+    else if (groupBy == "category")
+        outStream() << "Category: " << key << std::endl << std::endl;
+    else
+        outStream() << "Wallet: " << key << std::endl << std::endl;
+}
+
+/**
+ * @brief Prints one transaction of a grouped listing, without the field the
+ * listing is grouped by.
+ */
+static void printGroupedTransaction(const std::string& groupBy, const Transaction& transaction,
+                                    const std::vector<std::string>& tagNames) {
+    outStream() << "ID: " << transaction.id << std::endl;
+    if (groupBy != "date")
+        outStream() << "Date: " << transaction.date << std::endl;
+    outStream() << "Amount: " << std::fixed << std::setprecision(2) << transaction.amount / 100.0 << std::endl;
+    if (groupBy == "date")
+        outStream() << "Category: " << transaction.category << std::endl;
+    outStream() << "Description: " << transaction.description << std::endl;
+    if (groupBy == "wallet")
+        outStream() << "Category: " << transaction.category << std::endl;
+    else
+        outStream() << "Wallet: " << transaction.wallet << std::endl;
+    printTags(transaction, tagNames);
+    outStream() << std::endl;
+}
+
+static void printGrouped(const std::string& groupBy, const TransactionGroups& groupedResults,
+                         const std::vector<std::string>& tagNames) {
+    printGroupedTitle(groupBy);
     for (const auto& [key, transactions] : groupedResults) {
-        std::cout << "Date: " << key << std::endl << std::endl;
-        for (const auto& transaction : transactions) {
-            std::cout << "ID: " << transaction.id << std::endl;
-            std::cout << "Amount: " << std::fixed << std::setprecision(2) << transaction.amount / 100.0 << std::endl;
-            std::cout << "Category: " << transaction.category << std::endl;
-            std::cout << "Description: " << transaction.description << std::endl;
-            std::cout << "Wallet: " << transaction.wallet << std::endl;
-            std::cout << std::endl;
-        }
+        printGroupHeader(groupBy, key);
+        for (const auto& transaction : transactions)
+            printGroupedTransaction(groupBy, transaction, tagNames);
     }
 }
 
-void printGroupedByCategory(const std::unordered_map<std::string, std::vector<Transaction>>& groupedResults) {
-    std::cout << "Expenses grouped by category: " << std::endl;
-    for (const auto& [key, transactions] : groupedResults) {
-        std::cout << "Category: " << key << std::endl << std::endl;
-        for (const auto& transaction : transactions) {
-            std::cout << "ID: " << transaction.id << std::endl;
-            std::cout << "Date: " << transaction.date << std::endl;
-            std::cout << "Amount: " << std::fixed << std::setprecision(2) << transaction.amount / 100.0 << std::endl;
-            std::cout << "Description: " << transaction.description << std::endl;
-            std::cout << "Wallet: " << transaction.wallet << std::endl;
-            std::cout << std::endl;
+void printGroupedByDate(const TransactionGroups& groupedResults, const std::vector<std::string>& tagNames) {
+    printGrouped("date", groupedResults, tagNames);
+}
+
+void printGroupedByCategory(const TransactionGroups& groupedResults, const std::vector<std::string>& tagNames) {
+    printGrouped("category", groupedResults, tagNames);
+}
+
+void printGroupedByWallet(const TransactionGroups& groupedResults, const std::vector<std::string>& tagNames) {
+    printGrouped("wallet", groupedResults, tagNames);
+}
+
+/**
+ * @brief Prints streamed rows ordered by group key in the same format as
+ * printResultsGrouped, starting a new group whenever the key changes. Nothing
+ * is printed, not even the title, when there are no rows.
+ *
+ * @param groupBy "date", "category", "wallet" or "none"
+ * @param rows the transactions to print, ordered by group key
+ * @param tagNames names of the tag ids
+ * @return size_t the number of rows printed
+ */
+size_t printStreamGrouped(const std::string& groupBy, Generator<const Transaction*>& rows,
+                          const std::vector<std::string>& tagNames) {
+    if (groupBy == "none")
+        return printStream(rows, tagNames);
+    if (groupBy != "date" && groupBy != "category" && groupBy != "wallet")
+        throw std::runtime_error("Invalid grouping category: " + groupBy + "\n");
+
+    size_t printed = 0;
+    std::string key;
+    for (const Transaction* transaction : rows) {
+        const std::string& rowKey = groupBy == "date" ? transaction->date
+                                    : groupBy == "category" ? transaction->category : transaction->wallet;
+        if (printed == 0)
+            printGroupedTitle(groupBy);
+        if (printed == 0 || rowKey != key) {
+            key = rowKey;
+            printGroupHeader(groupBy, key);
         }
+        printGroupedTransaction(groupBy, *transaction, tagNames);
+        printed++;
     }
+    return printed;
 }
 
-void printGroupedByWallet(const std::unordered_map<std::string, std::vector<Transaction>>& groupedResults) {
-    std::cout << "Expenses grouped by wallet: " << std::endl;
-    for (const auto& [key, transactions] : groupedResults) {
-        std::cout << "Wallet: " << key << std::endl << std::endl;
-        for (const auto& transaction : transactions) {
-            std::cout << "ID: " << transaction.id << std::endl;
-            std::cout << "Date: " << transaction.date << std::endl;
-            std::cout << "Amount: " << std::fixed << std::setprecision(2) << transaction.amount / 100.0 << std::endl;
-            std::cout << "Description: " << transaction.description << std::endl;
-            std::cout << "Category: " << transaction.category << std::endl;
-            std::cout << std::endl;
-        }
+void printStats(bool income, bool tree, const std::map<std::string, AmountHistogram>& perCategory, const AmountHistogram& overall) {
+    outStream() << (income ? "Income" : "Expense") << " statistics by category: " << std::endl << std::endl;
+
+    // in tree mode '/' has to sort before every other character, so that
+    // food/groceries comes right after food and before food-court
+    std::vector<const std::string*> order;
+    for (const auto& [category, histogram] : perCategory)
+        order.push_back(&category);
+    if (tree) {
+        std::sort(order.begin(), order.end(), [](const std::string* a, const std::string* b) {
+            return std::lexicographical_compare(a->begin(), a->end(), b->begin(), b->end(), [](char x, char y) {
+                return (x == '/' ? '\0' : x) < (y == '/' ? '\0' : y);
+            });
+        });
+    }
+
+    for (const std::string* category : order) {
+        const AmountHistogram& histogram = perCategory.at(*category);
+        std::string indent;
+        if (tree)
+            indent.assign(2 * static_cast<size_t>(std::count(category->begin(), category->end(), '/')), ' ');
+        outStream() << indent << "Category: " << *category << std::endl;
+        outStream() << indent << "Count: " << histogram.count() << std::endl;
+        outStream() << indent << "Total: " << std::fixed << std::setprecision(2) << histogram.sum() / 100.0 << std::endl;
+        outStream() << indent << "Median: " << histogram.quantile(0.5) / 100.0 << std::endl;
+        outStream() << indent << "P90: " << histogram.quantile(0.9) / 100.0 << std::endl;
+        outStream() << indent << "P99: " << histogram.quantile(0.99) / 100.0 << std::endl;
+        outStream() << std::endl;
+    }
+
+    outStream() << "Overall: " << overall.count() << " transactions, median " << overall.quantile(0.5) / 100.0
+              << ", p90 " << overall.quantile(0.9) / 100.0 << ", p99 " << overall.quantile(0.99) / 100.0 << std::endl << std::endl;
+
+    // one row per power of two, the finer buckets are only used for the percentiles
+    outStream() << "Histogram of amounts: " << std::endl;
+    std::uint64_t biggestRow = 0;
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> rows;
+    for (std::uint64_t low = 1; low != 0 && low <= overall.max(); low <<= 1) {
+        if (low * 2 <= overall.min())
+            continue;
+        std::uint64_t count = overall.countBetween(low == 1 ? 0 : low, low * 2);
+        rows.emplace_back(low, count);
+        biggestRow = std::max(biggestRow, count);
+    }
+    for (const auto& [low, count] : rows) {
+        size_t bar = biggestRow == 0 ? 0 : static_cast<size_t>(count * 40 / biggestRow);
+        outStream() << std::setw(12) << (low == 1 ? 0 : low) / 100.0 << " - " << std::setw(12) << (low * 2) / 100.0
+                  << " | " << std::setw(8) << count << " " << std::string(bar, '#') << std::endl;
     }
 }
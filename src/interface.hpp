@@ -2,18 +2,24 @@
 #define INTERFACE_HPP
 
 #include "transaction.hpp"
+#include "generator.hpp"
+#include "stats.hpp"
 
 
 #include <vector>
 #include <unordered_map>
+#include <map>
 #include <QApplication>
 #include <QWidget>
 
-void printResults(std::vector<Transaction>& results);
-void printResultsGrouped(const std::string& groupBy, const std::unordered_map<std::string, std::vector<Transaction>>& groupedResults);
-void printGroupedByCategory(const std::unordered_map<std::string, std::vector<Transaction>>& groupedResults);
-void printGroupedByWallet(const std::unordered_map<std::string, std::vector<Transaction>>& groupedResults);
-void printGroupedByDate(const std::unordered_map<std::string, std::vector<Transaction>>& groupedResults);
+void printResults(const std::vector<Transaction>& results, const std::vector<std::string>& tagNames = {});
+size_t printStream(Generator<const Transaction*>& rows, const std::vector<std::string>& tagNames = {});
+size_t printStreamGrouped(const std::string& groupBy, Generator<const Transaction*>& rows, const std::vector<std::string>& tagNames = {});
+void printResultsGrouped(const std::string& groupBy, const TransactionGroups& groupedResults, const std::vector<std::string>& tagNames = {});
+void printGroupedByCategory(const TransactionGroups& groupedResults, const std::vector<std::string>& tagNames = {});
+void printGroupedByWallet(const TransactionGroups& groupedResults, const std::vector<std::string>& tagNames = {});
+void printGroupedByDate(const TransactionGroups& groupedResults, const std::vector<std::string>& tagNames = {});
+void printStats(bool income, bool tree, const std::map<std::string, AmountHistogram>& perCategory, const AmountHistogram& overall);
 
 void drawWindow();
 
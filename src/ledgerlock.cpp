@@ -0,0 +1,129 @@
+/**
+ * @file ledgerlock.cpp
+ * @brief Implementation file for the ledger lock file
+ *
+ */
+
+#include "ledgerlock.hpp"
+#include "utils.hpp"
+
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+/**
+ * @brief Width of each number in the lock file. Numbers are always rewritten
+ * in full, zero padded, so a read never sees half of one.
+ */
+static const size_t NUMBER_WIDTH = 20;
+
+LedgerLock::LedgerLock(const std::string& _path) : path(_path) {}
+
+LedgerLock::~LedgerLock() {
+    if (fd >= 0)
+        ::close(fd);
+}
+
+/**
+ * @brief Opens (creating if needed) the lock file.
+ */
+bool LedgerLock::open() {
+    if (fd >= 0)
+        return true;
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        errStream() << "Error: could not open lock file " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Waits for the lock. Taking it while already held converts it.
+ *
+ * @param exclusive true for a writer lock, false for a shared one
+ * @return bool false if the lock file cannot be opened or locked
+ */
+bool LedgerLock::lock(bool exclusive) {
+    if (!open())
+        return false;
+    int result;
+#ifdef F_OFD_SETLKW
+    struct flock request{};
+    request.l_type = exclusive ? F_WRLCK : F_RDLCK;
+    request.l_whence = SEEK_SET;
+    do {
+        result = ::fcntl(fd, F_OFD_SETLKW, &request);
+    } while (result != 0 && errno == EINTR);
+#else
+    do {
+        result = ::flock(fd, exclusive ? LOCK_EX : LOCK_SH);
+    } while (result != 0 && errno == EINTR);
+#endif
+    if (result != 0) {
+        errStream() << "Error: could not lock " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    held = true;
+    return true;
+}
+
+/**
+ * @brief Releases the lock.
+ */
+void LedgerLock::unlock() {
+    if (fd < 0 || !held)
+        return;
+#ifdef F_OFD_SETLK
+    struct flock request{};
+    request.l_type = F_UNLCK;
+    request.l_whence = SEEK_SET;
+    ::fcntl(fd, F_OFD_SETLK, &request);
+#else
+    ::flock(fd, LOCK_UN);
+#endif
+    held = false;
+}
+
+/**
+ * @brief Reads one of the numbers of the lock file (the generation or the id
+ * mark). Takes the shared lock for the read unless the lock is already held.
+ *
+ * @param slot the position of the number
+ * @return std::int64_t the number, 0 if it was never written, -1 on error
+ */
+std::int64_t LedgerLock::readNumber(size_t slot) {
+    bool wasHeld = held;
+    if (!wasHeld && !lock(false))
+        return -1;
+    char buffer[NUMBER_WIDTH + 1] = {};
+    ssize_t got = ::pread(fd, buffer, NUMBER_WIDTH, static_cast<off_t>(slot * NUMBER_WIDTH));
+    if (!wasHeld)
+        unlock();
+    if (got < 0)
+        return -1;
+    std::int64_t value = 0;
+    std::from_chars(buffer, buffer + got, value);
+    return value;
+}
+
+/**
+ * @brief Stores one of the numbers of the lock file. Must be called with the
+ * exclusive lock held.
+ *
+ * @param slot the position of the number
+ * @param value the new value, not negative
+ * @return bool false on a write error
+ */
+bool LedgerLock::writeNumber(size_t slot, std::int64_t value) {
+    char buffer[NUMBER_WIDTH + 1];
+    std::snprintf(buffer, sizeof(buffer), "%020lld", static_cast<long long>(value));
+    return ::pwrite(fd, buffer, NUMBER_WIDTH, static_cast<off_t>(slot * NUMBER_WIDTH)) ==
+           static_cast<ssize_t>(NUMBER_WIDTH);
+}
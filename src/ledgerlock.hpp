@@ -0,0 +1,74 @@
+/**
+ * @file ledgerlock.hpp
+ * @brief Header file for the ledger lock file, which serializes commits of
+ * concurrent writer processes and holds the ledger generation number
+ *
+ */
+
+#ifndef LEDGERLOCK_HPP
+#define LEDGERLOCK_HPP
+
+#include <cstdint>
+#include <string>
+
+/**
+* @class
+* @brief Advisory lock on a small file next to the ledger. The file holds the
+* generation number of the ledger, bumped by every commit, which lets writers
+* detect that the ledger changed since they loaded it, and the highest
+* transaction id reserved by any process.
+*
+* Locks are OFD locks where available (flock otherwise), which belong to the
+* open file description, so they work the same between threads of a process
+* and between processes.
+*/
+class LedgerLock {
+public:
+    explicit LedgerLock(const std::string& path);
+    ~LedgerLock();
+    LedgerLock(const LedgerLock&) = delete;
+    LedgerLock& operator=(const LedgerLock&) = delete;
+
+    bool lock(bool exclusive);
+    void unlock();
+    bool isHeld() const { return held; }
+
+    std::int64_t readGeneration() { return readNumber(GENERATION_SLOT); }
+    bool writeGeneration(std::int64_t generation) { return writeNumber(GENERATION_SLOT, generation); }
+    std::int64_t readIdMark() { return readNumber(ID_MARK_SLOT); }
+    bool writeIdMark(std::int64_t id) { return writeNumber(ID_MARK_SLOT, id); }
+
+    /**
+    * @class
+    * @brief Holds the exclusive lock for as long as it lives.
+    */
+    class Exclusive {
+    public:
+        explicit Exclusive(LedgerLock& ledgerLock) : owner(ledgerLock), locked(ledgerLock.lock(true)) {}
+        ~Exclusive() {
+            if (locked)
+                owner.unlock();
+        }
+        Exclusive(const Exclusive&) = delete;
+        Exclusive& operator=(const Exclusive&) = delete;
+        bool ok() const { return locked; }
+
+    private:
+        LedgerLock& owner;
+        bool locked;
+    };
+
+private:
+    static const size_t GENERATION_SLOT = 0;
+    static const size_t ID_MARK_SLOT = 1;
+
+    std::string path;
+    int fd = -1;
+    bool held = false;
+
+    bool open();
+    std::int64_t readNumber(size_t slot);
+    bool writeNumber(size_t slot, std::int64_t value);
+};
+
+#endif
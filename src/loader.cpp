@@ -0,0 +1,517 @@
+/**
+ * @file loader.cpp
+ * @brief Implementation file for the chunked loader of the data files
+ *
+ */
+
+#include "loader.hpp"
+#include "executor.hpp"
+#include "fastparser.hpp"
+#include "spscqueue.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief Smallest file worth splitting, below this a single json::parse is faster
+ * than scanning for the buckets first.
+ */
+static const size_t MIN_CHUNKED_SIZE = 1 << 20;
+
+/**
+ * @brief Approximate size of the text handed through the load pipeline at a time.
+ */
+static const size_t PIPELINE_BATCH_BYTES = 1 << 18;
+
+/**
+ * @brief Number of batches each pipeline queue can hold.
+ */
+static const size_t PIPELINE_QUEUE_CAPACITY = 8;
+
+/**
+ * @brief Skips a string starting at pos (which must be a quote).
+ *
+ * @return size_t the position right after the closing quote, npos if unterminated
+ */
+static size_t skipString(std::string_view text, size_t pos) {
+    pos++;
+    while (pos < text.size()) {
+        size_t quote = findQuoteOrEscape(text, pos);
+        if (quote == std::string_view::npos)
+            return std::string_view::npos;
+        if (text[quote] == '"')
+            return quote + 1;
+        pos = quote + 2; // skip the escaped character
+    }
+    return std::string_view::npos;
+}
+
+/**
+ * @brief Skips a whole json value without building it. Only the structure is
+ * followed (brackets and strings), the value itself is validated later by the
+ * real parser.
+ *
+ * @return size_t the position right after the value, npos if it is not terminated
+ */
+static size_t skipValue(std::string_view text, size_t pos) {
+    if (pos >= text.size())
+        return std::string_view::npos;
+    if (text[pos] == '"')
+        return skipString(text, pos);
+    if (text[pos] != '{' && text[pos] != '[') {
+        while (pos < text.size() && text[pos] != ',' && text[pos] != '}' && text[pos] != ']' && text[pos] != ' ' &&
+               text[pos] != '\n' && text[pos] != '\r' && text[pos] != '\t')
+            pos++;
+        return pos;
+    }
+
+    int depth = 0;
+    while ((pos = findBracketOrQuote(text, pos)) != std::string_view::npos) {
+        char c = text[pos];
+        if (c == '"') {
+            pos = skipString(text, pos);
+            if (pos == std::string_view::npos)
+                return pos;
+            continue;
+        }
+        if (c == '{' || c == '[') {
+            depth++;
+        } else if (--depth == 0) {
+            return pos + 1;
+        }
+        pos++;
+    }
+    return std::string_view::npos;
+}
+
+/**
+ * @brief Finds the members of the json object starting at begin, without
+ * parsing their values.
+ *
+ * @param text the whole json text
+ * @param begin position of the opening brace
+ * @param members filled with the key and value span of every member
+ * @return size_t the position right after the closing brace, npos if the text
+ * is not shaped like an object
+ */
+size_t scanObjectMembers(std::string_view text, size_t begin, std::vector<MemberSpan>& members) {
+    size_t pos = skipSpaces(text, begin);
+    if (pos >= text.size() || text[pos] != '{')
+        return std::string_view::npos;
+    pos = skipSpaces(text, pos + 1);
+    if (pos < text.size() && text[pos] == '}')
+        return pos + 1;
+
+    while (pos < text.size()) {
+        if (text[pos] != '"')
+            return std::string_view::npos;
+        size_t keyEnd = skipString(text, pos);
+        if (keyEnd == std::string_view::npos)
+            return keyEnd;
+        std::string_view rawKey = text.substr(pos, keyEnd - pos);
+        std::string key;
+        if (rawKey.find('\\') == std::string_view::npos)
+            key = rawKey.substr(1, rawKey.size() - 2);
+        else
+            key = json::parse(rawKey).get<std::string>();
+
+        pos = skipSpaces(text, keyEnd);
+        if (pos >= text.size() || text[pos] != ':')
+            return std::string_view::npos;
+        pos = skipSpaces(text, pos + 1);
+        size_t valueEnd = skipValue(text, pos);
+        if (valueEnd == std::string_view::npos || valueEnd == pos)
+            return std::string_view::npos;
+        members.push_back({std::move(key), pos, valueEnd});
+
+        pos = skipSpaces(text, valueEnd);
+        if (pos >= text.size())
+            return std::string_view::npos;
+        if (text[pos] == '}')
+            return pos + 1;
+        if (text[pos] != ',')
+            return std::string_view::npos;
+        pos = skipSpaces(text, pos + 1);
+    }
+    return std::string_view::npos;
+}
+
+/**
+ * @brief Parses the values of the given members, in order.
+ */
+static std::vector<json> parseMembers(const std::string& text, const std::vector<MemberSpan>& members, size_t first,
+                                      size_t last) {
+    std::vector<json> values;
+    values.reserve(last - first);
+    for (size_t i = first; i < last; i++)
+        values.push_back(json::parse(text.data() + members[i].begin, text.data() + members[i].end));
+    return values;
+}
+
+/**
+ * @brief Parses a data file, splitting the "data" object in its date buckets
+ * and parsing runs of buckets of about the same size as tasks of the shared
+ * executor.
+ * Everything else is parsed in place. Small files, and files that do not have
+ * the expected shape, are handed to json::parse as a whole, so malformed input
+ * is always reported by the real parser.
+ *
+ * @param text the file contents
+ * @return json the parsed document
+ * @throws json::parse_error on malformed input
+ */
+json parseChunked(const std::string& text) {
+    if (text.size() < MIN_CHUNKED_SIZE)
+        return json::parse(text);
+
+    std::vector<MemberSpan> members;
+    size_t end = scanObjectMembers(text, 0, members);
+    if (end == std::string_view::npos || skipSpaces(text, end) != text.size())
+        return json::parse(text);
+
+    json root = json::object();
+    for (const MemberSpan& member : members) {
+        std::vector<MemberSpan> buckets;
+        if (member.key != "data" || scanObjectMembers(text, member.begin, buckets) != member.end) {
+            root[member.key] = json::parse(text.data() + member.begin, text.data() + member.end);
+            continue;
+        }
+
+        Executor& executor = Executor::shared();
+        size_t chunkBytes = std::max<size_t>(1, (member.end - member.begin) / executor.concurrency() + 1);
+        std::vector<size_t> starts;
+        for (size_t first = 0; first < buckets.size();) {
+            size_t last = first;
+            size_t bytes = 0;
+            while (last < buckets.size() && (last == first || bytes < chunkBytes)) {
+                bytes += buckets[last].end - buckets[last].begin;
+                last++;
+            }
+            starts.push_back(first);
+            first = last;
+        }
+        starts.push_back(buckets.size());
+
+        std::vector<std::vector<json>> chunks(starts.size() - 1);
+        executor.parallelFor(0, chunks.size(), 1, [&](size_t firstChunk, size_t lastChunk) {
+            for (size_t c = firstChunk; c < lastChunk; c++)
+                chunks[c] = parseMembers(text, buckets, starts[c], starts[c + 1]);
+        });
+
+        json data = json::object();
+        json::object_t& object = data.get_ref<json::object_t&>();
+        for (size_t c = 0; c < chunks.size(); c++) {
+            for (size_t i = 0; i < chunks[c].size(); i++)
+                object.insert_or_assign(object.end(), buckets[starts[c] + i].key, std::move(chunks[c][i]));
+        }
+        root[member.key] = std::move(data);
+    }
+    return root;
+}
+
+/**
+ * @brief Adds the counters of another thread of the same stage.
+ */
+void StageReport::add(const StageReport& other) {
+    threads += other.threads;
+    batches += other.batches;
+    records += other.records;
+    bytes += other.bytes;
+    busySeconds += other.busySeconds;
+    stalls += other.stalls;
+    stallSeconds += other.stallSeconds;
+}
+
+/**
+ * @brief Prints one line per stage with its throughput (over the time it was
+ * busy, not waiting) and its stalls.
+ *
+ * @param out the stream to print to
+ */
+void LoadReport::print(std::ostream& out) const {
+    if (!pipelined) {
+        out << "load: not pipelined (unexpected file layout), " << std::fixed << std::setprecision(3) << seconds
+            << " s" << std::endl;
+        return;
+    }
+    out << "load: " << std::fixed << std::setprecision(3) << seconds << " s" << std::endl;
+    out << std::left << std::setw(10) << "stage" << std::right << std::setw(8) << "threads" << std::setw(9)
+        << "batches" << std::setw(11) << "records" << std::setw(10) << "MB/s" << std::setw(12) << "records/s"
+        << std::setw(10) << "busy s" << std::setw(8) << "stalls" << std::setw(10) << "stall s" << std::endl;
+    for (const StageReport& stage : stages) {
+        double busy = std::max(stage.busySeconds, 1e-9);
+        out << std::left << std::setw(10) << stage.name << std::right << std::setw(8) << stage.threads << std::setw(9)
+            << stage.batches << std::setw(11) << stage.records << std::setw(10) << std::setprecision(1)
+            << stage.bytes / busy / 1e6 << std::setw(12) << std::setprecision(0) << stage.records / busy
+            << std::setw(10) << std::setprecision(3) << stage.busySeconds << std::setw(8) << stage.stalls
+            << std::setw(10) << stage.stallSeconds << std::endl;
+    }
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Pushes into a pipeline queue, waiting while it is full.
+ *
+ * @return bool false if the pipeline failed while waiting
+ */
+template <typename T>
+static bool pushWaiting(SpscQueue<T>& queue, T& item, StageReport& stage, const std::atomic<bool>& failed) {
+    if (queue.tryPush(item))
+        return true;
+    auto start = std::chrono::steady_clock::now();
+    stage.stalls++;
+    while (!queue.tryPush(item)) {
+        if (failed.load(std::memory_order_relaxed))
+            return false;
+        std::this_thread::yield();
+    }
+    stage.stallSeconds += secondsSince(start);
+    return true;
+}
+
+/**
+ * @brief Pops from a pipeline queue, waiting while it is empty.
+ *
+ * @return bool false once the queue is closed and drained, or the pipeline failed
+ */
+template <typename T>
+static bool popWaiting(SpscQueue<T>& queue, T& out, StageReport& stage, const std::atomic<bool>& failed) {
+    if (queue.tryPop(out))
+        return true;
+    auto start = std::chrono::steady_clock::now();
+    stage.stalls++;
+    while (true) {
+        if (queue.tryPop(out))
+            break;
+        if (queue.isClosed()) {
+            // everything pushed before close is visible now
+            if (queue.tryPop(out))
+                break;
+            stage.stallSeconds += secondsSince(start);
+            return false;
+        }
+        if (failed.load(std::memory_order_relaxed))
+            return false;
+        std::this_thread::yield();
+    }
+    stage.stallSeconds += secondsSince(start);
+    return true;
+}
+
+/**
+* @struct
+* @brief A run of date buckets travelling through the load pipeline: parsed
+* into transactions by a parser thread, turned into partial indexes by a
+* converter thread, then merged by the index builder.
+*/
+struct LoadBatch {
+    size_t first = 0; // index of the first bucket of the batch
+    std::vector<std::vector<Transaction>> buckets;
+    IndexPartial partial;
+};
+
+/**
+ * @brief Parses one date bucket into transactions, with the schema-specialized
+ * parser when it fits and with nlohmann otherwise. Dates are left unset, they
+ * are the key of the bucket.
+ *
+ * @param text the json array of the bucket
+ * @return std::vector<Transaction> the transactions of the bucket
+ * @throws json::parse_error on malformed input
+ */
+std::vector<Transaction> parseBucket(std::string_view text) {
+    std::vector<Transaction> transactions;
+    if (parseTransactionBucket(text, transactions))
+        return transactions;
+    json bucket = json::parse(text.begin(), text.end());
+    transactions.reserve(bucket.size());
+    for (const auto& tx : bucket)
+        transactions.emplace_back(tx);
+    return transactions;
+}
+
+/**
+ * @brief Loads the transaction file through a pipeline, so parsing overlaps
+ * with conversion and index construction.
+ *
+ * The date buckets are located first (see scanObjectMembers) and cut into
+ * batches of about PIPELINE_BATCH_BYTES. Batches are dealt round robin to a
+ * few lanes, each one a parser thread feeding a converter thread through a
+ * bounded SPSC queue. Parsers decode buckets straight into Transaction records
+ * (see parseTransactionBucket). The converters build an IndexPartial per batch
+ * and hand it to the calling thread through a second queue; it takes batches
+ * back in order from the lanes and merges them into the indexes. Any error
+ * stops every stage and is rethrown here.
+ *
+ * No json document is built for the "data" object: when report.pipelined is
+ * set, the returned document holds every other member and the transactions
+ * only live in the indexes until someone parses the text again. Files that do
+ * not have the {"metadata": ..., "data": {date: [...]}} layout are parsed
+ * whole with parseChunked and left to the lazy index builds.
+ *
+ * @param text the contents of the transaction file
+ * @param indexes the index manager to populate
+ * @param report filled with the per-stage counters
+ * @return json the parsed document
+ * @throws json::parse_error on malformed input
+ */
+json loadPipelined(const std::string& text, IndexManager& indexes, LoadReport& report) {
+    auto loadStart = std::chrono::steady_clock::now();
+    StageReport scan{"scan"};
+    scan.threads = 1;
+    scan.bytes = text.size();
+
+    std::vector<MemberSpan> members;
+    std::vector<MemberSpan> buckets;
+    size_t end = scanObjectMembers(text, 0, members);
+    const MemberSpan* dataMember = nullptr;
+    if (end != std::string_view::npos && skipSpaces(text, end) == text.size()) {
+        for (const MemberSpan& member : members) {
+            if (member.key == "data")
+                dataMember = dataMember ? nullptr : &member;
+        }
+    }
+    if (!dataMember || scanObjectMembers(text, dataMember->begin, buckets) != dataMember->end) {
+        json document = parseChunked(text);
+        report.seconds = secondsSince(loadStart);
+        return document;
+    }
+
+    std::vector<size_t> batchStarts;
+    for (size_t b = 0, bytes = PIPELINE_BATCH_BYTES; b < buckets.size(); b++) {
+        if (bytes >= PIPELINE_BATCH_BYTES) {
+            batchStarts.push_back(b);
+            bytes = 0;
+        }
+        bytes += buckets[b].end - buckets[b].begin;
+    }
+    batchStarts.push_back(buckets.size());
+    const size_t batchCount = batchStarts.size() - 1;
+    scan.batches = batchCount;
+    scan.busySeconds = secondsSince(loadStart);
+
+    // the stages block on their queues, so they get their own threads instead
+    // of executor tasks, as many as the executor is configured for
+    const size_t hardware = Executor::shared().concurrency();
+    const size_t lanes = std::clamp<size_t>((hardware - 1) / 2, 1, std::max<size_t>(1, batchCount));
+
+    using BatchQueue = SpscQueue<std::unique_ptr<LoadBatch>>;
+    std::vector<std::unique_ptr<BatchQueue>> parsed, converted;
+    for (size_t lane = 0; lane < lanes; lane++) {
+        parsed.push_back(std::make_unique<BatchQueue>(PIPELINE_QUEUE_CAPACITY));
+        converted.push_back(std::make_unique<BatchQueue>(PIPELINE_QUEUE_CAPACITY));
+    }
+    std::vector<StageReport> parseStages(lanes, StageReport{"parse", 1}), convertStages(lanes, StageReport{"convert", 1});
+    StageReport build{"index", 1};
+
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto fail = [&]() {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!error)
+            error = std::current_exception();
+        failed.store(true);
+    };
+
+    auto parser = [&](size_t lane) {
+        StageReport& stage = parseStages[lane];
+        auto start = std::chrono::steady_clock::now();
+        try {
+            for (size_t batch = lane; batch < batchCount && !failed.load(std::memory_order_relaxed); batch += lanes) {
+                auto item = std::make_unique<LoadBatch>();
+                item->first = batchStarts[batch];
+                for (size_t b = batchStarts[batch]; b < batchStarts[batch + 1]; b++) {
+                    std::string_view bucket(text.data() + buckets[b].begin, buckets[b].end - buckets[b].begin);
+                    item->buckets.push_back(parseBucket(bucket));
+                    stage.records += item->buckets.back().size();
+                    stage.bytes += bucket.size();
+                }
+                stage.batches++;
+                if (!pushWaiting(*parsed[lane], item, stage, failed))
+                    break;
+            }
+        } catch (...) {
+            fail();
+        }
+        parsed[lane]->close();
+        stage.busySeconds = secondsSince(start) - stage.stallSeconds;
+    };
+
+    auto converter = [&](size_t lane) {
+        StageReport& stage = convertStages[lane];
+        auto start = std::chrono::steady_clock::now();
+        try {
+            std::unique_ptr<LoadBatch> item;
+            while (popWaiting(*parsed[lane], item, stage, failed)) {
+                for (size_t i = 0; i < item->buckets.size(); i++)
+                    item->partial.addBucket(buckets[item->first + i].key, item->buckets[i]);
+                stage.records += item->partial.columns.size();
+                stage.batches++;
+                if (!pushWaiting(*converted[lane], item, stage, failed))
+                    break;
+            }
+        } catch (...) {
+            fail();
+        }
+        converted[lane]->close();
+        stage.busySeconds = secondsSince(start) - stage.stallSeconds;
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t lane = 0; lane < lanes; lane++) {
+        threads.emplace_back(parser, lane);
+        threads.emplace_back(converter, lane);
+    }
+
+    json document = json::object();
+    auto buildStart = std::chrono::steady_clock::now();
+    try {
+        for (const MemberSpan& member : members) {
+            if (&member != dataMember)
+                document[member.key] = json::parse(text.data() + member.begin, text.data() + member.end);
+        }
+
+        indexes.clearAll();
+        std::unique_ptr<LoadBatch> item;
+        for (size_t batch = 0; batch < batchCount; batch++) {
+            if (!popWaiting(*converted[batch % lanes], item, build, failed))
+                break;
+            build.records += item->partial.columns.size();
+            build.batches++;
+            indexes.mergePartial(item->partial);
+        }
+        if (!failed.load())
+            indexes.finishMerge();
+    } catch (...) {
+        fail();
+    }
+    build.busySeconds = secondsSince(buildStart) - build.stallSeconds;
+
+    for (std::thread& thread : threads)
+        thread.join();
+    if (error) {
+        indexes.clearAll();
+        indexes.invalidate();
+        std::rethrow_exception(error);
+    }
+
+    StageReport parseTotal{"parse"}, convertTotal{"convert"};
+    for (size_t lane = 0; lane < lanes; lane++) {
+        parseTotal.add(parseStages[lane]);
+        convertTotal.add(convertStages[lane]);
+    }
+    report.pipelined = true;
+    report.stages = {scan, parseTotal, convertTotal, build};
+    report.seconds = secondsSince(loadStart);
+    return document;
+}
@@ -0,0 +1,68 @@
+/**
+ * @file loader.hpp
+ * @brief Header file for the chunked loader of the data files, which splits
+ * the transaction file at its date buckets and parses them concurrently
+ *
+ */
+
+#ifndef LOADER_HPP
+#define LOADER_HPP
+
+#include "indexmanager.hpp"
+#include "json.hpp"
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using json = nlohmann::json;
+
+/**
+* @struct
+* @brief Location of one member of a json object in the raw text: the decoded
+* key and the span of its value.
+*/
+struct MemberSpan {
+    std::string key;
+    size_t begin;
+    size_t end; // one past the last character of the value
+};
+
+/**
+* @struct
+* @brief Counters of one stage of the load pipeline, summed over its threads.
+* A stall is a wait on a full output queue or an empty input queue.
+*/
+struct StageReport {
+    std::string name;
+    size_t threads = 0;
+    size_t batches = 0;
+    size_t records = 0;
+    size_t bytes = 0;
+    double busySeconds = 0;
+    size_t stalls = 0;
+    double stallSeconds = 0;
+
+    void add(const StageReport& other);
+};
+
+/**
+* @struct
+* @brief What the load pipeline did, for tuning batch sizes and thread counts.
+*/
+struct LoadReport {
+    bool pipelined = false;
+    double seconds = 0;
+    std::vector<StageReport> stages;
+
+    void print(std::ostream& out) const;
+};
+
+size_t scanObjectMembers(std::string_view text, size_t begin, std::vector<MemberSpan>& members);
+std::vector<Transaction> parseBucket(std::string_view text);
+json parseChunked(const std::string& text);
+json loadPipelined(const std::string& text, IndexManager& indexes, LoadReport& report);
+
+#endif
@@ -0,0 +1,434 @@
+/**
+ * @file outofcore.cpp
+ * @brief Implementation file for the out-of-core queries
+ *
+ */
+
+#include "outofcore.hpp"
+#include "executor.hpp"
+#include "expression.hpp"
+#include "filter.hpp"
+#include "spill.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Bounds of the text parsed per batch, whatever the memory limit.
+ */
+static const size_t MIN_BATCH_BYTES = 1 << 16;
+static const size_t MAX_BATCH_BYTES = 1 << 26;
+
+/**
+ * @brief Maps the transaction file and reads its layout.
+ *
+ * @param _transactionFile path of the transaction file
+ * @param _memoryLimit bytes a query may hold in memory
+ * @throws std::runtime_error if the file cannot be mapped or does not have the
+ * {"metadata": ..., "data": {date: [...]}} layout
+ */
+OutOfCoreLedger::OutOfCoreLedger(const std::string& _transactionFile, size_t _memoryLimit)
+    : transactionFile(_transactionFile), memoryLimit(_memoryLimit) {
+    map();
+}
+
+OutOfCoreLedger::~OutOfCoreLedger() {
+    if (text)
+        ::munmap(const_cast<char*>(text), textSize);
+}
+
+void OutOfCoreLedger::map() {
+    int fd = ::open(transactionFile.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Error: could not open " + transactionFile + ": " + std::strerror(errno));
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        throw std::runtime_error("Error: could not read " + transactionFile + ".");
+    }
+    void* mapping = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("Error: could not map " + transactionFile + ": " + std::strerror(errno));
+    text = static_cast<const char*>(mapping);
+    textSize = static_cast<size_t>(info.st_size);
+    ::madvise(mapping, textSize, MADV_SEQUENTIAL);
+
+    std::string_view view(text, textSize);
+    std::vector<MemberSpan> members;
+    const MemberSpan* dataMember = nullptr;
+    if (scanObjectMembers(view, 0, members) != std::string_view::npos) {
+        for (const MemberSpan& member : members) {
+            if (member.key == "data")
+                dataMember = &member;
+            else if (member.key == "metadata")
+                metadata = json::parse(text + member.begin, text + member.end);
+        }
+    }
+    if (!dataMember || scanObjectMembers(view, dataMember->begin, buckets) != dataMember->end)
+        throw std::runtime_error("Error: " + transactionFile + " does not have the layout --memory-limit needs.");
+    release(0, textSize);
+}
+
+/**
+ * @brief Drops the pages of a range of the file from the mapping once it has
+ * been read. They stay in the page cache, which the kernel can reclaim.
+ */
+void OutOfCoreLedger::release(size_t begin, size_t end) const {
+    const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    begin = begin / page * page;
+    end = std::min(textSize, (end + page - 1) / page * page);
+    if (begin < end)
+        ::madvise(const_cast<char*>(text) + begin, end - begin, MADV_DONTNEED);
+}
+
+/**
+ * @brief Returns the tag names, indexed by tag id
+ *
+ * @return std::vector<std::string> the tag names
+ */
+std::vector<std::string> OutOfCoreLedger::getTagNames() const {
+    if (!metadata.is_object() || !metadata.contains("tags") || !metadata["tags"].is_array())
+        return {};
+    return metadata["tags"].get<std::vector<std::string>>();
+}
+
+/**
+ * @brief Whether a description contains the text, like IndexManager::searchText:
+ * texts shorter than 3 characters must be part of a single word.
+ *
+ * @param description the description
+ * @param folded the text, lowercased
+ */
+static bool containsText(const std::string& description, const std::string& folded) {
+    std::string text(description);
+    for (char& c : text)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    if (folded.size() >= 3)
+        return text.find(folded) != std::string::npos;
+
+    std::string token;
+    for (size_t i = 0; i <= text.size(); i++) {
+        if (i < text.size() && std::isalnum(static_cast<unsigned char>(text[i]))) {
+            token.push_back(text[i]);
+            continue;
+        }
+        if (!token.empty() && token.find(folded) != std::string::npos)
+            return true;
+        token.clear();
+    }
+    return false;
+}
+
+/**
+ * @brief Whether the tags of a transaction pass the tag filters. Unknown tags
+ * (id -1) are never carried.
+ */
+static bool matchesTags(const std::vector<int>& tags, const std::vector<int>& allTags, const std::vector<int>& anyTags,
+                        const std::vector<int>& noTags) {
+    auto carries = [&tags](int tag) { return std::find(tags.begin(), tags.end(), tag) != tags.end(); };
+    if (!std::all_of(allTags.begin(), allTags.end(), carries))
+        return false;
+    if (!anyTags.empty() && !std::any_of(anyTags.begin(), anyTags.end(), carries))
+        return false;
+    return std::none_of(noTags.begin(), noTags.end(), carries);
+}
+
+/**
+ * @brief Streams the transactions matching the filters of a query, in file
+ * order, one batch of buckets at a time (see the class description).
+ * The filters are the ones of StorageHandler::resolveFilters, the current
+ * day/week/month included when no filter is given.
+ * Rows stay valid until the next one is asked for, and may be moved from.
+ *
+ * @param query the view query
+ * @return Generator<Transaction*> the matching transactions
+ */
+Generator<Transaction*> OutOfCoreLedger::scan(ViewQuery query) {
+    if (!query.type.empty() && query.type != "expense" && query.type != "income")
+        throw std::invalid_argument("Invalid transaction type: " + query.type);
+
+    std::string date = query.baseDate;
+    bool amountFilter = query.minAmount || query.maxAmount;
+    bool columnFilter = !query.type.empty() || !query.weekdays.empty() || !query.allTags.empty() ||
+                        !query.anyTags.empty() || !query.noTags.empty();
+    if (date.empty() && query.wallet.empty() && query.category.empty() && !amountFilter && query.search.empty() &&
+        !columnFilter && !query.where && query.range != 0)
+        date = getCurrentDate();
+
+    // the date filter selects whole buckets
+    std::string firstDate, lastDate;
+    if (!date.empty() && query.range != 0) {
+        std::chrono::year_month_day base = parseYMD(date);
+        std::chrono::year_month_day first, last;
+        switch (query.range) {
+            case 1:
+                firstDate = lastDate = date;
+                break;
+            case 2:
+                getWeek(base, first, last);
+                firstDate = formatYMD(first);
+                lastDate = formatYMD(last);
+                break;
+            case 3:
+                firstDate = formatYMD(base.year() / base.month() / std::chrono::day(1));
+                lastDate = formatYMD(base.year() / base.month() / std::chrono::last);
+                break;
+            default:
+                co_return;
+        }
+    }
+
+    std::string root = query.category;
+    while (root.size() > 1 && root.back() == '/')
+        root.pop_back();
+    std::string search = query.search;
+    for (char& c : search)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    const std::vector<std::string> tagNames = getTagNames();
+    auto toIds = [&tagNames](const std::vector<std::string>& names) {
+        std::vector<int> ids;
+        for (const std::string& name : names) {
+            auto it = std::find(tagNames.begin(), tagNames.end(), name);
+            ids.push_back(it == tagNames.end() ? -1 : static_cast<int>(it - tagNames.begin()));
+        }
+        return ids;
+    };
+    const std::vector<int> allTags = toIds(query.allTags);
+    const std::vector<int> anyTags = toIds(query.anyTags);
+    const std::vector<int> noTags = toIds(query.noTags);
+    const bool tagFilter = !allTags.empty() || !anyTags.empty() || !noTags.empty();
+
+    Executor& executor = Executor::shared();
+    const size_t batchBytes = std::clamp(memoryLimit / 16, MIN_BATCH_BYTES, MAX_BATCH_BYTES);
+    std::vector<const MemberSpan*> batch;
+    size_t next = 0;
+    while (true) {
+        batch.clear();
+        size_t bytes = 0;
+        while (next < buckets.size() && (batch.empty() || bytes < batchBytes)) {
+            const MemberSpan& bucket = buckets[next++];
+            if (!firstDate.empty() && (bucket.key < firstDate || bucket.key > lastDate))
+                continue;
+            batch.push_back(&bucket);
+            bytes += bucket.end - bucket.begin;
+        }
+        if (batch.empty())
+            co_return;
+
+        std::vector<std::vector<Transaction>> parsed(batch.size());
+        executor.parallelFor(0, batch.size(), 1, [&](size_t first, size_t last) {
+            for (size_t b = first; b < last; b++)
+                parsed[b] = parseBucket(std::string_view(text + batch[b]->begin, batch[b]->end - batch[b]->begin));
+        });
+        release(batch.front()->begin, batch.back()->end);
+
+        std::vector<Transaction> rows;
+        TransactionColumns columns;
+        for (size_t b = 0; b < batch.size(); b++) {
+            const int day = dayNumber(batch[b]->key);
+            for (Transaction& transaction : parsed[b]) {
+                transaction.date = batch[b]->key;
+                columns.append(transaction, day);
+                rows.push_back(std::move(transaction));
+            }
+        }
+        parsed.clear();
+
+        const size_t count = rows.size();
+        SelectionMask mask = fullMask(count);
+        SelectionMask predicate;
+        if (!query.wallet.empty()) {
+            std::vector<int> walletIds;
+            if (auto it = columns.walletIds.find(query.wallet); it != columns.walletIds.end())
+                walletIds.push_back(it->second);
+            maskIn(columns.wallets.data(), count, walletIds, predicate);
+            maskAnd(mask, predicate);
+        }
+        if (!root.empty()) {
+            std::vector<int> categoryIds;
+            for (size_t c = 0; c < columns.categoryNames.size(); c++) {
+                const std::string& name = columns.categoryNames[c];
+                if (name == root || (name.size() > root.size() && name.compare(0, root.size(), root) == 0 &&
+                                     name[root.size()] == '/'))
+                    categoryIds.push_back(static_cast<int>(c));
+            }
+            maskIn(columns.categories.data(), count, categoryIds, predicate);
+            maskAnd(mask, predicate);
+        }
+        if (amountFilter) {
+            maskRange(columns.amounts.data(), count, query.minAmount.value_or(std::numeric_limits<int>::min()),
+                      query.maxAmount.value_or(std::numeric_limits<int>::max()), predicate);
+            maskAnd(mask, predicate);
+        }
+        if (query.type == "expense") {
+            maskRange(columns.amounts.data(), count, std::numeric_limits<int>::min(), -1, predicate);
+            maskAnd(mask, predicate);
+        } else if (query.type == "income") {
+            maskRange(columns.amounts.data(), count, 1, std::numeric_limits<int>::max(), predicate);
+            maskAnd(mask, predicate);
+        }
+        if (!query.weekdays.empty()) {
+            maskIn(columns.weekdays.data(), count, query.weekdays, predicate);
+            maskAnd(mask, predicate);
+        }
+        if (query.where)
+            maskAnd(mask, FilterProgram::compile({query.where.get()}, columns).run(columns));
+
+        for (size_t row = 0; row < count; row++) {
+            if (!maskTest(mask, row))
+                continue;
+            Transaction& transaction = rows[row];
+            if (tagFilter && !matchesTags(transaction.tags, allTags, anyTags, noTags))
+                continue;
+            if (!search.empty() && !containsText(transaction.description, search))
+                continue;
+            Transaction* match = &transaction;
+            co_yield match;
+        }
+    }
+}
+
+/**
+ * @brief Compares two transactions on one field, like the sort keys of the
+ * in-memory queries: dates in calendar order, amounts signed or absolute
+ * ("size"), ids, and names alphabetically.
+ *
+ * @return int negative, 0 or positive
+ */
+static int compareField(const std::string& field, const Transaction& a, const Transaction& b) {
+    auto compare = [](auto x, auto y) { return (x > y) - (x < y); };
+    if (field == "date")
+        return a.date.compare(b.date);
+    if (field == "category")
+        return a.category.compare(b.category);
+    if (field == "wallet")
+        return a.wallet.compare(b.wallet);
+    if (field == "amount")
+        return compare(a.amount, b.amount);
+    if (field == "size")
+        return compare(std::abs(static_cast<std::int64_t>(a.amount)), std::abs(static_cast<std::int64_t>(b.amount)));
+    return compare(a.id, b.id);
+}
+
+/**
+ * @brief Streams the transactions matching a query in the order of
+ * StorageHandler::retrieveTransactions: by group key first when grouped, then
+ * by the sort key, ties broken by id. Matches go through an ExternalSorter, so
+ * the first row comes out once the whole file has been scanned. With --top,
+ * each group keeps a bounded heap of its N biggest transactions.
+ * Errors in the query are thrown when the first row is asked for.
+ *
+ * @param query the view query
+ * @return Generator<const Transaction*> the matching transactions, in order
+ */
+Generator<const Transaction*> OutOfCoreLedger::streamTransactions(ViewQuery query) {
+    if (query.groupBy != "date" && query.groupBy != "category" && query.groupBy != "wallet" && query.groupBy != "none")
+        throw std::invalid_argument("Invalid groupBy parameter.");
+    static const std::vector<std::string> sortFields = {"date", "amount", "size", "id", "category", "wallet"};
+    if (std::find(sortFields.begin(), sortFields.end(), query.sortBy) == sortFields.end())
+        throw std::invalid_argument("Invalid sort key: " + query.sortBy);
+
+    const bool grouped = query.groupBy != "none";
+    const bool groupDescending = query.sortBy == query.groupBy && query.descending;
+    const bool idDescending = query.sortBy == "id" && query.descending;
+    auto less = [&query, grouped, groupDescending, idDescending](const Transaction& a, const Transaction& b) {
+        if (grouped) {
+            int order = compareField(query.groupBy, a, b);
+            if (order != 0)
+                return groupDescending ? order > 0 : order < 0;
+        }
+        if (query.sortBy != "id") {
+            int order = compareField(query.sortBy, a, b);
+            if (order != 0)
+                return query.descending ? order > 0 : order < 0;
+        }
+        return idDescending ? a.id > b.id : a.id < b.id;
+    };
+    ExternalSorter sorter(less, memoryLimit / 4);
+
+    if (query.top > 0) {
+        // (size, -id): among equal sizes the older transaction wins
+        auto entry = [](const Transaction& transaction) {
+            return std::make_pair(std::abs(static_cast<std::int64_t>(transaction.amount)), -transaction.id);
+        };
+        auto smaller = [&entry](const Transaction& a, const Transaction& b) { return entry(a) > entry(b); };
+        std::unordered_map<std::string, std::vector<Transaction>> heaps;
+        const size_t limit = static_cast<size_t>(query.top);
+        for (Transaction* transaction : scan(query)) {
+            const std::string* group = &query.topBy;
+            if (query.topBy == "category")
+                group = &transaction->category;
+            else if (query.topBy == "wallet")
+                group = &transaction->wallet;
+
+            std::vector<Transaction>& heap = heaps[*group];
+            if (heap.size() < limit) {
+                heap.push_back(std::move(*transaction));
+                std::push_heap(heap.begin(), heap.end(), smaller);
+            } else if (entry(heap.front()) < entry(*transaction)) {
+                std::pop_heap(heap.begin(), heap.end(), smaller);
+                heap.back() = std::move(*transaction);
+                std::push_heap(heap.begin(), heap.end(), smaller);
+            }
+        }
+        for (auto& [group, heap] : heaps) {
+            for (Transaction& transaction : heap)
+                sorter.add(std::move(transaction));
+        }
+    } else {
+        for (Transaction* transaction : scan(query))
+            sorter.add(std::move(*transaction));
+    }
+
+    for (const Transaction* row : sorter.sorted())
+        co_yield row;
+}
+
+/**
+ * @brief Computes amount statistics over the transactions matching a query,
+ * like StorageHandler::computeStats, with the per-category histograms built
+ * by a SpillingAggregator while the file is scanned.
+ *
+ * @param query the view query selecting the transactions
+ * @param income true to summarize incomes, false for expenses
+ * @param rollup true to also add the amounts of each category to all its parent categories
+ * @param perCategory histogram of each category, to be filled
+ * @param overall histogram of every matching transaction, to be filled
+ * @return int -1 when nothing matches, 0 on success
+ */
+int OutOfCoreLedger::computeStats(const ViewQuery& query, bool income, bool rollup,
+                                  std::map<std::string, AmountHistogram>& perCategory, AmountHistogram& overall) {
+    SpillingAggregator aggregator(memoryLimit / 4);
+    for (Transaction* transaction : scan(query)) {
+        if ((transaction->amount > 0) != income || transaction->amount == 0)
+            continue;
+        aggregator.add(transaction->category, transaction->amount);
+    }
+
+    aggregator.finish([&](const std::string& category, const AmountHistogram& histogram) {
+        perCategory[category].merge(histogram);
+        overall.merge(histogram);
+        if (!rollup)
+            return;
+        for (size_t slash = category.find('/'); slash != std::string::npos; slash = category.find('/', slash + 1))
+            perCategory[category.substr(0, slash)].merge(histogram);
+    });
+    if (overall.count() == 0)
+        return -1;
+    return 0;
+}
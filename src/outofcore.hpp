@@ -0,0 +1,73 @@
+/**
+ * @file outofcore.hpp
+ * @brief Header file for the out-of-core queries, which answer 'view' and
+ * 'stats' within a memory limit by streaming the transaction file instead of
+ * loading it
+ *
+ */
+
+#ifndef OUTOFCORE_HPP
+#define OUTOFCORE_HPP
+
+#include "generator.hpp"
+#include "loader.hpp"
+#include "stats.hpp"
+#include "storage.hpp"
+#include "transaction.hpp"
+#include "json.hpp"
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+/**
+* @class
+* @brief Read-only view of a transaction file too big to load, queried in
+* bounded memory.
+*
+* The file is mapped, and only its layout is read up front: the metadata and
+* where each date bucket starts and ends. A query then streams the buckets in
+* batches of about a sixteenth of the memory limit. Each batch is parsed into
+* transactions on the shared executor, turned into columns and filtered like
+* the in-memory indexes would, and its pages are dropped from the mapping
+* before the next one is read. Buckets outside the date range of the query are
+* skipped without being parsed.
+*
+* Matches are sorted with an ExternalSorter (runs of a quarter of the limit) and
+* summarized with a SpillingAggregator (a quarter of the limit), so neither
+* the number of matches nor the number of categories is bounded by memory.
+*
+* Names are matched exactly: misspelled wallets and categories are not
+* resolved, since there is no vocabulary to resolve them against.
+*/
+class OutOfCoreLedger {
+public:
+    static const size_t MIN_MEMORY_LIMIT = 1 << 20;
+
+    OutOfCoreLedger(const std::string& _transactionFile, size_t _memoryLimit);
+    ~OutOfCoreLedger();
+    OutOfCoreLedger(const OutOfCoreLedger&) = delete;
+    OutOfCoreLedger& operator=(const OutOfCoreLedger&) = delete;
+
+    std::vector<std::string> getTagNames() const;
+    Generator<const Transaction*> streamTransactions(ViewQuery query);
+    int computeStats(const ViewQuery& query, bool income, bool rollup, std::map<std::string, AmountHistogram>& perCategory,
+        AmountHistogram& overall);
+
+private:
+    std::string transactionFile;
+    size_t memoryLimit;
+    const char* text = nullptr;
+    size_t textSize = 0;
+    json metadata;
+    std::vector<MemberSpan> buckets;
+
+    void map();
+    void release(size_t begin, size_t end) const;
+    Generator<Transaction*> scan(ViewQuery query);
+};
+
+#endif
@@ -0,0 +1,490 @@
+/**
+ * @file segment.cpp
+ * @brief Implementation file for the index segment
+ *
+ * Layout: a fixed header followed by sections, each an array of plain integers
+ * or bytes at an 8 byte aligned offset from the start of the file. Nothing in
+ * the file is a pointer, so every process can map it anywhere. Variable length
+ * data (names, descriptions, tags, postings) is stored as an offsets array
+ * with one more entry than there are items, indexing into a values array.
+ *
+ */
+
+#include "segment.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char SEGMENT_MAGIC[8] = {'M', 'B', 'I', 'D', 'X', 'S', 'E', 'G'};
+static const std::uint32_t SEGMENT_VERSION = 3; // 2: 64-bit transaction ids, 3: read in place
+
+enum Section : std::uint32_t {
+    IDS, AMOUNTS, DAYS, WEEKDAYS, CATEGORIES, WALLETS, DESCRIPTION_LENGTHS,
+    ROW_DATES,                                      // index into the date names
+    ROW_IDS,                                        // (id, row) pairs, sorted
+    TAG_OFFSETS, TAG_VALUES,                        // per row
+    TAG_BITMAPS,                                    // per tag id, a bit per row padded to whole words
+    DESCRIPTION_OFFSETS, DESCRIPTION_BYTES,         // per row
+    CATEGORY_NAME_OFFSETS, CATEGORY_NAME_BYTES,
+    WALLET_NAME_OFFSETS, WALLET_NAME_BYTES,
+    DATE_NAME_OFFSETS, DATE_NAME_BYTES,             // sorted
+    CATEGORY_POSTING_OFFSETS, CATEGORY_POSTING_IDS, // per category name
+    WALLET_POSTING_OFFSETS, WALLET_POSTING_IDS,     // per wallet name
+    DATE_POSTING_OFFSETS, DATE_POSTING_IDS,         // per date name
+    AMOUNT_INDEX,                                   // (amount, id) pairs, sorted
+    DOCUMENT,                                       // the transaction file without "data", as json
+    SECTION_COUNT
+};
+
+struct SectionEntry {
+    std::uint64_t offset;
+    std::uint64_t bytes;
+};
+
+struct SegmentHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t sectionCount;
+    LedgerStamp stamp;
+    std::uint64_t rows;
+    std::uint64_t totalBytes;
+    SectionEntry sections[SECTION_COUNT];
+};
+
+/**
+* @class
+* @brief Accumulates the sections of a segment in memory before it is written.
+*/
+class SegmentBuilder {
+public:
+    SegmentBuilder() : buffer(sizeof(SegmentHeader), 0) {}
+
+    template <typename T>
+    void add(Section section, const T* data, size_t count) {
+        buffer.resize((buffer.size() + 7) & ~size_t(7), 0);
+        entries[section] = {buffer.size(), count * sizeof(T)};
+        const char* bytes = reinterpret_cast<const char*>(data);
+        buffer.insert(buffer.end(), bytes, bytes + count * sizeof(T));
+    }
+
+    template <typename T>
+    void add(Section section, const std::vector<T>& values) {
+        add(section, values.data(), values.size());
+    }
+
+    /**
+     * @brief Adds a list of strings as an offsets section and a bytes section.
+     */
+    void addStrings(Section offsetsSection, Section bytesSection, const std::vector<std::string_view>& strings) {
+        std::vector<std::uint64_t> offsets{0};
+        std::string bytes;
+        for (std::string_view text : strings) {
+            bytes += text;
+            offsets.push_back(bytes.size());
+        }
+        add(offsetsSection, offsets);
+        add(bytesSection, bytes.data(), bytes.size());
+    }
+
+    /**
+     * @brief Adds postings lists (one per name, in name order) as an offsets
+     * section and an ids section.
+     */
+    void addPostings(Section offsetsSection, Section idsSection,
+                     const std::vector<const Postings*>& lists) {
+        std::vector<std::uint64_t> offsets{0};
+        std::vector<TransactionId> ids;
+        for (const Postings* list : lists) {
+            ids.insert(ids.end(), list->begin(), list->end());
+            offsets.push_back(ids.size());
+        }
+        add(offsetsSection, offsets);
+        add(idsSection, ids);
+    }
+
+    std::vector<char> finish(const LedgerStamp& stamp, size_t rows) {
+        SegmentHeader header{};
+        std::memcpy(header.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+        header.version = SEGMENT_VERSION;
+        header.sectionCount = SECTION_COUNT;
+        header.stamp = stamp;
+        header.rows = rows;
+        header.totalBytes = buffer.size();
+        std::copy(std::begin(entries), std::end(entries), header.sections);
+        std::memcpy(buffer.data(), &header, sizeof(header));
+        return std::move(buffer);
+    }
+
+private:
+    std::vector<char> buffer;
+    SectionEntry entries[SECTION_COUNT] = {};
+};
+
+/**
+ * @brief Reads the stamp of the current transaction file.
+ *
+ * @return bool false if the file cannot be stat'ed
+ */
+bool LedgerStamp::of(const std::string& path, LedgerStamp& stamp) {
+    struct stat info;
+    if (::stat(path.c_str(), &info) != 0)
+        return false;
+    stamp.device = static_cast<std::uint64_t>(info.st_dev);
+    stamp.inode = static_cast<std::uint64_t>(info.st_ino);
+    stamp.size = static_cast<std::uint64_t>(info.st_size);
+    stamp.modifiedSeconds = info.st_mtim.tv_sec;
+    stamp.modifiedNanoseconds = info.st_mtim.tv_nsec;
+    return true;
+}
+
+/**
+ * @brief Writes the indexes of a fully loaded ledger as a segment. The file is
+ * written under a temporary name and renamed into place, so processes that
+ * attach concurrently see either the old or the new segment, never a partial
+ * one.
+ *
+ * @param path the segment file
+ * @param stamp the generation of the transaction file the indexes were built from
+ * @param indexes the indexes, as built by the load pipeline or populateAllIdxs
+ * @param document the transaction file without its "data" object
+ * @return bool true if the segment was written
+ */
+bool writeIndexSegment(const std::string& path, const LedgerStamp& stamp, const IndexManager& indexes,
+                       const json& document) {
+    if (!indexes.isColumnsPopulated || !indexes.isCategoryIdxPopulated || !indexes.isWalletIdxPopulated ||
+        !indexes.isDateMapPopulated || !indexes.isAmountIdxPopulated)
+        return false;
+    const SharedColumns& columns = indexes.columns;
+    const size_t rows = columns.size();
+    // removed rows (repeated ids) have no place in the segment layout
+    if (columns.rowsById.size() != rows)
+        return false;
+
+    // date names are written sorted, the columns have them in the order they were seen
+    const std::vector<std::string>& seenDates = columns.dateNames->names;
+    std::vector<int> sortedDates(seenDates.size());
+    for (size_t i = 0; i < sortedDates.size(); i++)
+        sortedDates[i] = static_cast<int>(i);
+    std::sort(sortedDates.begin(), sortedDates.end(),
+              [&seenDates](int a, int b) { return seenDates[static_cast<size_t>(a)] < seenDates[static_cast<size_t>(b)]; });
+    std::vector<int> dateRanks(sortedDates.size());
+    std::vector<std::string_view> dateNames;
+    for (size_t i = 0; i < sortedDates.size(); i++) {
+        dateRanks[static_cast<size_t>(sortedDates[i])] = static_cast<int>(i);
+        dateNames.push_back(seenDates[static_cast<size_t>(sortedDates[i])]);
+    }
+    std::vector<int> rowDates(rows);
+    std::vector<std::uint64_t> tagOffsets{0};
+    std::vector<int> tagValues;
+    std::vector<std::string_view> descriptions(rows);
+    for (size_t row = 0; row < rows; row++) {
+        rowDates[row] = dateRanks[static_cast<size_t>(columns.dates[row])];
+        std::span<const int> rowTags = columns.tags[row];
+        tagValues.insert(tagValues.end(), rowTags.begin(), rowTags.end());
+        tagOffsets.push_back(tagValues.size());
+        descriptions[row] = columns.descriptions.get(row);
+    }
+
+    // postings in the order of the names, already sorted
+    auto postingsOf = [](const auto& index, const auto& names) {
+        std::vector<const Postings*> lists;
+        static const Postings none;
+        for (const auto& name : names) {
+            auto it = index.find(std::string(name));
+            lists.push_back(it != index.end() ? &it->second : &none);
+        }
+        return lists;
+    };
+    auto flatten = [rows](const auto& column) {
+        std::vector<std::decay_t<decltype(column[0])>> values(rows);
+        for (size_t row = 0; row < rows; row++)
+            values[row] = column[row];
+        return values;
+    };
+    std::vector<std::string_view> categoryNames(columns.categoryNames->names.begin(), columns.categoryNames->names.end());
+    std::vector<std::string_view> walletNames(columns.walletNames->names.begin(), columns.walletNames->names.end());
+    std::vector<std::pair<int, TransactionId>> amountIndex(indexes.transactionsByAmount.begin(),
+                                                          indexes.transactionsByAmount.end());
+    std::vector<std::pair<TransactionId, std::uint64_t>> rowIds(columns.rowsById.begin(), columns.rowsById.end());
+    const size_t words = (rows + 63) / 64;
+    std::vector<std::uint64_t> tagBitmaps(indexes.transactionsByTag.size() * words, 0);
+    for (size_t tag = 0; tag < indexes.transactionsByTag.size(); tag++) {
+        const SharedColumns::RowBitmap& bitmap = indexes.transactionsByTag[tag];
+        for (size_t w = 0; w < bitmap.size() && w < words; w++)
+            tagBitmaps[tag * words + w] = bitmap[w];
+    }
+
+    SegmentBuilder builder;
+    builder.add(IDS, flatten(columns.ids));
+    builder.add(AMOUNTS, flatten(columns.amounts));
+    builder.add(DAYS, flatten(columns.days));
+    builder.add(WEEKDAYS, flatten(columns.weekdays));
+    builder.add(CATEGORIES, flatten(columns.categories));
+    builder.add(WALLETS, flatten(columns.wallets));
+    builder.add(DESCRIPTION_LENGTHS, flatten(columns.descriptionLengths));
+    builder.add(ROW_DATES, rowDates);
+    builder.add(ROW_IDS, rowIds);
+    builder.add(TAG_OFFSETS, tagOffsets);
+    builder.add(TAG_VALUES, tagValues);
+    builder.add(TAG_BITMAPS, tagBitmaps);
+    builder.addStrings(DESCRIPTION_OFFSETS, DESCRIPTION_BYTES, descriptions);
+    builder.addStrings(CATEGORY_NAME_OFFSETS, CATEGORY_NAME_BYTES, categoryNames);
+    builder.addStrings(WALLET_NAME_OFFSETS, WALLET_NAME_BYTES, walletNames);
+    builder.addStrings(DATE_NAME_OFFSETS, DATE_NAME_BYTES, dateNames);
+    builder.addPostings(CATEGORY_POSTING_OFFSETS, CATEGORY_POSTING_IDS,
+                        postingsOf(*indexes.transactionsByCategory, categoryNames));
+    builder.addPostings(WALLET_POSTING_OFFSETS, WALLET_POSTING_IDS,
+                        postingsOf(*indexes.transactionsByWallet, walletNames));
+    builder.addPostings(DATE_POSTING_OFFSETS, DATE_POSTING_IDS,
+                        postingsOf(*indexes.transactionsByDateMap, dateNames));
+    builder.add(AMOUNT_INDEX, amountIndex);
+    std::string documentText = document.dump();
+    builder.add(DOCUMENT, documentText.data(), documentText.size());
+    std::vector<char> bytes = builder.finish(stamp, rows);
+
+    std::string temporary = path + ".tmp." + std::to_string(::getpid());
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    size_t written = 0;
+    while (written < bytes.size()) {
+        ssize_t n = ::write(fd, bytes.data() + written, bytes.size() - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        written += static_cast<size_t>(n);
+    }
+    bool ok = written == bytes.size();
+    ok = ::close(fd) == 0 && ok;
+    if (!ok || ::rename(temporary.c_str(), path.c_str()) != 0) {
+        ::unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+* @class
+* @brief Read-only mapping of a segment file, with bounds-checked access to its
+* sections.
+*/
+class SegmentView {
+public:
+    explicit SegmentView(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return;
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(SegmentHeader)) {
+            size = static_cast<size_t>(info.st_size);
+            void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapped != MAP_FAILED)
+                base = static_cast<const char*>(mapped);
+        }
+        ::close(fd);
+    }
+    ~SegmentView() {
+        if (base)
+            ::munmap(const_cast<char*>(base), size);
+    }
+    SegmentView(const SegmentView&) = delete;
+    SegmentView& operator=(const SegmentView&) = delete;
+
+    const SegmentHeader* header() const {
+        if (!base)
+            return nullptr;
+        const SegmentHeader* h = reinterpret_cast<const SegmentHeader*>(base);
+        if (std::memcmp(h->magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0 || h->version != SEGMENT_VERSION ||
+            h->sectionCount != SECTION_COUNT || h->totalBytes != size)
+            return nullptr;
+        for (const SectionEntry& entry : h->sections) {
+            if (entry.offset % 8 != 0 || entry.offset > size || entry.bytes > size - entry.offset)
+                return nullptr;
+        }
+        return h;
+    }
+
+    /**
+     * @brief The elements of a section, as a pointer and a count.
+     */
+    template <typename T>
+    std::pair<const T*, size_t> section(Section which) const {
+        const SectionEntry& entry = reinterpret_cast<const SegmentHeader*>(base)->sections[which];
+        return {reinterpret_cast<const T*>(base + entry.offset), entry.bytes / sizeof(T)};
+    }
+
+private:
+    const char* base = nullptr;
+    size_t size = 0;
+};
+
+/**
+ * @brief Checks that an offsets section is non-decreasing, has count + 1
+ * entries and ends within the values it indexes.
+ */
+static bool validOffsets(std::pair<const std::uint64_t*, size_t> offsets, size_t count, size_t values) {
+    if (offsets.second != count + 1 || offsets.first[0] != 0 || offsets.first[count] != values)
+        return false;
+    for (size_t i = 0; i < count; i++) {
+        if (offsets.first[i] > offsets.first[i + 1])
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Loads the indexes from the segment, if it was built from the current
+ * generation of the transaction file. No json is parsed except the small
+ * document without "data", and nothing is copied but the name tables: the
+ * columns, descriptions, tags, row ids, postings and amount index borrow the
+ * mapped sections, and keep the mapping alive for as long as any version of
+ * the indexes refers to them. A write copies only the chunks it changes.
+ *
+ * @param path the segment file
+ * @param stamp the generation of the transaction file
+ * @param indexes the index manager to fill
+ * @param document set to the transaction file without its "data" object
+ * @return bool false if there is no usable segment for this generation
+ */
+bool attachIndexSegment(const std::string& path, const LedgerStamp& stamp, IndexManager& indexes, json& document) {
+    auto view = std::make_shared<const SegmentView>(path);
+    const SegmentHeader* header = view->header();
+    if (!header || !(header->stamp == stamp))
+        return false;
+    const size_t rows = header->rows;
+
+    auto ids = view->section<TransactionId>(IDS);
+    auto amounts = view->section<int>(AMOUNTS);
+    auto days = view->section<int>(DAYS);
+    auto weekdays = view->section<int>(WEEKDAYS);
+    auto categories = view->section<int>(CATEGORIES);
+    auto wallets = view->section<int>(WALLETS);
+    auto lengths = view->section<int>(DESCRIPTION_LENGTHS);
+    auto rowDates = view->section<int>(ROW_DATES);
+    auto rowIds = view->section<std::pair<TransactionId, std::uint64_t>>(ROW_IDS);
+    auto tagOffsets = view->section<std::uint64_t>(TAG_OFFSETS);
+    auto tagValues = view->section<int>(TAG_VALUES);
+    auto tagBitmaps = view->section<std::uint64_t>(TAG_BITMAPS);
+    auto descriptionOffsets = view->section<std::uint64_t>(DESCRIPTION_OFFSETS);
+    auto descriptionBytes = view->section<char>(DESCRIPTION_BYTES);
+    auto amountIndex = view->section<std::pair<int, TransactionId>>(AMOUNT_INDEX);
+    auto documentBytes = view->section<char>(DOCUMENT);
+    for (auto column : {amounts, days, weekdays, categories, wallets, lengths, rowDates}) {
+        if (column.second != rows)
+            return false;
+    }
+    const size_t words = (rows + 63) / 64;
+    if (ids.second != rows || rowIds.second != rows || amountIndex.second != rows ||
+        !validOffsets(tagOffsets, rows, tagValues.second) ||
+        !validOffsets(descriptionOffsets, rows, descriptionBytes.second) ||
+        (words == 0 ? tagBitmaps.second != 0 : tagBitmaps.second % words != 0))
+        return false;
+    // rowsById is searched, so its ids must be strictly increasing
+    for (size_t i = 0; i < rows; i++) {
+        if (rowIds.first[i].second >= rows || (i > 0 && rowIds.first[i - 1].first >= rowIds.first[i].first))
+            return false;
+    }
+
+    // names tables with their postings
+    auto readNames = [&](Section offsetsSection, Section bytesSection, std::vector<std::string>& names) {
+        auto offsets = view->section<std::uint64_t>(offsetsSection);
+        auto bytes = view->section<char>(bytesSection);
+        if (offsets.second == 0 || !validOffsets(offsets, offsets.second - 1, bytes.second))
+            return false;
+        for (size_t i = 0; i + 1 < offsets.second; i++)
+            names.emplace_back(bytes.first + offsets.first[i], offsets.first[i + 1] - offsets.first[i]);
+        return true;
+    };
+    auto readPostings = [&](Section offsetsSection, Section idsSection, size_t count, auto&& store) {
+        auto offsets = view->section<std::uint64_t>(offsetsSection);
+        auto postings = view->section<TransactionId>(idsSection);
+        if (!validOffsets(offsets, count, postings.second))
+            return false;
+        for (size_t i = 0; i < count; i++)
+            store(i, postings.first + offsets.first[i], static_cast<size_t>(offsets.first[i + 1] - offsets.first[i]));
+        return true;
+    };
+    std::vector<std::string> categoryNames, walletNames, dateNames;
+    if (!readNames(CATEGORY_NAME_OFFSETS, CATEGORY_NAME_BYTES, categoryNames) ||
+        !readNames(WALLET_NAME_OFFSETS, WALLET_NAME_BYTES, walletNames) ||
+        !readNames(DATE_NAME_OFFSETS, DATE_NAME_BYTES, dateNames))
+        return false;
+    for (size_t row = 0; row < rows; row++) {
+        if (static_cast<size_t>(categories.first[row]) >= categoryNames.size() ||
+            static_cast<size_t>(wallets.first[row]) >= walletNames.size() ||
+            static_cast<size_t>(rowDates.first[row]) >= dateNames.size())
+            return false;
+    }
+
+    try {
+        document = json::parse(documentBytes.first, documentBytes.first + documentBytes.second);
+    } catch (const json::parse_error&) {
+        return false;
+    }
+
+    const std::shared_ptr<const void> owner = view;
+    indexes.clearAll();
+    bool ok = readPostings(CATEGORY_POSTING_OFFSETS, CATEGORY_POSTING_IDS, categoryNames.size(),
+                           [&](size_t i, const TransactionId* begin, size_t count) {
+                               if (count > 0)
+                                   indexes.transactionsByCategory.write()[categoryNames[i]].borrow(begin, count, owner);
+                           }) &&
+              readPostings(WALLET_POSTING_OFFSETS, WALLET_POSTING_IDS, walletNames.size(),
+                           [&](size_t i, const TransactionId* begin, size_t count) {
+                               if (count > 0)
+                                   indexes.transactionsByWallet.write()[walletNames[i]].borrow(begin, count, owner);
+                           }) &&
+              readPostings(DATE_POSTING_OFFSETS, DATE_POSTING_IDS, dateNames.size(),
+                           [&](size_t i, const TransactionId* begin, size_t count) {
+                               indexes.transactionsByDateHashed.write()[dateNames[i]].borrow(begin, count, owner);
+                               indexes.transactionsByDateMap.write()[dateNames[i]].borrow(begin, count, owner);
+                           });
+    if (!ok) {
+        indexes.clearAll();
+        return false;
+    }
+
+    // the names are interned in section order, so the ids of the sections stay valid
+    SharedColumns& columns = indexes.columns;
+    for (const std::string& name : categoryNames)
+        columns.categoryNames.write().intern(name);
+    for (const std::string& name : walletNames)
+        columns.walletNames.write().intern(name);
+    for (const std::string& name : dateNames)
+        columns.dateNames.write().intern(name);
+    columns.ids.borrow(ids.first, rows, owner);
+    columns.amounts.borrow(amounts.first, rows, owner);
+    columns.days.borrow(days.first, rows, owner);
+    columns.weekdays.borrow(weekdays.first, rows, owner);
+    columns.categories.borrow(categories.first, rows, owner);
+    columns.wallets.borrow(wallets.first, rows, owner);
+    columns.dates.borrow(rowDates.first, rows, owner);
+    columns.descriptionLengths.borrow(lengths.first, rows, owner);
+    columns.tags.borrow(tagOffsets.first, tagValues.first, rows, owner);
+    columns.descriptions.borrow(descriptionOffsets.first, descriptionBytes.first, rows, owner);
+    columns.rowsById.borrow(rowIds.first, rows, owner);
+    if (words > 0) {
+        indexes.transactionsByTag.resize(tagBitmaps.second / words);
+        for (size_t tag = 0; tag < indexes.transactionsByTag.size(); tag++)
+            indexes.transactionsByTag[tag].borrow(tagBitmaps.first + tag * words, words, owner);
+    }
+    indexes.transactionsByAmount.borrow(amountIndex.first, rows, owner);
+    indexes.isWalletIdxPopulated = true;
+    indexes.isCategoryIdxPopulated = true;
+    indexes.isDateHashPopulated = true;
+    indexes.isDateMapPopulated = true;
+    indexes.isAmountIdxPopulated = true;
+    indexes.isColumnsPopulated = true;
+    return true;
+}
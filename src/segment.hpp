@@ -0,0 +1,39 @@
+/**
+ * @file segment.hpp
+ * @brief Header file for the index segment: a read-only file, mapped by every
+ * process, holding the columns and postings of one generation of the ledger
+ *
+ */
+
+#ifndef SEGMENT_HPP
+#define SEGMENT_HPP
+
+#include "indexmanager.hpp"
+#include "json.hpp"
+
+#include <cstdint>
+#include <string>
+
+using json = nlohmann::json;
+
+/**
+* @struct
+* @brief Identifies one generation of the transaction file: any write replaces
+* or modifies the file, which changes at least one of these.
+*/
+struct LedgerStamp {
+    std::uint64_t device = 0;
+    std::uint64_t inode = 0;
+    std::uint64_t size = 0;
+    std::int64_t modifiedSeconds = 0;
+    std::int64_t modifiedNanoseconds = 0;
+
+    static bool of(const std::string& path, LedgerStamp& stamp);
+    bool operator==(const LedgerStamp& other) const = default;
+};
+
+bool writeIndexSegment(const std::string& path, const LedgerStamp& stamp, const IndexManager& indexes,
+                       const json& document);
+bool attachIndexSegment(const std::string& path, const LedgerStamp& stamp, IndexManager& indexes, json& document);
+
+#endif
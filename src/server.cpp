@@ -0,0 +1,405 @@
+/**
+ * @file server.cpp
+ * @brief Implementation file for the server mode and its client
+ *
+ * Requests and replies are sent over a stream socket as length-prefixed
+ * strings. A request is the argument count followed by the arguments (without
+ * the program name), a reply is the exit code followed by everything the
+ * command wrote to stdout and stderr. One connection carries one command.
+ *
+ */
+
+#include "server.hpp"
+#include "utils.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static volatile std::sig_atomic_t stopRequested = 0;
+
+static void requestStop(int) {
+    stopRequested = 1;
+}
+
+static bool writeAll(int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t written = ::send(fd, bytes, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        bytes += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* data, size_t size) {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t got = ::recv(fd, bytes, size, 0);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        bytes += got;
+        size -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+static bool writeString(int fd, const std::string& text) {
+    std::uint32_t size = static_cast<std::uint32_t>(text.size());
+    return writeAll(fd, &size, sizeof(size)) && writeAll(fd, text.data(), text.size());
+}
+
+static bool readString(int fd, std::string& text) {
+    std::uint32_t size;
+    if (!readAll(fd, &size, sizeof(size)) || size > (1u << 30))
+        return false;
+    text.resize(size);
+    return readAll(fd, text.data(), size);
+}
+
+/**
+ * @brief Fills a socket address, failing if the path does not fit.
+ */
+static bool socketAddress(const std::string& socketPath, sockaddr_un& address) {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+        return false;
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    return true;
+}
+
+/**
+ * @brief Connects to the server socket.
+ *
+ * @return int the connected socket, -1 if no server is listening
+ */
+static int connectTo(const std::string& socketPath) {
+    sockaddr_un address;
+    if (!socketAddress(socketPath, address))
+        return -1;
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Sends a command to a running server and prints its output.
+ *
+ * @param socketPath the server socket
+ * @param args the command line, without the program name
+ * @param exitCode set to the exit code of the command
+ * @return bool false if no server is running, so the command must run in-process
+ */
+bool forwardToServer(const std::string& socketPath, const std::vector<std::string>& args, int& exitCode) {
+    int fd = connectTo(socketPath);
+    if (fd < 0)
+        return false;
+
+    bool ok = true;
+    std::uint32_t count = static_cast<std::uint32_t>(args.size());
+    ok = writeAll(fd, &count, sizeof(count));
+    for (size_t i = 0; ok && i < args.size(); i++)
+        ok = writeString(fd, args[i]);
+
+    std::int32_t code = -1;
+    std::string out, err;
+    ok = ok && readAll(fd, &code, sizeof(code)) && readString(fd, out) && readString(fd, err);
+    ::close(fd);
+    if (!ok) {
+        std::cerr << "Error: lost connection to the munnybud server." << std::endl;
+        exitCode = -1;
+        return true;
+    }
+    std::cout << out << std::flush;
+    std::cerr << err << std::flush;
+    exitCode = code;
+    return true;
+}
+
+/**
+* @struct
+* @brief Modification times and sizes of the data files, to notice when they
+* were changed by someone other than the server.
+*/
+struct FileStamps {
+    timespec walletTime{};
+    timespec transactionTime{};
+    off_t walletSize = -1;
+    off_t transactionSize = -1;
+
+    static FileStamps of(const std::string& walletFile, const std::string& transactionFile) {
+        FileStamps stamps;
+        struct stat info;
+        if (::stat(walletFile.c_str(), &info) == 0) {
+            stamps.walletTime = info.st_mtim;
+            stamps.walletSize = info.st_size;
+        }
+        if (::stat(transactionFile.c_str(), &info) == 0) {
+            stamps.transactionTime = info.st_mtim;
+            stamps.transactionSize = info.st_size;
+        }
+        return stamps;
+    }
+
+    bool operator==(const FileStamps& other) const {
+        return walletTime.tv_sec == other.walletTime.tv_sec && walletTime.tv_nsec == other.walletTime.tv_nsec &&
+               transactionTime.tv_sec == other.transactionTime.tv_sec &&
+               transactionTime.tv_nsec == other.transactionTime.tv_nsec && walletSize == other.walletSize &&
+               transactionSize == other.transactionSize;
+    }
+};
+
+/**
+* @struct
+* @brief One published version of the ledger, with the stamps of the data
+* files it matches.
+*/
+struct LedgerVersion {
+    std::shared_ptr<StorageHandler> storage;
+    FileStamps stamps;
+};
+
+/**
+* @class
+* @brief The versions of the ledger served to clients (multi-version
+* concurrency control). A published version is never modified: readers pin the
+* current one for their whole command, while writers take turns, run their
+* command on a copy of the current version and publish the copy atomically.
+* A version is freed when the last command using it finishes, so reads never
+* wait for writes and always see a single consistent state.
+*/
+class LedgerVersions {
+public:
+    LedgerVersions(const std::string& _walletFile, const std::string& _transactionFile)
+        : walletFile(_walletFile), transactionFile(_transactionFile) {
+        publish(std::make_shared<StorageHandler>(walletFile, transactionFile));
+    }
+
+    /**
+     * @brief Returns the current version, reloading the ledger first if the
+     * data files were changed by another process.
+     */
+    std::shared_ptr<const LedgerVersion> pin() {
+        std::shared_ptr<const LedgerVersion> version = current.load();
+        if (version->stamps == FileStamps::of(walletFile, transactionFile))
+            return version;
+        std::lock_guard<std::mutex> lock(writerMutex);
+        refresh();
+        return current.load();
+    }
+
+    /**
+     * @brief Runs a command that modifies the ledger on a copy of the current
+     * version, and publishes the copy if the command succeeds. The copy
+     * shares the date buckets and the index chunks with the current version,
+     * so only what the command writes to is copied.
+     *
+     * @return int the exit code of the command
+     */
+    int write(const std::function<int(StorageHandler&)>& command) {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        refresh();
+        auto next = std::make_shared<StorageHandler>(*current.load()->storage);
+        int code = command(*next);
+        if (code == 0)
+            publish(std::move(next));
+        return code;
+    }
+
+private:
+    std::string walletFile;
+    std::string transactionFile;
+    std::atomic<std::shared_ptr<const LedgerVersion>> current;
+    std::mutex writerMutex; // held by the writer building the next version
+
+    /**
+     * @brief Reloads the ledger if the data files changed since the current
+     * version was published. Must be called with the writer mutex held.
+     */
+    void refresh() {
+        if (!(current.load()->stamps == FileStamps::of(walletFile, transactionFile)))
+            publish(std::make_shared<StorageHandler>(walletFile, transactionFile));
+    }
+
+    void publish(std::shared_ptr<StorageHandler> storage) {
+        storage->prepareSnapshot();
+        auto version = std::make_shared<LedgerVersion>();
+        version->storage = std::move(storage);
+        version->stamps = FileStamps::of(walletFile, transactionFile);
+        current.store(std::move(version));
+    }
+};
+
+/**
+ * @brief Whether a command only reads the ledger, so it can run on a pinned
+ * version next to other commands.
+ */
+static bool isReadOnly(const std::vector<std::string>& args) {
+    return args.size() > 1 && (args[1] == "view" || args[1] == "stats" || args[1] == "balance");
+}
+
+/**
+ * @brief Reads one command from a client, runs it and sends back the result.
+ * Read-only commands run on the current version of the ledger, the others on
+ * the next one.
+ */
+static void serveClient(int fd, LedgerVersions& versions, CommandRunner runCommand) {
+    timeval timeout{5, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::uint32_t count;
+    if (!readAll(fd, &count, sizeof(count)) || count > 1024)
+        return;
+    std::vector<std::string> args(count + 1);
+    args[0] = "munnybud";
+    for (size_t i = 1; i <= count; i++) {
+        if (!readString(fd, args[i]))
+            return;
+    }
+    std::vector<char*> argv;
+    for (std::string& arg : args)
+        argv.push_back(arg.data());
+    argv.push_back(nullptr);
+    const int argc = static_cast<int>(args.size());
+
+    std::int32_t code = -1;
+    std::ostringstream out, err;
+    {
+        StreamRedirect redirect(out, err);
+        try {
+            if (isReadOnly(args)) {
+                std::shared_ptr<const LedgerVersion> version = versions.pin();
+                code = runCommand(argc, argv.data(), version->storage.get());
+            } else {
+                code = versions.write(
+                    [&](StorageHandler& storage) { return runCommand(argc, argv.data(), &storage); });
+            }
+        } catch (const std::exception& e) {
+            errStream() << "Error: " << e.what() << std::endl;
+        }
+    }
+    if (!writeAll(fd, &code, sizeof(code)) || !writeString(fd, out.str()) || !writeString(fd, err.str()))
+        std::cerr << "Warning: could not send the reply to a client." << std::endl;
+}
+
+/**
+ * @brief Serves commands over a Unix domain socket until SIGINT or SIGTERM.
+ *
+ * The ledger is loaded once and kept in memory with its indexes. Every client
+ * is served on its own thread: reads run side by side on the current version
+ * of the ledger, writes build and publish the next one (see LedgerVersions).
+ * If the data files are changed by another process (an in-process CLI run, an
+ * editor) the ledger is reloaded before the next command.
+ *
+ * @param socketPath where to listen
+ * @param walletFile the wallet file
+ * @param transactionFile the transaction file
+ * @param runCommand runs one command line against the loaded ledger
+ * @return int -1 on error, 0 after a clean shutdown
+ */
+int runServer(const std::string& socketPath, const std::string& walletFile, const std::string& transactionFile,
+              CommandRunner runCommand) {
+    sockaddr_un address;
+    if (!socketAddress(socketPath, address)) {
+        std::cerr << "Error: socket path is too long: " << socketPath << std::endl;
+        return -1;
+    }
+    int probe = connectTo(socketPath);
+    if (probe >= 0) {
+        ::close(probe);
+        std::cerr << "Error: a munnybud server is already running on " << socketPath << std::endl;
+        return -1;
+    }
+
+    std::unique_ptr<LedgerVersions> versions;
+    try {
+        versions = std::make_unique<LedgerVersions>(walletFile, transactionFile);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: could not load the ledger: " << e.what() << std::endl;
+        return -1;
+    }
+
+    int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        std::cerr << "Error: could not create socket: " << std::strerror(errno) << std::endl;
+        return -1;
+    }
+    ::unlink(socketPath.c_str()); // stale socket of a server that did not shut down cleanly
+    mode_t oldMask = ::umask(0077);
+    int bound = ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    ::umask(oldMask);
+    if (bound != 0 || ::listen(listener, 16) != 0) {
+        std::cerr << "Error: could not listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+        ::close(listener);
+        return -1;
+    }
+
+    struct sigaction action{};
+    action.sa_handler = requestStop;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0; // no SA_RESTART, so accept returns on a signal
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+
+    std::cout << "Serving on " << socketPath << " (Ctrl+C to stop)" << std::endl;
+    std::list<std::future<void>> clients;
+    while (!stopRequested) {
+        int client = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            std::cerr << "Error: accept failed: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        clients.remove_if([](const std::future<void>& done) {
+            return done.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        });
+        // client threads inherit a mask without the stop signals, so they reach accept
+        sigset_t previous;
+        ::pthread_sigmask(SIG_BLOCK, &stopSignals, &previous);
+        clients.push_back(std::async(std::launch::async, [client, &versions, runCommand]() {
+            serveClient(client, *versions, runCommand);
+            ::close(client);
+        }));
+        ::pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    }
+
+    ::close(listener);
+    clients.clear(); // waits for the commands still running
+    ::unlink(socketPath.c_str());
+    std::cout << "Server stopped." << std::endl;
+    return 0;
+}
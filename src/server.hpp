@@ -0,0 +1,31 @@
+/**
+ * @file server.hpp
+ * @brief Header file for 'munnybud serve', which keeps the ledger and its
+ * indexes loaded and runs commands sent over a Unix domain socket, and for the
+ * client side used by the CLI
+ *
+ */
+
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include "storage.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief Socket the server listens on, next to the data files.
+ */
+inline const std::string SERVER_SOCKET_PATH = "../munnybud.sock";
+
+/**
+ * @brief Runs one command line against the given storage handler.
+ */
+using CommandRunner = int (*)(int argc, char* argv[], StorageHandler* storageHandler);
+
+int runServer(const std::string& socketPath, const std::string& walletFile, const std::string& transactionFile,
+              CommandRunner runCommand);
+bool forwardToServer(const std::string& socketPath, const std::vector<std::string>& args, int& exitCode);
+
+#endif
@@ -0,0 +1,65 @@
+/**
+ * @file sorting.cpp
+ * @brief Implementation file for the integer key sorting used to order query results
+ *
+ */
+
+#include "sorting.hpp"
+#include <array>
+#include <cstddef>
+
+/**
+ * @brief Sorts a vector of row indices by the integer key of each row.
+ *
+ * This is a stable LSD radix sort over 8 bit digits, so it runs in linear time
+ * and never compares the keys directly. Digits that are the same for every key
+ * (the high bytes of day numbers or ids, for example) are skipped entirely.
+ * Because it is stable, sorting by a secondary key first and by the primary key
+ * afterwards gives a fully ordered result.
+ *
+ * @param rows the row indices to sort, reordered in place
+ * @param keys the key of each row, indexed by row
+ * @param descending whether rows with bigger keys should come first
+ */
+void radixSortRows(std::vector<std::uint32_t>& rows, const std::vector<std::int64_t>& keys, bool descending) {
+    const size_t n = rows.size();
+    if (n < 2)
+        return;
+
+    // flip the sign bit so that negative keys come before positive ones when
+    // compared as unsigned, and invert everything for a descending order
+    std::vector<std::uint64_t> current(n);
+    for (size_t i = 0; i < n; i++) {
+        std::uint64_t key = static_cast<std::uint64_t>(keys[rows[i]]) ^ (std::uint64_t(1) << 63);
+        current[i] = descending ? ~key : key;
+    }
+
+    std::array<std::array<size_t, 256>, 8> counts{};
+    for (std::uint64_t key : current) {
+        for (int digit = 0; digit < 8; digit++)
+            counts[digit][(key >> (8 * digit)) & 0xff]++;
+    }
+
+    std::vector<std::uint64_t> nextKeys(n);
+    std::vector<std::uint32_t> nextRows(n);
+    for (int digit = 0; digit < 8; digit++) {
+        const int shift = 8 * digit;
+        auto& count = counts[digit];
+        if (count[(current[0] >> shift) & 0xff] == n)
+            continue; // every key has the same digit here
+
+        size_t offset = 0;
+        for (size_t& c : count) {
+            size_t tmp = c;
+            c = offset;
+            offset += tmp;
+        }
+        for (size_t i = 0; i < n; i++) {
+            size_t pos = count[(current[i] >> shift) & 0xff]++;
+            nextKeys[pos] = current[i];
+            nextRows[pos] = rows[i];
+        }
+        current.swap(nextKeys);
+        rows.swap(nextRows);
+    }
+}
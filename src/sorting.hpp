@@ -0,0 +1,15 @@
+/**
+ * @file sorting.hpp
+ * @brief Header file for the integer key sorting used to order query results
+ *
+ */
+
+#ifndef SORTING_HPP
+#define SORTING_HPP
+
+#include <cstdint>
+#include <vector>
+
+void radixSortRows(std::vector<std::uint32_t>& rows, const std::vector<std::int64_t>& keys, bool descending);
+
+#endif
@@ -0,0 +1,299 @@
+/**
+ * @file spill.cpp
+ * @brief Implementation file for the spill files, the external merge sort and
+ * the spilling hash aggregation
+ *
+ * A spilled transaction is its id and amount, the length-prefixed category,
+ * description, wallet and date, and the count and ids of its tags, all in
+ * native byte order: spill files never outlive the process that wrote them.
+ *
+ */
+
+#include "spill.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <stdexcept>
+
+#include <unistd.h>
+
+static const size_t SPILL_BUFFER_BYTES = 1 << 16;
+
+/**
+ * @brief Creates and unlinks the file.
+ * @throws std::runtime_error if it cannot be created
+ */
+SpillFile::SpillFile() {
+    const char* directory = std::getenv("TMPDIR");
+    std::string path = std::string(directory && *directory ? directory : "/tmp") + "/munnybud-spill-XXXXXX";
+    int fd = ::mkstemp(path.data());
+    if (fd < 0)
+        throw std::runtime_error("Error: could not create spill file in " + path + ": " + std::strerror(errno));
+    ::unlink(path.c_str());
+    file = ::fdopen(fd, "w+b");
+    if (!file) {
+        ::close(fd);
+        throw std::runtime_error(std::string("Error: could not open spill file: ") + std::strerror(errno));
+    }
+    std::setvbuf(file, nullptr, _IOFBF, SPILL_BUFFER_BYTES);
+}
+
+SpillFile::~SpillFile() {
+    if (file)
+        std::fclose(file);
+}
+
+void SpillFile::write(const void* data, size_t size) {
+    if (size > 0 && std::fwrite(data, 1, size, file) != size)
+        throw std::runtime_error(std::string("Error: could not write spill file: ") + std::strerror(errno));
+}
+
+/**
+ * @brief Reads exactly size bytes.
+ *
+ * @return bool false at the end of the file
+ * @throws std::runtime_error on a read error or a truncated record
+ */
+bool SpillFile::read(void* data, size_t size) {
+    size_t got = std::fread(data, 1, size, file);
+    if (got == size)
+        return true;
+    if (got == 0 && std::feof(file))
+        return false;
+    throw std::runtime_error("Error: could not read spill file.");
+}
+
+/**
+ * @brief Flushes what was written and goes back to the start for reading.
+ */
+void SpillFile::rewind() {
+    if (std::fflush(file) != 0 || std::fseek(file, 0, SEEK_SET) != 0)
+        throw std::runtime_error(std::string("Error: could not rewind spill file: ") + std::strerror(errno));
+}
+
+void SpillFile::writeString(const std::string& text) {
+    std::uint32_t length = static_cast<std::uint32_t>(text.size());
+    write(&length, sizeof(length));
+    write(text.data(), text.size());
+}
+
+bool SpillFile::readString(std::string& text) {
+    std::uint32_t length;
+    if (!read(&length, sizeof(length)))
+        return false;
+    text.resize(length);
+    if (length > 0 && !read(text.data(), length))
+        throw std::runtime_error("Error: could not read spill file.");
+    return true;
+}
+
+void SpillFile::writeTransaction(const Transaction& transaction) {
+    write(&transaction.id, sizeof(transaction.id));
+    write(&transaction.amount, sizeof(transaction.amount));
+    writeString(transaction.category);
+    writeString(transaction.description);
+    writeString(transaction.wallet);
+    writeString(transaction.date);
+    std::uint32_t tagCount = static_cast<std::uint32_t>(transaction.tags.size());
+    write(&tagCount, sizeof(tagCount));
+    write(transaction.tags.data(), tagCount * sizeof(int));
+}
+
+/**
+ * @brief Reads the next transaction.
+ *
+ * @return bool false at the end of the file
+ */
+bool SpillFile::readTransaction(Transaction& transaction) {
+    if (!read(&transaction.id, sizeof(transaction.id)))
+        return false;
+    std::uint32_t tagCount = 0;
+    if (!read(&transaction.amount, sizeof(transaction.amount)) || !readString(transaction.category) ||
+        !readString(transaction.description) || !readString(transaction.wallet) || !readString(transaction.date) ||
+        !read(&tagCount, sizeof(tagCount)))
+        throw std::runtime_error("Error: could not read spill file.");
+    transaction.tags.resize(tagCount);
+    if (tagCount > 0 && !read(transaction.tags.data(), tagCount * sizeof(int)))
+        throw std::runtime_error("Error: could not read spill file.");
+    return true;
+}
+
+/**
+ * @brief Approximate memory held by a transaction, for the memory budgets.
+ */
+size_t transactionFootprint(const Transaction& transaction) {
+    return sizeof(Transaction) + transaction.category.capacity() + transaction.description.capacity() +
+           transaction.wallet.capacity() + transaction.date.capacity() + transaction.tags.capacity() * sizeof(int);
+}
+
+/**
+ * @brief Adds a transaction, writing out a sorted run when the buffer reaches
+ * the memory budget.
+ */
+void ExternalSorter::add(Transaction transaction) {
+    bufferedBytes += transactionFootprint(transaction);
+    buffer.push_back(std::move(transaction));
+    if (bufferedBytes >= memoryBudget)
+        spillRun();
+}
+
+/**
+ * @brief Sorts the buffered transactions and writes them out as a run.
+ */
+void ExternalSorter::spillRun() {
+    std::sort(buffer.begin(), buffer.end(), less);
+    auto run = std::make_unique<SpillFile>();
+    for (const Transaction& transaction : buffer)
+        run->writeTransaction(transaction);
+    run->rewind();
+    runs.push_back(std::move(run));
+    buffer.clear();
+    buffer.shrink_to_fit();
+    bufferedBytes = 0;
+}
+
+/**
+ * @brief Merges sorted runs, reading them from their current position.
+ * Only the head of each run is in memory.
+ *
+ * @param group the runs, rewound
+ * @return Generator<Transaction> the transactions of every run, in order
+ */
+static Generator<Transaction> mergeSortedRuns(std::vector<SpillFile*> group, ExternalSorter::Less less) {
+    std::vector<Transaction> heads(group.size());
+    auto later = [&](size_t a, size_t b) { return less(heads[b], heads[a]); };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(later);
+    for (size_t i = 0; i < group.size(); i++) {
+        if (group[i]->readTransaction(heads[i]))
+            heap.push(i);
+    }
+    while (!heap.empty()) {
+        size_t next = heap.top();
+        heap.pop();
+        co_yield heads[next];
+        if (group[next]->readTransaction(heads[next]))
+            heap.push(next);
+    }
+}
+
+/**
+ * @brief Merges a group of runs into a single new run.
+ */
+std::unique_ptr<SpillFile> ExternalSorter::mergeRuns(std::vector<std::unique_ptr<SpillFile>> group) {
+    std::vector<SpillFile*> files;
+    for (const auto& run : group)
+        files.push_back(run.get());
+    auto merged = std::make_unique<SpillFile>();
+    for (const Transaction& transaction : mergeSortedRuns(files, less))
+        merged->writeTransaction(transaction);
+    merged->rewind();
+    return merged;
+}
+
+/**
+ * @brief Yields every added transaction in order. Must be called once, after
+ * the last add. Transactions that fit in the budget are sorted in memory,
+ * otherwise the runs are merged.
+ *
+ * @return Generator<const Transaction*> the transactions, in order
+ */
+Generator<const Transaction*> ExternalSorter::sorted() {
+    if (runs.empty()) {
+        std::sort(buffer.begin(), buffer.end(), less);
+        for (const Transaction& transaction : buffer) {
+            const Transaction* row = &transaction;
+            co_yield row;
+        }
+        co_return;
+    }
+
+    if (!buffer.empty())
+        spillRun();
+    while (runs.size() > MAX_MERGE_FANIN) {
+        std::vector<std::unique_ptr<SpillFile>> next;
+        for (size_t first = 0; first < runs.size(); first += MAX_MERGE_FANIN) {
+            size_t last = std::min(runs.size(), first + MAX_MERGE_FANIN);
+            std::vector<std::unique_ptr<SpillFile>> group;
+            for (size_t i = first; i < last; i++)
+                group.push_back(std::move(runs[i]));
+            next.push_back(group.size() == 1 ? std::move(group[0]) : mergeRuns(std::move(group)));
+        }
+        runs = std::move(next);
+    }
+
+    std::vector<SpillFile*> files;
+    for (const auto& run : runs)
+        files.push_back(run.get());
+    for (const Transaction& transaction : mergeSortedRuns(files, less)) {
+        const Transaction* row = &transaction;
+        co_yield row;
+    }
+}
+
+/**
+ * @brief Spill partition of a key, from a hash salted with the depth so a
+ * partition aggregated one level down spreads over all the new partitions.
+ */
+size_t SpillingAggregator::partitionOf(const std::string& key) const {
+    std::uint64_t hash = std::hash<std::string>{}(key) ^ ((depth + 1) * 0x9e3779b97f4a7c15ULL);
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return static_cast<size_t>((hash ^ (hash >> 31)) % SPILL_PARTITIONS);
+}
+
+/**
+ * @brief Adds an amount to the histogram of a key, or to the spill partition
+ * of the key when the table is full and does not have it yet.
+ */
+void SpillingAggregator::add(const std::string& key, std::int64_t amount) {
+    auto it = table.find(key);
+    if (it != table.end()) {
+        it->second.add(amount);
+        return;
+    }
+    // past MAX_DEPTH the keys hash alike, so the budget gives way
+    const size_t entryBytes = sizeof(AmountHistogram) + key.capacity() + 64;
+    if (table.empty() || tableBytes + entryBytes <= memoryBudget || depth >= MAX_DEPTH) {
+        table[key].add(amount);
+        tableBytes += entryBytes;
+        return;
+    }
+    if (partitions.empty()) {
+        for (size_t i = 0; i < SPILL_PARTITIONS; i++)
+            partitions.push_back(std::make_unique<SpillFile>());
+    }
+    SpillFile& partition = *partitions[partitionOf(key)];
+    partition.writeString(key);
+    partition.write(&amount, sizeof(amount));
+}
+
+/**
+ * @brief Emits the histogram of every key, each exactly once and in no
+ * particular order: first the keys of the table, then the keys of each spill
+ * partition. The aggregator is empty afterwards.
+ */
+void SpillingAggregator::finish(const Emit& emit) {
+    for (const auto& [key, histogram] : table)
+        emit(key, histogram);
+    table.clear();
+    tableBytes = 0;
+
+    std::vector<std::unique_ptr<SpillFile>> spilled = std::move(partitions);
+    partitions.clear();
+    for (auto& partition : spilled) {
+        partition->rewind();
+        SpillingAggregator next(memoryBudget, depth + 1);
+        std::string key;
+        std::int64_t amount;
+        while (partition->readString(key)) {
+            if (!partition->read(&amount, sizeof(amount)))
+                throw std::runtime_error("Error: could not read spill file.");
+            next.add(key, amount);
+        }
+        partition.reset();
+        next.finish(emit);
+    }
+}
@@ -0,0 +1,119 @@
+/**
+ * @file spill.hpp
+ * @brief Header file for the spill files of the out-of-core queries: an
+ * external merge sort of transactions and a hash aggregation that spills the
+ * groups it has no room for
+ *
+ */
+
+#ifndef SPILL_HPP
+#define SPILL_HPP
+
+#include "generator.hpp"
+#include "stats.hpp"
+#include "transaction.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+* @class
+* @brief Temporary file in $TMPDIR (or /tmp), unlinked as soon as it is
+* created so it never outlives the process. Written sequentially, then
+* rewound and read back sequentially. I/O errors throw std::runtime_error.
+*/
+class SpillFile {
+public:
+    SpillFile();
+    ~SpillFile();
+    SpillFile(const SpillFile&) = delete;
+    SpillFile& operator=(const SpillFile&) = delete;
+
+    void write(const void* data, size_t size);
+    bool read(void* data, size_t size);
+    void rewind();
+
+    void writeString(const std::string& text);
+    bool readString(std::string& text);
+    void writeTransaction(const Transaction& transaction);
+    bool readTransaction(Transaction& transaction);
+
+private:
+    std::FILE* file = nullptr;
+};
+
+/**
+* @class
+* @brief Sorts more transactions than fit in memory.
+*
+* Transactions are buffered until the buffer reaches the memory budget, then
+* sorted and written out as a run. Once every transaction is added, the runs
+* are merged back with a heap holding the head of each run, MAX_MERGE_FANIN
+* runs at a time (wider merges are done in passes). When everything fits in
+* the budget nothing is written at all.
+*/
+class ExternalSorter {
+public:
+    using Less = std::function<bool(const Transaction&, const Transaction&)>;
+    static const size_t MAX_MERGE_FANIN = 64;
+
+    ExternalSorter(Less _less, size_t _memoryBudget) : less(std::move(_less)), memoryBudget(_memoryBudget) {}
+
+    void add(Transaction transaction);
+    Generator<const Transaction*> sorted();
+    size_t runCount() const { return runs.size(); }
+
+private:
+    Less less;
+    size_t memoryBudget;
+    size_t bufferedBytes = 0;
+    std::vector<Transaction> buffer;
+    std::vector<std::unique_ptr<SpillFile>> runs;
+
+    void spillRun();
+    std::unique_ptr<SpillFile> mergeRuns(std::vector<std::unique_ptr<SpillFile>> group);
+};
+
+/**
+* @class
+* @brief Per-key amount histograms of more keys than fit in memory.
+*
+* Keys are aggregated in a hash table until it reaches the memory budget.
+* From then on, amounts of keys that are not already in the table are
+* written to one of SPILL_PARTITIONS files chosen by a hash of the key. When
+* the table is emitted, each partition is aggregated in turn by a fresh
+* aggregator (a different hash, so a partition that is still too big splits
+* further), and only one partition is ever in memory.
+*/
+class SpillingAggregator {
+public:
+    using Emit = std::function<void(const std::string&, const AmountHistogram&)>;
+    static const size_t SPILL_PARTITIONS = 16;
+    static const unsigned MAX_DEPTH = 6;
+
+    explicit SpillingAggregator(size_t _memoryBudget, unsigned _depth = 0)
+        : memoryBudget(_memoryBudget), depth(_depth) {}
+
+    void add(const std::string& key, std::int64_t amount);
+    void finish(const Emit& emit);
+    bool hasSpilled() const { return !partitions.empty(); }
+
+private:
+    size_t memoryBudget;
+    unsigned depth;
+    size_t tableBytes = 0;
+    std::unordered_map<std::string, AmountHistogram> table;
+    std::vector<std::unique_ptr<SpillFile>> partitions;
+
+    size_t partitionOf(const std::string& key) const;
+};
+
+size_t transactionFootprint(const Transaction& transaction);
+
+#endif
@@ -0,0 +1,73 @@
+/**
+ * @file spscqueue.hpp
+ * @brief Header file for the bounded single-producer single-consumer queue
+ * used between the stages of the load pipeline
+ *
+ */
+
+#ifndef SPSCQUEUE_HPP
+#define SPSCQUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+* @class
+* @brief Bounded lock-free ring buffer for exactly one producer thread and one
+* consumer thread.
+*
+* The producer only writes tail and the consumer only writes head, so both
+* sides just need acquire/release ordering on the other side's index. The two
+* indices live on separate cache lines to avoid false sharing. Once the
+* producer is done it closes the queue, and the consumer drains what is left.
+*/
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : slots(capacity + 1) {}
+
+    /**
+     * @brief Pushes an item if there is room. The item is only moved from on success.
+     *
+     * @return true if the item was pushed, false if the queue is full
+     */
+    bool tryPush(T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = t + 1 == slots.size() ? 0 : t + 1;
+        if (next == head.load(std::memory_order_acquire))
+            return false;
+        slots[t] = std::move(item);
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Pops the oldest item if there is one.
+     *
+     * @return true if an item was popped into out, false if the queue is empty
+     */
+    bool tryPop(T& out) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        out = std::move(slots[h]);
+        head.store(h + 1 == slots.size() ? 0 : h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Called by the producer after its last push.
+     */
+    void close() { closed.store(true, std::memory_order_release); }
+    bool isClosed() const { return closed.load(std::memory_order_acquire); }
+
+private:
+    std::vector<T> slots;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    std::atomic<bool> closed{false};
+};
+
+#endif
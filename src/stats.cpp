@@ -0,0 +1,113 @@
+/**
+ * @file stats.cpp
+ * @brief Implementation file for the streaming amount statistics (percentiles and histograms)
+ *
+ */
+
+#include "stats.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+/**
+ * @brief Maps a value to its bucket. Values below SUB_BUCKETS get a bucket
+ * of their own, bigger ones are bucketed by exponent and top mantissa bits.
+ *
+ * @param value the value (absolute amount in cents)
+ * @return int the bucket index
+ */
+int AmountHistogram::bucketIndex(std::uint64_t value) {
+    if (value < SUB_BUCKETS)
+        return static_cast<int>(value);
+    int exponent = 63 - std::countl_zero(value);
+    int mantissa = static_cast<int>((value >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1));
+    return (exponent - SUB_BITS + 1) * SUB_BUCKETS + mantissa;
+}
+
+/**
+ * @brief Smallest value that falls in the given bucket
+ */
+std::uint64_t AmountHistogram::bucketLow(int index) {
+    if (index < SUB_BUCKETS)
+        return static_cast<std::uint64_t>(index);
+    int exponent = index / SUB_BUCKETS + SUB_BITS - 1;
+    std::uint64_t mantissa = static_cast<std::uint64_t>(index % SUB_BUCKETS);
+    return (std::uint64_t(1) << exponent) + (mantissa << (exponent - SUB_BITS));
+}
+
+/**
+ * @brief Biggest value that falls in the given bucket
+ */
+std::uint64_t AmountHistogram::bucketHigh(int index) {
+    if (index < SUB_BUCKETS)
+        return static_cast<std::uint64_t>(index);
+    int exponent = index / SUB_BUCKETS + SUB_BITS - 1;
+    return bucketLow(index) + (std::uint64_t(1) << (exponent - SUB_BITS)) - 1;
+}
+
+/**
+ * @brief Adds an amount to the histogram. Only its magnitude is bucketed,
+ * so expenses and incomes should be kept in separate histograms.
+ *
+ * @param amount amount in cents
+ */
+void AmountHistogram::add(std::int64_t amount) {
+    std::uint64_t value = amount < 0 ? 0 - static_cast<std::uint64_t>(amount) : static_cast<std::uint64_t>(amount);
+    counts[bucketIndex(value)]++;
+    total++;
+    amountSum += amount;
+    smallest = std::min(smallest, value);
+    largest = std::max(largest, value);
+}
+
+/**
+ * @brief Adds the contents of another histogram to this one.
+ *
+ * @param other histogram built over another partition
+ */
+void AmountHistogram::merge(const AmountHistogram& other) {
+    for (int i = 0; i < BUCKETS; i++)
+        counts[i] += other.counts[i];
+    total += other.total;
+    amountSum += other.amountSum;
+    smallest = std::min(smallest, other.smallest);
+    largest = std::max(largest, other.largest);
+}
+
+/**
+ * @brief Estimates the q-quantile of the magnitudes added so far, using the
+ * middle of the bucket it falls in (clamped to the exact min and max).
+ *
+ * @param q quantile between 0 and 1 (0.5 for the median)
+ * @return std::int64_t the estimated magnitude in cents, 0 when empty
+ */
+std::int64_t AmountHistogram::quantile(double q) const {
+    if (total == 0)
+        return 0;
+    q = std::clamp(q, 0.0, 1.0);
+    std::uint64_t rank = static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(total)));
+    rank = std::max<std::uint64_t>(rank, 1);
+
+    std::uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            std::uint64_t middle = bucketLow(i) + (bucketHigh(i) - bucketLow(i)) / 2;
+            return static_cast<std::int64_t>(std::clamp(middle, smallest, largest));
+        }
+    }
+    return static_cast<std::int64_t>(largest);
+}
+
+/**
+ * @brief Counts the magnitudes in [low, high). Bucket boundaries are used
+ * as-is, so the range edges should be powers of two for exact counts.
+ */
+std::uint64_t AmountHistogram::countBetween(std::uint64_t low, std::uint64_t high) const {
+    std::uint64_t result = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        if (bucketLow(i) >= low && bucketLow(i) < high)
+            result += counts[i];
+    }
+    return result;
+}
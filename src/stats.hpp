@@ -0,0 +1,50 @@
+/**
+ * @file stats.hpp
+ * @brief Header file for the streaming amount statistics (percentiles and histograms)
+ *
+ */
+
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <array>
+#include <cstdint>
+
+/**
+* @class
+* @brief Fixed-bucket log histogram of amounts in cents.
+*
+* Every power of two is split in 32 linear sub-buckets, so any quantile is
+* within ~3% of the exact value while the memory used stays constant no
+* matter how many amounts are added. Two histograms can be merged by adding
+* their buckets, which lets partitions be summarized independently.
+*/
+class AmountHistogram {
+public:
+    static constexpr int SUB_BITS = 5;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    void add(std::int64_t amount);
+    void merge(const AmountHistogram& other);
+    std::int64_t quantile(double q) const;
+
+    std::uint64_t count() const { return total; }
+    std::int64_t sum() const { return amountSum; }
+    std::uint64_t min() const { return smallest; }
+    std::uint64_t max() const { return largest; }
+    std::uint64_t countBetween(std::uint64_t low, std::uint64_t high) const;
+
+    static int bucketIndex(std::uint64_t value);
+    static std::uint64_t bucketLow(int index);
+    static std::uint64_t bucketHigh(int index);
+
+private:
+    std::array<std::uint64_t, BUCKETS> counts{};
+    std::uint64_t total = 0;
+    std::int64_t amountSum = 0;
+    std::uint64_t smallest = UINT64_MAX;
+    std::uint64_t largest = 0;
+};
+
+#endif
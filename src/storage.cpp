@@ -7,12 +7,54 @@
 */
 
 #include "storage.hpp"
+#include "executor.hpp"
+#include "loader.hpp"
+#include "segment.hpp"
+#include "sorting.hpp"
 #include "utils.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <chrono>
 #include <regex>
+#include <sstream>
 #include <stdexcept>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <queue>
+#include <utility>
+
+/**
+* @brief Conflicting commits retried without holding the ledger lock, before
+* the lock is held across the whole reload and write.
+*/
+static const int MAX_OPTIMISTIC_COMMITS = 8;
+
+/**
+* @brief Smallest ledger whose queries are split in date partitions, below this
+* the tasks cost more than they save.
+*/
+static const size_t MIN_PARTITIONED_ROWS = 1 << 16;
+
+/**
+* @brief A posting of fewer than 1/SELECTIVE_FRACTION of the rows makes a query
+* selective enough to be driven by its postings instead of the date partitions.
+*/
+static const size_t SELECTIVE_FRACTION = 8;
+
+/**
+* @brief Suffixes of the files of a commit in progress, next to the data files:
+* the next contents of a file, and the record of a commit whose files are
+* written.
+*/
+static const char* TEMPORARY_SUFFIX = ".tmp";
+static const char* COMMIT_RECORD_SUFFIX = ".commit";
 
 /**
 * @brief Sets up a new transaction json file with the proper structure.
@@ -23,7 +65,7 @@ If, say, the wallet index returns almost every transaction because most transact
 int StorageHandler::setupTransactions(const std::string &transactionFile) {
 std::ofstream file(transactionFile);
 if (!file.is_open()) {
-    std::cerr << "Error opening file for writing: " << transactionFile << " ."
+    errStream() << "Error opening file for writing: " << transactionFile << " ."
             << std::endl;
     return -1;
 }
@@ -32,7 +74,7 @@ json data = {{"metadata", {{"currentID", 0}}}, {"data", json::object()}};
 
 file << data.dump(4);
 if (!file) {
-    std::cerr << "Error writing to file: " << transactionFile << std::endl;
+    errStream() << "Error writing to file: " << transactionFile << std::endl;
     return -1;
 }
 
@@ -50,7 +92,7 @@ return 0;
 int StorageHandler::setupWallets(const std::string &walletFile) {
 std::ofstream file(walletFile);
 if (!file.is_open()) {
-    std::cerr << "Error opening file for writing: " << walletFile << " ."
+    errStream() << "Error opening file for writing: " << walletFile << " ."
             << std::endl;
     return -1;
 }
@@ -60,7 +102,7 @@ float walletMoney;
 std::string walletName;
 
 while (true) {
-    std::cout << "Enter name of default wallet (leave empty for 'default'): ";
+    outStream() << "Enter name of default wallet (leave empty for 'default'): ";
     std::getline(std::cin, walletName);
     if (walletName.empty()) {
     walletName = "default";
@@ -71,16 +113,16 @@ while (true) {
     if (std::regex_match(walletName, alphaNum)) {
     break;
     } else {
-    std::cout << "Invalid wallet name. Must only contain alphanumeric "
+    outStream() << "Invalid wallet name. Must only contain alphanumeric "
                 "characters.\n";
     }
 }
 
-std::cout << "Enter amount of money in default wallet: ";
+outStream() << "Enter amount of money in default wallet: ";
 while (!(std::cin >> walletMoney)) {
     std::cin.clear();
     std::cin.ignore(std::numeric_limits<std::streamsize>::max());
-    std::cout << "Invalid amount. Please enter a number: ";
+    outStream() << "Invalid amount. Please enter a number: ";
 }
 
 data["default_wallet"] = walletName;
@@ -89,7 +131,7 @@ data["wallets"][walletName] = static_cast<int>(std::round(walletMoney * 100));
 
 file << data.dump(4);
 if (!file) {
-    std::cerr << "Error writing to file: " << walletFile << std::endl;
+    errStream() << "Error writing to file: " << walletFile << std::endl;
     return -1;
 }
 
@@ -99,7 +141,8 @@ return 0;
 
 /**
 * @brief Loads the file contents of the provided file (path) into a
-* nlohmann::basicjson<> object and returns it.
+* nlohmann::basicjson<> object and returns it. Large files are parsed in
+* chunks on several threads, see parseChunked.
 *
 * @param filePath the path to the file
 * @return json - nlohmann::basicjson<> object with the loaded data
@@ -109,9 +152,10 @@ std::ifstream file(filePath);
 json data;
 if (file.is_open()) {
     try {
-    data = json::parse(file);
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    data = parseChunked(text);
     } catch (json::parse_error &e) {
-    std::cout << "JSON parse error: " << e.what() << std::endl;
+    outStream() << "JSON parse error: " << e.what() << std::endl;
     throw std::runtime_error("JSON Parse Error");
     }
     file.close();
@@ -122,6 +166,84 @@ if (file.is_open()) {
 return data;
 }
 
+/**
+* @brief Loads the transaction file through the load pipeline, which builds
+* the indexes while the file is being parsed. Setting MUNNYBUD_LOAD_STATS
+* prints the per-stage throughput and queue stalls to stderr.
+* The "data" object is not kept as json by the pipeline, the file contents are
+* held instead until ensureData needs it.
+* When the index segment next to the file was built from this same version of
+* the file, the indexes are attached from it and the file is not read at all.
+* Otherwise this process builds them and publishes a new segment.
+*
+* @param filePath the path to the transaction file
+* @return json - nlohmann::basicjson<> object with the loaded data
+*/
+json StorageHandler::loadTransactionFile(const std::string &filePath) {
+json data;
+const std::string segmentPath = filePath + ".idx";
+LedgerStamp stamp;
+bool stamped = LedgerStamp::of(filePath, stamp);
+if (stamped && attachIndexSegment(segmentPath, stamp, idxManager, data)) {
+    isDataPending = true;
+    if (std::getenv("MUNNYBUD_LOAD_STATS"))
+        std::cerr << "load: attached index segment " << segmentPath << std::endl;
+    return data;
+}
+
+std::ifstream file(filePath);
+if (file.is_open()) {
+    try {
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    LoadReport report;
+    data = loadPipelined(text, idxManager, report);
+    if (report.pipelined) {
+        pendingTransactionText = std::make_shared<const std::string>(std::move(text));
+        isDataPending = true;
+        // only publish the segment if the file did not change while it was read
+        LedgerStamp after;
+        if (stamped && LedgerStamp::of(filePath, after) && after == stamp)
+            writeIndexSegment(segmentPath, stamp, idxManager, data);
+    }
+    if (std::getenv("MUNNYBUD_LOAD_STATS"))
+        report.print(std::cerr);
+    } catch (json::parse_error &e) {
+    outStream() << "JSON parse error: " << e.what() << std::endl;
+    throw std::runtime_error("JSON Parse Error");
+    }
+    file.close();
+}
+
+return data;
+}
+
+/**
+* @brief Parses the "data" object of the transaction file into the date
+* buckets if the load pipeline or the index segment skipped it, reading the
+* file again if needed. Must be called before anything reads or modifies
+* the buckets.
+*
+*/
+void StorageHandler::ensureData() {
+if (!isDataPending)
+    return;
+try {
+    std::string text;
+    if (!pendingTransactionText) {
+        std::ifstream file(transactionFile);
+        text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    json parsed = parseChunked(pendingTransactionText ? *pendingTransactionText : text);
+    buckets = takeBuckets(parsed);
+    transactions["data"] = std::move(parsed["data"]);
+} catch (json::parse_error &e) {
+    outStream() << "JSON parse error: " << e.what() << std::endl;
+    throw std::runtime_error("JSON Parse Error");
+}
+pendingTransactionText.reset();
+isDataPending = false;
+}
+
 /**
 * @brief This function calls loadFile for both the wallet file and the
 * transaction file and loads them into the appropriate member variables in the
@@ -129,48 +251,226 @@ return data;
 *
 */
 void StorageHandler::loadData() {
+if (std::filesystem::exists(transactionFile + COMMIT_RECORD_SUFFIX) && !ledgerLock->isHeld()) {
+    // a writer died between its renames, or is in the middle of them
+    LedgerLock::Exclusive guard(*ledgerLock);
+    if (!guard.ok() || !finishCommit())
+        throw std::runtime_error("Could not complete the last commit of the ledger.");
+}
+// read first: a commit after this point makes the data newer, never older
+loadedGeneration = ledgerLock->readGeneration();
 wallets = loadFile(walletFile);
-transactions = loadFile(transactionFile);
+transactions = loadTransactionFile(transactionFile);
+buckets = takeBuckets(transactions);
 
 if (!transactions.contains("metadata") ||
     !transactions["metadata"].contains("currentID"))
     throw std::runtime_error("Transaction metadata invalid.");
-Transaction::currentID = transactions["metadata"]["currentID"];
+idAllocator->observe(transactions["metadata"]["currentID"].get<TransactionId>());
 
 if (!wallets.contains("default_wallet"))
     throw std::runtime_error("Could not find default wallet.");
 
-StorageHandler::default_wallet = wallets["default_wallet"];
+default_wallet = wallets["default_wallet"];
 }
 
 /**
-* @brief Stores the contents of json data in the given filePath, effectively
-* updating user storage.
+* @brief Writes the next contents of a data file next to it, to be renamed
+* over it by finishCommit.
 *
-* @param filePath the path to the file
-* @param data nlohmann::basic_json<> containing user data
+* @param filePath the path to the data file
+* @param text the new file contents
 * @return int -1 on error, 0 for success
 */
-int StorageHandler::storeFile(const std::string &filePath, json &data) {
-std::ofstream file(filePath);
+int StorageHandler::writeTemporaryFile(const std::string &filePath, const std::string &text) {
+const std::string temporaryPath = filePath + TEMPORARY_SUFFIX;
+std::ofstream file(temporaryPath, std::ios::trunc);
 if (!file.is_open()) {
-    std::cerr << "Error: Could not open file for writing." << std::endl;
+    errStream() << "Error: Could not open file for writing." << std::endl;
     return -1;
 }
-file << std::setprecision(2) << data.dump(4);
+file << text;
 file.close();
+if (!file) {
+    errStream() << "Error: Could not write " << temporaryPath << std::endl;
+    std::remove(temporaryPath.c_str());
+    return -1;
+}
 return 0;
 }
 
 /**
-* @brief Wrapper function that calls storeFile for the json data structures in
-* the StorageHandler class.
+* @brief Writes the commit record: the generation the ledger is at once the
+* temporary files written by writeTemporaryFile replace the data files. The
+* record is itself renamed into place, so it exists complete or not at all,
+* and from then on the commit is durable. Must be called with the exclusive
+* lock held.
+*
+* @param generation the generation of the commit
+* @return int -1 on error, 0 for success
+*/
+int StorageHandler::writeCommitRecord(std::int64_t generation) {
+const std::string recordPath = transactionFile + COMMIT_RECORD_SUFFIX;
+if (writeTemporaryFile(recordPath, std::to_string(generation)) != 0)
+    return -1;
+const std::string temporaryPath = recordPath + TEMPORARY_SUFFIX;
+if (std::rename(temporaryPath.c_str(), recordPath.c_str()) != 0) {
+    errStream() << "Error: Could not write " << recordPath << std::endl;
+    std::remove(temporaryPath.c_str());
+    return -1;
+}
+return 0;
+}
+
+/**
+* @brief Completes the recorded commit, if there is one: renames the temporary
+* files that are still there over the data files, moves the ledger generation
+* to the recorded one and removes the record. Renames already done by an
+* earlier attempt are skipped, so a commit interrupted at any point is completed
+* by running this again. Must be called with the exclusive lock held.
+*
+* @return bool false if the commit could not be completed (the record is kept)
+*/
+bool StorageHandler::finishCommit() {
+const std::string recordPath = transactionFile + COMMIT_RECORD_SUFFIX;
+std::ifstream record(recordPath);
+if (!record.is_open())
+    return true;
+std::int64_t generation = -1;
+record >> generation;
+record.close();
+if (generation < 0) {
+    errStream() << "Error: invalid commit record " << recordPath << std::endl;
+    return false;
+}
+
+for (const std::string* filePath : {&walletFile, &transactionFile}) {
+    const std::string temporaryPath = *filePath + TEMPORARY_SUFFIX;
+    if (std::filesystem::exists(temporaryPath) && std::rename(temporaryPath.c_str(), filePath->c_str()) != 0) {
+        errStream() << "Error: Could not write " << *filePath << std::endl;
+        return false;
+    }
+}
+if (ledgerLock->readGeneration() < generation && !ledgerLock->writeGeneration(generation)) {
+    errStream() << "Error: could not update the ledger generation." << std::endl;
+    return false;
+}
+std::remove(recordPath.c_str());
+return true;
+}
+
+/**
+* @brief Serializes the transaction file as json::dump(4) would, with the date
+* buckets written in place of the empty "data" object of transactions. Each
+* bucket is dumped on its own, so none of them is copied into one document.
+*
+* @return std::string the contents of the transaction file
+*/
+std::string StorageHandler::dumpTransactions() const {
+    std::string text = transactions.dump(4);
+    static const std::string EMPTY_DATA = "\n    \"data\": {}";
+    const size_t data = text.find(EMPTY_DATA);
+    if (data == std::string::npos || buckets->empty())
+        return text;
+
+    std::string body = "{\n";
+    for (const auto& [date, bucket] : *buckets) {
+        if (body.size() > 2)
+            body += ",\n";
+        std::string dumped = bucket->dump(4);
+        body += "        " + json(date).dump() + ": ";
+        for (char c : dumped) {
+            body += c;
+            if (c == '\n')
+                body += "        ";
+        }
+    }
+    body += "\n    }";
+    const size_t braces = data + EMPTY_DATA.size() - 2;
+    return text.replace(braces, 2, body);
+}
+
+/**
+* @brief Applies a change to the loaded ledger and writes it back, without
+* losing changes other processes committed in the meantime.
+*
+* The change is applied and serialized without holding any lock. The
+* exclusive lock is only taken to check that the ledger generation is still
+* the one the data was loaded at, and to write the files and bump the
+* generation. If another writer committed first, the ledger is reloaded and
+* the change applied again. After MAX_OPTIMISTIC_COMMITS conflicts the last
+* attempt holds the lock from the reload to the write, so it cannot conflict.
+*
+* Both files are written to temporary files first, then a commit record is
+* written and the temporary files are renamed over the data files. A commit
+* cut short between the renames is completed from its record by the next
+* writer or the next load, so wallet balances always end up matching the
+* transactions.
+*
+* @param apply applies the change to the loaded data; returns -1 to abort the
+* commit, after which the loaded data is reloaded since the change may have
+* been applied in part
+* @return int -1 on error (nothing was committed), 0 on success, PARTIAL_COMMIT
+* if the commit is recorded but its files could not all be replaced yet
+*/
+int StorageHandler::commitChange(const std::function<int()> &apply) {
+for (int attempt = 0; attempt <= MAX_OPTIMISTIC_COMMITS; attempt++) {
+    const bool pessimistic = attempt == MAX_OPTIMISTIC_COMMITS;
+    std::optional<LedgerLock::Exclusive> guard;
+    if (pessimistic) {
+        guard.emplace(*ledgerLock);
+        if (!guard->ok())
+            return -1;
+    }
+    if (attempt > 0)
+        reload();
+    ensureData();
+    if (apply() != 0) {
+        reload();
+        return -1;
+    }
+
+    transactions["metadata"]["generation"] = loadedGeneration + 1;
+    const std::string walletText = wallets.dump(4);
+    const std::string transactionText = dumpTransactions();
+
+    if (!pessimistic) {
+        guard.emplace(*ledgerLock);
+        if (!guard->ok())
+            return -1;
+    }
+    // a commit left half done bumps the generation once completed, so it counts as a conflict
+    if (!finishCommit())
+        return -1;
+    if (ledgerLock->readGeneration() != loadedGeneration)
+        continue; // another writer committed since the data was loaded
+    if (writeTemporaryFile(walletFile, walletText) != 0 || writeTemporaryFile(transactionFile, transactionText) != 0 ||
+        writeCommitRecord(loadedGeneration + 1) != 0) {
+        std::remove((walletFile + TEMPORARY_SUFFIX).c_str());
+        std::remove((transactionFile + TEMPORARY_SUFFIX).c_str());
+        return -1;
+    }
+    loadedGeneration++; // the loaded data is the recorded generation either way
+    if (!finishCommit()) {
+        errStream() << "Warning: the change was committed, but the ledger files are only partly updated. "
+                    << "They will be completed the next time the ledger is opened." << std::endl;
+        return PARTIAL_COMMIT;
+    }
+    return 0;
+}
+return -1;
+}
+
+/**
+* @brief Drops everything loaded from the data files, including the indexes,
+* and loads them again.
 *
-* @return int -1 on error, 0 on success
 */
-int StorageHandler::storeData() {
-return (storeFile(walletFile, wallets) +
-        storeFile(transactionFile, transactions)) == 1;
+void StorageHandler::reload() {
+idxManager.clearAll();
+pendingTransactionText.reset();
+isDataPending = false;
+loadData();
 }
 
 /**
@@ -182,53 +482,134 @@ return (storeFile(walletFile, wallets) +
 */
 StorageHandler::StorageHandler(const std::string &_walletFile,
                             const std::string &_transactionFile)
-    : walletFile(_walletFile), transactionFile(_transactionFile) {
+    : walletFile(_walletFile), transactionFile(_transactionFile),
+      ledgerLock(std::make_shared<LedgerLock>(_transactionFile + ".lock")),
+      idAllocator(std::make_shared<IdAllocator>(*ledgerLock)) {
 loadData();
 }
 
 /**
-* @brief Stores the specified transaction in the transactions json file.
+* @brief Builds every index that queries would otherwise build on first use,
+* so that a handler published as a snapshot is never modified by its readers
+* and can serve queries from several threads at once.
 *
-* @param transaction a Transaction oject to be converted to json
+*/
+void StorageHandler::prepareSnapshot() {
+if (!idxManager.isColumnsPopulated) {
+    ensureData();
+    idxManager.populateAllIdxs(*buckets);
+}
+populateTextIdx();
+// writes keep built vocabularies up to date, they are only rebuilt once stale
+if (!idxManager.isCategoryVocabPopulated)
+    idxManager.populateCategoryVocab();
+if (!idxManager.isWalletVocabPopulated)
+    idxManager.populateWalletVocab();
+if (!idxManager.isTokenVocabPopulated)
+    idxManager.populateTokenVocab();
+}
+
+/**
+* @brief Finds the id of a tag in the tag list of the transaction file metadata.
+* Transactions only store these ids, the names are kept once in the metadata.
+*
+* @param tag the tag name
+* @param create whether to add the tag to the list when it is not there yet
+* @return int the tag id, -1 if it does not exist and create is false
+*/
+int StorageHandler::getTagId(const std::string &tag, bool create) {
+    // lookups only read, queries on a shared snapshot must not modify it
+    const json& metadata = std::as_const(transactions)["metadata"];
+    if (metadata.contains("tags") && metadata["tags"].is_array()) {
+        const json& tags = metadata["tags"];
+        for (size_t i = 0; i < tags.size(); i++) {
+            if (tags[i] == tag)
+                return static_cast<int>(i);
+        }
+    }
+    if (!create)
+        return -1;
+    json& writable = transactions["metadata"];
+    if (!writable.contains("tags") || !writable["tags"].is_array())
+        writable["tags"] = json::array();
+    writable["tags"].push_back(tag);
+    return static_cast<int>(writable["tags"].size() - 1);
+}
+
+/**
+* @brief Returns the tag names, indexed by tag id
+*
+* @return std::vector<std::string> the tag names
+*/
+std::vector<std::string> StorageHandler::getTagNames() {
+    const json& metadata = std::as_const(transactions)["metadata"];
+    if (!metadata.contains("tags") || !metadata["tags"].is_array())
+        return {};
+    return metadata["tags"].get<std::vector<std::string>>();
+}
+
+/**
+* @brief Adds a transaction to the loaded data, its wallet balance and the
+* built indexes. Nothing is written.
+*
+* @param transaction the transaction, with its id and date set
 * @return int -1 on error, 0 on success
 */
-int StorageHandler::storeTransaction(Transaction &transaction) {
+int StorageHandler::appendTransaction(Transaction &transaction) {
 std::string wlt;
 if (transaction.wallet == "default")
-    wlt = StorageHandler::default_wallet;
+    wlt = default_wallet;
 else
     wlt = transaction.wallet;
 
 // expense in json format
 json jsonTransaction = transaction.toJson();
 
-if (updateBalance(wlt, jsonTransaction["amount"]) != 0) {
-    Transaction::currentID--;
+if (updateBalance(wlt, jsonTransaction["amount"]) != 0)
     return -1;
-}
 
 if (!transactions.contains("data") || !transactions["data"].is_object()) {
-    Transaction::currentID--;
-    std::cerr << "Invalid file structure: couldn't find 'data' object.\n";
+    errStream() << "Invalid file structure: couldn't find 'data' object.\n";
     return -1;
 }
 
-if (!transactions["data"].contains(transaction.date) ||
-    !transactions["data"][transaction.date].is_array())
-    transactions["data"][transaction.date] = json::array();
-transactions["data"][transaction.date].push_back(jsonTransaction);
-transactions["metadata"]["currentID"] = Transaction::currentID;
-return storeData();
+// only the bucket of the date is copied, the others stay shared with other versions
+std::shared_ptr<const json>& bucket = buckets.write()[transaction.date];
+json updated = bucket && bucket->is_array() ? *bucket : json::array();
+updated.push_back(jsonTransaction);
+bucket = std::make_shared<const json>(std::move(updated));
+json& highest = transactions["metadata"]["currentID"];
+if (!highest.is_number_integer() || highest.get<TransactionId>() < transaction.id)
+    highest = transaction.id;
+Transaction stored(jsonTransaction);
+stored.date = transaction.date;
+idxManager.addTransaction(stored);
+return 0;
 }
 
 /**
-* @brief populates the Id index.
-* This performs a simple check to see if it is already loaded,
-* and leaves the actual loading up to the IndexManager class
+* @brief Stores the specified transaction in the transactions json file,
+* giving it a new id unless it already has one.
+*
+* @param transaction a Transaction oject to be converted to json
+* @param tagNames tag names to resolve into the transaction's tag ids,
+* creating the ones that do not exist yet
+* @return int -1 on error, 0 on success, PARTIAL_COMMIT, see commitChange
 */
-void StorageHandler::populateIdIdx() {
-if (!idxManager.isIdIdxPopulated)
-    idxManager.populateIdIdx(transactions);
+int StorageHandler::storeTransaction(Transaction &transaction, const std::vector<std::string> &tagNames) {
+if (transaction.id == 0 && (transaction.id = idAllocator->next()) < 0)
+    return -1;
+const std::vector<int> givenTags = transaction.tags;
+return commitChange([&]() {
+    // tag ids are only valid for the metadata they were resolved against
+    transaction.tags = givenTags;
+    for (const std::string& tag : tagNames) {
+        int tagId = getTagId(tag, true);
+        if (std::find(transaction.tags.begin(), transaction.tags.end(), tagId) == transaction.tags.end())
+            transaction.tags.push_back(tagId);
+    }
+    return appendTransaction(transaction);
+});
 }
 
 /**
@@ -237,8 +618,11 @@ if (!idxManager.isIdIdxPopulated)
 * and leaves the actual loading up to the IndexManager class
 */
 void StorageHandler::populateWalletIdx() {
-if (!idxManager.isWalletIdxPopulated)
-    idxManager.populateWalletIdx(transactions);
+if (!idxManager.isWalletIdxPopulated) {
+    if (!idxManager.isColumnsPopulated)
+        ensureData();
+    idxManager.populateWalletIdx(*buckets);
+}
 }
 
 /**
@@ -247,8 +631,11 @@ if (!idxManager.isWalletIdxPopulated)
 * and leaves the actual loading up to the IndexManager class
 */
 void StorageHandler::populateCategoryIdx() {
-if (!idxManager.isCategoryIdxPopulated)
-    idxManager.populateCategoryIndex(transactions);
+if (!idxManager.isCategoryIdxPopulated) {
+    if (!idxManager.isColumnsPopulated)
+        ensureData();
+    idxManager.populateCategoryIndex(*buckets);
+}
 }
 
 /**
@@ -257,8 +644,11 @@ if (!idxManager.isCategoryIdxPopulated)
 * and leaves the actual loading up to the IndexManager class
 */
 void StorageHandler::populateDateHash() {
-if (!idxManager.isDateHashPopulated)
-    idxManager.populateDateHash(transactions);
+if (!idxManager.isDateHashPopulated) {
+    if (!idxManager.isColumnsPopulated)
+        ensureData();
+    idxManager.populateDateHash(*buckets);
+}
 }
 
 /**
@@ -267,63 +657,197 @@ if (!idxManager.isDateHashPopulated)
 * and leaves the actual loading up to the IndexManager class
 */
 void StorageHandler::populateDateMap() {
-if (!idxManager.isDateMapPopulated)
-    idxManager.populateDateMap(transactions);
+if (!idxManager.isDateMapPopulated) {
+    if (!idxManager.isColumnsPopulated)
+        ensureData();
+    idxManager.populateDateMap(*buckets);
+}
+}
+
+/**
+* @brief populates the Amount index.
+* This performs a simple check to see if it is already loaded,
+* and leaves the actual loading up to the IndexManager class
+*/
+void StorageHandler::populateAmountIdx() {
+if (!idxManager.isAmountIdxPopulated) {
+    if (!idxManager.isColumnsPopulated)
+        ensureData();
+    idxManager.populateAmountIdx(*buckets);
+}
+}
+
+/**
+* @brief populates the description (token and trigram) indexes.
+* This performs a simple check to see if it is already loaded,
+* and leaves the actual loading up to the IndexManager class
+*/
+void StorageHandler::populateTextIdx() {
+if (!idxManager.isTextIdxPopulated) {
+    if (!idxManager.isColumnsPopulated)
+        ensureData();
+    idxManager.populateTextIdx(*buckets);
+}
 }
 
 /**
-* @brief Makes use of the id index to find a Transaction with the provided id.
-* Index is loaded on demand if not loaded already by calling populateIdIdx()
+* @brief populates the transaction columns.
+* This performs a simple check to see if it is already loaded,
+* and leaves the actual loading up to the IndexManager class
+*/
+void StorageHandler::populateColumns() {
+if (!idxManager.isColumnsPopulated) {
+    ensureData();
+    idxManager.populateColumns(*buckets);
+}
+}
+
+/**
+* @brief Makes use of the columns to find a Transaction with the provided id.
+* The columns are loaded on demand if not loaded already by calling populateColumns()
 * @param id
-* @return Transaction& oject reference with the provided id
+* @return Transaction copy of the transaction with the provided id, description included
 */
-Transaction& StorageHandler::getTransactionById(int id) {
-    populateIdIdx();
-    auto it = idxManager.transactionsById.find(id);
-    if (it == idxManager.transactionsById.end())
+Transaction StorageHandler::getTransactionById(TransactionId id) {
+    populateColumns();
+    std::optional<size_t> row = idxManager.columns.rowOf(id);
+    if (!row)
         throw std::runtime_error("Transaction not found.");
-    return it->second;
+    return idxManager.columns.transaction(*row);
+}
+
+/**
+* @brief Maximum number of edits tolerated when looking up a misspelled name.
+* Short names only tolerate one edit, otherwise almost everything would match.
+*/
+static int maxTypos(const std::string& name) {
+    return name.size() <= 4 ? 1 : 2;
+}
+
+/**
+* @brief Resolves a name that is not in an index to its closest known name.
+* When there is a single closest match it is used (and the user is told so),
+* when several names are equally close they are only suggested.
+*
+* @param kind what is being looked up, for the messages ("Category", "Wallet")
+* @param name the name that was not found
+* @param matches the near matches, closest first
+* @return std::string the resolved name, or an empty string if there is none
+*/
+static std::string resolveNearMatch(const std::string& kind, const std::string& name,
+                                    const std::vector<std::pair<int, std::string>>& matches) {
+    if (matches.empty()) {
+        outStream() << kind << " not found\n";
+        return "";
+    }
+    if (matches.size() == 1 || matches[0].first < matches[1].first) {
+        outStream() << kind << " '" << name << "' not found, using '" << matches[0].second << "'\n";
+        return matches[0].second;
+    }
+    outStream() << kind << " '" << name << "' not found. Did you mean: ";
+    for (size_t i = 0; i < matches.size() && matches[i].first == matches[0].first; i++)
+        outStream() << (i ? ", " : "") << matches[i].second;
+    outStream() << "?\n";
+    return "";
 }
 
 /**
 * @brief Finds transactions with a certain wallet and puts them in the result
-* unordered_set
+* unordered_set. A misspelled wallet is resolved to its closest match.
 *
 * @param wallet - wallet to query
 * @param result Transaction vector to be filled
 * @return -1 on empty or no wallet, 0 on success
 */
 int StorageHandler::getTransactionsByWallet(const std::string &wallet,
-                                            std::unordered_set<int> &result) {
+                                            std::unordered_set<TransactionId> &result) {
     populateWalletIdx();
-    auto it = idxManager.transactionsByWallet.find(wallet);
-    if (it == idxManager.transactionsByWallet.end()) {
-        std::cout << "Wallet not found\n";
+    const auto& index = *idxManager.transactionsByWallet;
+    auto it = index.find(wallet);
+    if (it == index.end()) {
+        std::string nearMatch = resolveNearMatch("Wallet", wallet, idxManager.suggestWallets(wallet, maxTypos(wallet)));
+        if (nearMatch.empty())
+            return -1;
+        it = index.find(nearMatch);
+    }
+    result = std::unordered_set<TransactionId>(it->second.begin(), it->second.end());
+    if (result.empty())
+        return -1;
+    return 0;
+}
+
+/**
+* @brief Finds transactions whose description contains the given text
+* (case-insensitive) and puts them in the result unordered_set
+*
+* @param text text to look for
+* @param result unordered_set to be filled with the matching ids
+* @return int -1 on empty, 0 on success
+*/
+int StorageHandler::searchTransactions(const std::string &text, std::unordered_set<TransactionId> &result) {
+    populateTextIdx();
+    result = idxManager.searchText(text);
+    if (result.empty()) {
+        // labels are free text, so near matches are only suggested, never used
+        std::istringstream words(text);
+        std::string word;
+        while (words >> word) {
+            auto matches = idxManager.suggestTokens(word, maxTypos(word));
+            if (matches.empty() || matches[0].first == 0)
+                continue;
+            outStream() << "No label contains '" << word << "'. Did you mean: ";
+            for (size_t i = 0; i < matches.size() && i < 5; i++)
+                outStream() << (i ? ", " : "") << matches[i].second;
+            outStream() << "?\n";
+        }
         return -1;
     }
-    result = it->second;
+    return 0;
+}
+
+/**
+* @brief Finds transactions with an amount inside the given range using the
+* sorted amount index and puts them in the result unordered_set
+*
+* @param minAmount lowest amount in cents, unbounded when empty
+* @param maxAmount highest amount in cents, unbounded when empty
+* @param result unordered_set to be filled with the matching ids
+* @return int -1 on empty, 0 on success
+*/
+int StorageHandler::getTransactionsByAmount(std::optional<int> minAmount, std::optional<int> maxAmount,
+                                            std::unordered_set<TransactionId> &result) {
+    populateAmountIdx();
+    result = idxManager.amountRange(minAmount.value_or(std::numeric_limits<int>::min()),
+                                    maxAmount.value_or(std::numeric_limits<int>::max()));
     if (result.empty())
         return -1;
     return 0;
 }
 
 /**
-* @brief Finds transactions with a certain category and puts them in the result
-* vector
+* @brief Finds transactions with a certain category, or any of its subcategories
+* (food/groceries is part of food), and puts them in the result vector.
+* A misspelled category is resolved to its closest match.
 *
 * @param category - category to query
 * @param result Transaction vector to be filled
 * @return int -1 on empty or no category, 0 on success
 */
 int StorageHandler::getTransactionsByCategory(
-    const std::string &category, std::unordered_set<int> &result) {
+    const std::string &category, std::unordered_set<TransactionId> &result) {
     populateCategoryIdx();
-    auto it = idxManager.transactionsByCategory.find(category);
-    if (it == idxManager.transactionsByCategory.end()) {
-        std::cout << "Category not found\n";
-        return -1;
+    std::string root = category;
+    while (root.size() > 1 && root.back() == '/')
+        root.pop_back();
+
+    result = idxManager.categorySubtree(root);
+    if (result.empty()) {
+        std::string nearMatch = resolveNearMatch("Category", root,
+                                                 idxManager.suggestCategories(root, maxTypos(root)));
+        if (nearMatch.empty())
+            return -1;
+        result = idxManager.categorySubtree(nearMatch);
     }
-    result = it->second;
     if (result.empty())
         return -1;
     return 0;
@@ -338,12 +862,12 @@ int StorageHandler::getTransactionsByCategory(
 * @return int -1 on empty, 0 on success
 */
 int StorageHandler::retrieveDailyTransactions(const std::string &base_date,
-                                        std::unordered_set<int> &result) {
+                                        std::unordered_set<TransactionId> &result) {
     populateDateHash();
-    auto it = idxManager.transactionsByDateHashed.find(base_date);
-    if (it == idxManager.transactionsByDateHashed.end())
+    auto it = idxManager.transactionsByDateHashed->find(base_date);
+    if (it == idxManager.transactionsByDateHashed->end())
         return -1;
-    result = it->second;
+    result = std::unordered_set<TransactionId>(it->second.begin(), it->second.end());
     if (result.empty())
         return -1;
     return 0;
@@ -357,7 +881,7 @@ int StorageHandler::retrieveDailyTransactions(const std::string &base_date,
 * @return int -1 on empty, 0 on success
 */
 int StorageHandler::retrieveWeeklyTransactions(const std::string &base_date,
-                                        std::unordered_set<int> &result) {
+                                        std::unordered_set<TransactionId> &result) {
     populateDateMap();
     std::chrono::year_month_day baseDate = parseYMD(base_date);
     std::chrono::year_month_day startOfWeek, endOfWeek;
@@ -365,18 +889,15 @@ int StorageHandler::retrieveWeeklyTransactions(const std::string &base_date,
     getWeek(baseDate, startOfWeek, endOfWeek);
     std::string start = formatYMD(startOfWeek);
     std::string end = formatYMD(endOfWeek);
-    auto lowBound = idxManager.transactionsByDateMap.lower_bound(start);
-    auto highBound = idxManager.transactionsByDateMap.upper_bound(end);
+    auto lowBound = idxManager.transactionsByDateMap->lower_bound(start);
+    auto highBound = idxManager.transactionsByDateMap->upper_bound(end);
 
-    if (lowBound == idxManager.transactionsByDateMap.end()) {
+    if (lowBound == idxManager.transactionsByDateMap->end()) {
         return -1; // No transactions in the given range
     }
 
-    for (auto it = lowBound; it != highBound; ++it) {
-        for (int transactionID : it->second) {
-            result.insert(transactionID);
-        }
-    }
+    for (auto it = lowBound; it != highBound; ++it)
+        result.insert(it->second.begin(), it->second.end());
     if (result.empty())
         return -1;
     return 0;
@@ -390,7 +911,7 @@ int StorageHandler::retrieveWeeklyTransactions(const std::string &base_date,
 * @return int -1 on empty, 0 on success
 */
 int StorageHandler::retrieveMonthlyTransactions(const std::string &base_date,
-                                            std::unordered_set<int> &result) {
+                                            std::unordered_set<TransactionId> &result) {
     populateDateMap();
     std::chrono::year_month_day base_ymd = parseYMD(base_date);
     std::chrono::year_month_day startOfMonth =
@@ -400,17 +921,39 @@ int StorageHandler::retrieveMonthlyTransactions(const std::string &base_date,
     std::string start = formatYMD(startOfMonth);
     std::string end = formatYMD(endOfMonth);
 
-    auto lowBound = idxManager.transactionsByDateMap.lower_bound(start);
-    auto highBound = idxManager.transactionsByDateMap.upper_bound(end);
+    auto lowBound = idxManager.transactionsByDateMap->lower_bound(start);
+    auto highBound = idxManager.transactionsByDateMap->upper_bound(end);
 
-    if (lowBound == idxManager.transactionsByDateMap.end()) {
+    if (lowBound == idxManager.transactionsByDateMap->end()) {
         return -1;
     }
 
-    for (auto it = lowBound; it != highBound; ++it) {
-        for (int transactionID : it->second) {
-            result.insert(transactionID);
-        }
+    for (auto it = lowBound; it != highBound; ++it)
+        result.insert(it->second.begin(), it->second.end());
+    if (result.empty())
+        return -1;
+    return 0;
+}
+
+/**
+* @brief Finds transactions dated between start and end (both inclusive)
+*
+* @param start first date, YYYY-MM-DD (empty for no lower bound)
+* @param end last date, YYYY-MM-DD (empty for no upper bound)
+* @param result Transaction vector to be filled
+* @return int -1 on empty, 0 on success
+*/
+int StorageHandler::retrieveTransactionsBetween(const std::string &start, const std::string &end,
+                                               std::unordered_set<TransactionId> &result) {
+    populateDateMap();
+    const auto& dateMap = *idxManager.transactionsByDateMap;
+    auto lowBound = start.empty() ? dateMap.begin() : dateMap.lower_bound(start);
+    auto highBound = end.empty() ? dateMap.end() : dateMap.upper_bound(end);
+
+    for (auto it = lowBound; it != highBound && it != dateMap.end(); ++it) {
+        if (!end.empty() && it->first > end)
+            break;
+        result.insert(it->second.begin(), it->second.end());
     }
     if (result.empty())
         return -1;
@@ -418,39 +961,140 @@ int StorageHandler::retrieveMonthlyTransactions(const std::string &base_date,
 }
 
 /**
-* @brief Wrapper function that retrieves the expenses based on a combined query 
-* @param base_date 
-* @param range 
-* @param wallet
-* @param category
-* @param result 
-* @return int 
+* @brief Serves a single term of a --where expression from the indexes, when
+* there is one for it: wallet/category equality, category lists and amount or
+* date ranges. Names are matched exactly, as the compiled program matches them.
+* @param term the expression term
+* @param result the ids matching the term
+* @return bool true if the term was served, false if it has to be evaluated over the columns
+* @throws std::invalid_argument if an amount is not a whole number of cents
 */
-int StorageHandler::retrieveTransactions(const std::string &base_date, int range, const std::string& wallet, const std::string& category,
-                                    std::unordered_map<std::string, std::vector<Transaction>> &result, const std::string& groupBy) {
-    
-    idxManager.populateAllIdxs(transactions); // the overhead from this is pretty much negligible at this point, but I'll fix it later
+bool StorageHandler::pushDownTerm(const ExprNode& term, std::unordered_set<TransactionId>& result) {
+    if (term.kind != ExprNode::Kind::Compare)
+        return false;
 
-    std::unordered_set<int> walletTransactions;
-    std::unordered_set<int> categoryTransactions;
-    std::unordered_set<int> dateTransactions;
-    std::vector<std::unordered_set<int>> setVec;
-    std::string date;
+    if (term.field == "wallet" && term.op == "=") {
+        auto wallet = idxManager.transactionsByWallet->find(term.values[0]);
+        if (wallet != idxManager.transactionsByWallet->end())
+            result = std::unordered_set<TransactionId>(wallet->second.begin(), wallet->second.end());
+        return true;
+    }
+    if (term.field == "category" && (term.op == "=" || term.op == "in")) {
+        for (const std::string& category : term.values) {
+            std::unordered_set<TransactionId> categoryTransactions = idxManager.categorySubtree(category);
+            result.insert(categoryTransactions.begin(), categoryTransactions.end());
+        }
+        return true;
+    }
 
-    std::function<std::string(const Transaction&)> extractor;
+    bool isRange = term.op == "=" || term.op == "<" || term.op == "<=" || term.op == ">" || term.op == ">=";
+    if (!isRange || (term.field != "amount" && term.field != "date"))
+        return false;
 
-    if (groupBy == "date")
-        extractor = [](const Transaction& t) { return t.date; };
-    else if (groupBy == "category")
-        extractor = [](const Transaction& t) { return t.category; };
-    else if (groupBy == "wallet")
-        extractor = [](const Transaction& t) { return t.wallet; };
-    else
-        throw std::invalid_argument("Invalid groupBy parameter.");
+    // inclusive [low, high] in cents or day numbers
+    std::int64_t value = 0;
+    if (term.field == "amount") {
+        const std::string& text = term.values[0];
+        int amount = 0;
+        auto [end, err] = std::from_chars(text.data(), text.data() + text.size(), amount);
+        if (err != std::errc() || end != text.data() + text.size())
+            throw std::invalid_argument("Invalid filter expression: '" + text + "' is not a valid amount");
+        value = amount;
+    } else {
+        try {
+            value = dayNumber(term.values[0]);
+        } catch (const std::exception&) {
+            return false; // let the compiler report it
+        }
+    }
+    std::optional<std::int64_t> low, high;
+    if (term.op == "=" || term.op == ">=")
+        low = value;
+    if (term.op == "=" || term.op == "<=")
+        high = value;
+    if (term.op == ">")
+        low = value + 1;
+    if (term.op == "<")
+        high = value - 1;
+
+    if (term.field == "date") {
+        retrieveTransactionsBetween(low ? formatDayNumber(static_cast<int>(*low)) : "",
+                                    high ? formatDayNumber(static_cast<int>(*high)) : "", result);
+        return true;
+    }
+    const std::int64_t minInt = std::numeric_limits<int>::min();
+    const std::int64_t maxInt = std::numeric_limits<int>::max();
+    std::int64_t lowAmount = std::max(low.value_or(minInt), minInt);
+    std::int64_t highAmount = std::min(high.value_or(maxInt), maxInt);
+    if (lowAmount <= highAmount)
+        getTransactionsByAmount(static_cast<int>(lowAmount), static_cast<int>(highAmount), result);
+    return true;
+}
+
+/**
+* @brief Resolves the filters of a query against the indexes: the wallet,
+* category, description, amount and date postings, and the column filters for
+* the ones that have no index. The --where expression is split in terms that go
+* to the indexes when possible and a compiled program.
+* When no filter is given, the transactions of the current day/week/month are used.
+* A range of 0 disables the date filter.
+* @param query the view query
+* @param filters filled with the postings and the column mask
+*/
+void StorageHandler::resolveFilters(const ViewQuery& query, CandidateFilters& filters) {
+    if (!idxManager.isColumnsPopulated) {
+        ensureData();
+        idxManager.populateAllIdxs(*buckets);
+    }
 
-    if (base_date.empty() && wallet.empty() && category.empty()) {
+    std::unordered_set<TransactionId> walletTransactions;
+    std::unordered_set<TransactionId> categoryTransactions;
+    std::unordered_set<TransactionId> dateTransactions;
+    std::unordered_set<TransactionId> amountTransactions;
+    std::unordered_set<TransactionId> textTransactions;
+    std::vector<std::unordered_set<TransactionId>>& setVec = filters.sets;
+
+    std::string date = query.baseDate;
+    bool amountFilter = query.minAmount || query.maxAmount;
+    bool columnFilter = !query.type.empty() || !query.weekdays.empty() || !query.allTags.empty() ||
+                        !query.anyTags.empty() || !query.noTags.empty();
+    if (date.empty() && query.wallet.empty() && query.category.empty() && !amountFilter && query.search.empty() &&
+        !columnFilter && !query.where && query.range != 0)
         date = getCurrentDate();
-        switch (range) {
+
+    // terms of --where with an index are intersected like the other filters,
+    // the rest is compiled and run over the columns
+    std::vector<const ExprNode*> residual;
+    if (query.where) {
+        std::vector<const ExprNode*> conjuncts;
+        splitConjuncts(*query.where, conjuncts);
+        for (const ExprNode* term : conjuncts) {
+            std::unordered_set<TransactionId> termTransactions;
+            if (pushDownTerm(*term, termTransactions))
+                setVec.push_back(std::move(termTransactions));
+            else
+                residual.push_back(term);
+        }
+    }
+
+    if (!query.wallet.empty()) {
+        getTransactionsByWallet(query.wallet, walletTransactions);
+        setVec.push_back(walletTransactions);
+    }
+    if (!query.category.empty()) {
+        getTransactionsByCategory(query.category, categoryTransactions);
+        setVec.push_back(categoryTransactions);
+    }
+    if (!query.search.empty()) {
+        searchTransactions(query.search, textTransactions);
+        setVec.push_back(textTransactions);
+    }
+    if (amountFilter) {
+        getTransactionsByAmount(query.minAmount, query.maxAmount, amountTransactions);
+        setVec.push_back(amountTransactions);
+    }
+    if (!date.empty() && query.range != 0) {
+        switch (query.range) {
             case 1:
                 retrieveDailyTransactions(date, dateTransactions);
                 break;
@@ -463,66 +1107,706 @@ int StorageHandler::retrieveTransactions(const std::string &base_date, int range
             default:
                 break;
         }
-        for (int val : dateTransactions) {
-            Transaction& transaction = getTransactionById(val);
-            result[extractor(transaction)].push_back(transaction);
+        setVec.push_back(dateTransactions);
+        filters.dateRange = true;
+    }
+    if (columnFilter || !residual.empty()) {
+        filters.mask = filterColumns(query);
+        if (!residual.empty())
+            maskAnd(*filters.mask, FilterProgram::compile(residual, idxManager.columns).run(idxManager.columns));
+    }
+}
+
+/**
+* @brief Collects the ids of the transactions matching the filters of a query
+* by intersecting the postings of its filters, see resolveFilters.
+* @param filters the postings and column mask of a query
+* @param ids vector to be filled with the matching ids
+* @return int -1 when nothing matches, 0 on success
+*/
+int StorageHandler::collectCandidates(const CandidateFilters& filters, std::vector<TransactionId>& ids) {
+    if (filters.mask) {
+        std::unordered_set<TransactionId> final = idxManager.setIntersection(filters.sets, *filters.mask);
+        ids.assign(final.begin(), final.end());
+    } else if (filters.sets.empty()) {
+        // range 0 with no other filter: every transaction matches
+        const SharedColumns& columns = idxManager.columns;
+        ids.reserve(columns.rowsById.size());
+        for (size_t row = 0; row < columns.size(); row++) {
+            if (!columns.isRemoved(row))
+                ids.push_back(columns.ids[row]);
         }
-        return 0;
+    } else {
+        std::unordered_set<TransactionId> final = idxManager.setIntersection(filters.sets);
+        ids.assign(final.begin(), final.end());
     }
+    if (ids.empty())
+        return -1;
+    return 0;
+}
 
-    if (!wallet.empty()) {
-        getTransactionsByWallet(wallet, walletTransactions);
-        setVec.push_back(walletTransactions);
+/**
+* @brief Whether one of the postings of a query holds so few of the rows that
+* driving the query from it beats scanning every row.
+* @param filters the resolved filters of the query
+* @return bool true if the query is selective
+*/
+bool StorageHandler::isSelective(const CandidateFilters& filters) const {
+    const size_t rows = idxManager.columns.size();
+    for (const std::unordered_set<TransactionId>& set : filters.sets) {
+        if (set.size() * SELECTIVE_FRACTION < rows)
+            return true;
     }
-    if (!category.empty()) {
-        getTransactionsByCategory(category, categoryTransactions);
-        setVec.push_back(categoryTransactions);
+    return false;
+}
+
+/**
+* @brief Tests one transaction against every posting and the column mask of a query.
+* @param filters the resolved filters of the query
+* @param id the transaction
+* @return bool true if the transaction passes every filter
+*/
+bool StorageHandler::matchesFilters(const CandidateFilters& filters, TransactionId id) const {
+    for (const std::unordered_set<TransactionId>& set : filters.sets) {
+        if (set.count(id) == 0)
+            return false;
     }
-    if (!base_date.empty()) {
-        switch (range) {
-            case 1:
-                retrieveDailyTransactions(base_date, dateTransactions);
-                break;
-            case 2:
-                retrieveWeeklyTransactions(base_date, dateTransactions);
-                break;
-            case 3:
-                retrieveMonthlyTransactions(base_date, dateTransactions);
-                break;
-            default:
-                break;
+    if (!filters.mask)
+        return true;
+    std::optional<size_t> row = idxManager.columns.rowOf(id);
+    return row && maskTest(*filters.mask, *row);
+}
+
+/**
+* @brief Splits the date index in partitions for a query that is not limited to
+* a day, week or month. Partitions are months, or years when there are enough
+* years to keep every thread of the executor busy. Queries on small ledgers, and
+* selective ones that are cheaper to drive from their smallest posting, are
+* not partitioned.
+* @param filters the resolved filters of the query
+* @param partitions filled with the partitions, in date order
+* @return bool true if the query should run partitioned
+*/
+bool StorageHandler::partitionDates(const CandidateFilters& filters, std::vector<DatePartition>& partitions) {
+    if (filters.dateRange || idxManager.columns.size() < MIN_PARTITIONED_ROWS || isSelective(filters))
+        return false;
+
+    const auto& dateMap = *idxManager.transactionsByDateMap;
+    size_t years = 0;
+    for (auto it = dateMap.begin(); it != dateMap.end(); ++it) {
+        if (it == dateMap.begin() || it->first.compare(0, 4, std::prev(it)->first, 0, 4) != 0)
+            years++;
+    }
+    const size_t keyLength = years >= 2 * Executor::shared().concurrency() ? 4 : 7; // YYYY or YYYY-MM
+
+    for (auto it = dateMap.begin(); it != dateMap.end(); ++it) {
+        if (partitions.empty() || it->first.compare(0, keyLength, partitions.back().first->first, 0, keyLength) != 0)
+            partitions.push_back(DatePartition{it, it, 0});
+        partitions.back().last = std::next(it);
+        partitions.back().rows += it->second.size();
+    }
+    return partitions.size() > 1;
+}
+
+/**
+* @brief Collects the ids of one partition that pass every filter, date by date.
+* Only reads the indexes, so partitions can be filtered concurrently.
+* @param partition the dates to filter
+* @param filters the resolved filters of the query
+* @param ids filled with the matching ids, in date order
+*/
+void StorageHandler::filterPartition(const DatePartition& partition, const CandidateFilters& filters,
+                                     std::vector<TransactionId>& ids) const {
+    for (auto date = partition.first; date != partition.last; ++date) {
+        for (TransactionId id : date->second) {
+            if (matchesFilters(filters, id))
+                ids.push_back(id);
         }
-        setVec.push_back(dateTransactions);
     }
-    std::unordered_set<int> final = idxManager.setIntersection(setVec);
-    for (int val : final) {
-        Transaction& transaction = getTransactionById(val);
-        result[extractor(transaction)].push_back(transaction);
+}
+
+/**
+* @brief Evaluates the filters that have no index (transaction type and weekday)
+* over the transaction columns, and combines them with the tag bitmaps.
+* @param query the view query
+* @return SelectionMask the rows that pass every column filter
+*/
+SelectionMask StorageHandler::filterColumns(const ViewQuery& query) {
+    populateColumns();
+    const SharedColumns& columns = idxManager.columns;
+    const size_t rows = columns.size();
+    SelectionMask mask = columns.liveMask();
+    // predicates run one chunk of the columns at a time, chunks start on a mask word
+    auto filterChunks = [&columns, &mask, rows](const std::function<void(const ColumnBatch&, size_t, SelectionMask&)>& predicate) {
+        SelectionMask selected;
+        for (size_t begin = 0; begin < rows; begin += ROWS_PER_CHUNK) {
+            predicate(columns.batch(begin), std::min(ROWS_PER_CHUNK, rows - begin), selected);
+            for (size_t w = 0; w < selected.size(); w++)
+                mask[begin / 64 + w] &= selected[w];
+        }
+    };
+
+    if (query.type == "expense" || query.type == "income") {
+        const int low = query.type == "expense" ? std::numeric_limits<int>::min() : 1;
+        const int high = query.type == "expense" ? -1 : std::numeric_limits<int>::max();
+        filterChunks([low, high](const ColumnBatch& batch, size_t count, SelectionMask& selected) {
+            maskRange(batch.amounts, count, low, high, selected);
+        });
+    } else if (!query.type.empty()) {
+        throw std::invalid_argument("Invalid transaction type: " + query.type);
+    }
+    if (!query.weekdays.empty()) {
+        filterChunks([&query](const ColumnBatch& batch, size_t count, SelectionMask& selected) {
+            maskIn(batch.weekdays, count, query.weekdays, selected);
+        });
+    }
+    if (!query.allTags.empty() || !query.anyTags.empty() || !query.noTags.empty()) {
+        auto toIds = [this](const std::vector<std::string>& names) {
+            std::vector<int> ids;
+            for (const std::string& name : names)
+                ids.push_back(getTagId(name, false));
+            return ids;
+        };
+        maskAnd(mask, idxManager.tagMask(toIds(query.allTags), toIds(query.anyTags), toIds(query.noTags)));
     }
+    return mask;
+}
+
+/**
+* @brief Builds integer sort keys for a name column by ranking its names.
+* Only the names are compared, the rows themselves are keyed by rank.
+* @param rows the rows to key
+* @param column the column of name ids to rank by
+* @param names the names of those ids
+* @return std::vector<std::int64_t> the rank of each row's name
+*/
+static std::vector<std::int64_t> rankKeys(const std::vector<size_t>& rows, const SharedColumns::Column<int>& column,
+                                          const NameTable& names) {
+    std::vector<size_t> sorted(names.names.size());
+    std::iota(sorted.begin(), sorted.end(), 0);
+    std::sort(sorted.begin(), sorted.end(), [&names](size_t a, size_t b) { return names.names[a] < names.names[b]; });
+    std::vector<std::int64_t> ranks(sorted.size());
+    for (size_t i = 0; i < sorted.size(); i++)
+        ranks[sorted[i]] = static_cast<std::int64_t>(i);
+
+    std::vector<std::int64_t> keys(rows.size());
+    for (size_t i = 0; i < rows.size(); i++)
+        keys[i] = ranks[static_cast<size_t>(column[rows[i]])];
+    return keys;
+}
+
+/**
+* @brief Builds the integer sort keys of the given field for every row:
+* day numbers for dates, cents for amounts (signed or absolute for "size"), ids,
+* and ranks for category/wallet names.
+* @param columns the columns of the rows
+* @param rows the rows to key
+* @param field one of "date", "amount", "size", "id", "category" or "wallet"
+* @return std::vector<std::int64_t> the key of each row
+*/
+static std::vector<std::int64_t> sortKeys(const SharedColumns& columns, const std::vector<size_t>& rows,
+                                          const std::string& field) {
+    if (field == "category")
+        return rankKeys(rows, columns.categories, *columns.categoryNames);
+    if (field == "wallet")
+        return rankKeys(rows, columns.wallets, *columns.walletNames);
+
+    std::vector<std::int64_t> keys(rows.size());
+    if (field == "date") {
+        for (size_t i = 0; i < rows.size(); i++)
+            keys[i] = columns.days[rows[i]];
+    } else if (field == "amount") {
+        for (size_t i = 0; i < rows.size(); i++)
+            keys[i] = columns.amounts[rows[i]];
+    } else if (field == "size") {
+        for (size_t i = 0; i < rows.size(); i++)
+            keys[i] = std::abs(static_cast<std::int64_t>(columns.amounts[rows[i]]));
+    } else if (field == "id") {
+        for (size_t i = 0; i < rows.size(); i++)
+            keys[i] = columns.ids[rows[i]];
+    } else {
+        throw std::invalid_argument("Invalid sort key: " + field);
+    }
+    return keys;
+}
+
+/**
+* @brief Orders the matching transactions as requested. Rows are radix sorted
+* by id, then by the sort key, so ties always come out in id order.
+* @param query the view query
+* @param ids the ids of the matching transactions
+* @param rows filled with the rows of the ids in the columns, in the same order
+* @param order filled with the positions in rows, in sorted order
+*/
+void StorageHandler::orderRows(const ViewQuery& query, const std::vector<TransactionId>& ids,
+                               std::vector<size_t>& rows, std::vector<std::uint32_t>& order) {
+    const SharedColumns& columns = idxManager.columns;
+    rows.reserve(ids.size());
+    for (TransactionId id : ids) {
+        std::optional<size_t> row = columns.rowOf(id);
+        if (!row)
+            throw std::runtime_error("Transaction not found.");
+        rows.push_back(*row);
+    }
+
+    order.resize(rows.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    // ties are broken by id so the output never depends on hash order
+    radixSortRows(order, sortKeys(columns, rows, "id"), query.sortBy == "id" && query.descending);
+    if (query.sortBy != "id")
+        radixSortRows(order, sortKeys(columns, rows, query.sortBy), query.descending);
+}
+
+/**
+* @brief Orders the matching transactions and splits them into groups.
+* Rows are ordered by orderRows and then radix sorted by the group key,
+* so groups come out in chronological/alphabetical order and the transactions
+* inside each group follow the requested sort order.
+* @param query the view query
+* @param ids the ids of the matching transactions
+* @param result ordered groups to be filled
+*/
+void StorageHandler::sortAndGroup(const ViewQuery& query, const std::vector<TransactionId>& ids, TransactionGroups& result) {
+    if (query.groupBy != "date" && query.groupBy != "category" && query.groupBy != "wallet" && query.groupBy != "none")
+        throw std::invalid_argument("Invalid groupBy parameter.");
+
+    const SharedColumns& columns = idxManager.columns;
+    std::vector<size_t> rows;
+    std::vector<std::uint32_t> order;
+    orderRows(query, ids, rows, order);
+
+    if (query.groupBy == "none") {
+        result.emplace_back("", std::vector<Transaction>());
+        for (std::uint32_t row : order)
+            result.back().second.push_back(columns.transaction(rows[row]));
+        return;
+    }
+
+    std::vector<std::int64_t> groupKeys = sortKeys(columns, rows, query.groupBy);
+    radixSortRows(order, groupKeys, query.sortBy == query.groupBy && query.descending);
+
+    for (size_t i = 0; i < order.size(); i++) {
+        std::uint32_t row = order[i];
+        if (i == 0 || groupKeys[row] != groupKeys[order[i - 1]]) {
+            if (query.groupBy == "date")
+                result.emplace_back(columns.date(rows[row]), std::vector<Transaction>());
+            else if (query.groupBy == "category")
+                result.emplace_back(columns.category(rows[row]), std::vector<Transaction>());
+            else
+                result.emplace_back(columns.wallet(rows[row]), std::vector<Transaction>());
+        }
+        result.back().second.push_back(columns.transaction(rows[row]));
+    }
+}
+
+/**
+* @brief Keeps only the N biggest transactions (by absolute amount), either
+* overall or per category/wallet.
+* Each group keeps a bounded min-heap of at most N entries, so this runs in
+* O(n log N) and never holds more than N ids per group.
+* @param query the view query, with query.top and query.topBy set
+* @param ids the candidate ids, replaced by the selected ones
+*/
+void StorageHandler::selectTop(const ViewQuery& query, std::vector<TransactionId>& ids) {
+    // (size, -id): among equal sizes the older transaction wins
+    using Entry = std::pair<std::int64_t, TransactionId>;
+    using MinHeap = std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>>;
+    std::unordered_map<std::string, MinHeap> heaps;
+    const size_t limit = static_cast<size_t>(query.top);
+
+    const SharedColumns& columns = idxManager.columns;
+    for (TransactionId id : ids) {
+        std::optional<size_t> row = columns.rowOf(id);
+        if (!row)
+            throw std::runtime_error("Transaction not found.");
+        const std::string* group = &query.topBy;
+        if (query.topBy == "category")
+            group = &columns.category(*row);
+        else if (query.topBy == "wallet")
+            group = &columns.wallet(*row);
+
+        MinHeap& heap = heaps[*group];
+        Entry entry(std::abs(static_cast<std::int64_t>(columns.amounts[*row])), -id);
+        if (heap.size() < limit) {
+            heap.push(entry);
+        } else if (heap.top() < entry) {
+            heap.pop();
+            heap.push(entry);
+        }
+    }
+
+    ids.clear();
+    for (auto& [group, heap] : heaps) {
+        while (!heap.empty()) {
+            ids.push_back(-heap.top().second);
+            heap.pop();
+        }
+    }
+}
+
+/**
+* @brief Wrapper function that retrieves the expenses based on a combined query
+* and returns them sorted and grouped
+* @param query the view query
+* @param result ordered groups to be filled
+* @return int -1 when nothing matches, 0 on success
+*/
+int StorageHandler::retrieveTransactions(const ViewQuery& query, TransactionGroups& result) {
+    CandidateFilters filters;
+    resolveFilters(query, filters);
+    std::vector<DatePartition> partitions;
+    if (partitionDates(filters, partitions))
+        return retrievePartitioned(query, filters, partitions, result);
+
+    std::vector<TransactionId> ids;
+    if (collectCandidates(filters, ids) < 0)
+        return -1;
+    if (query.top > 0)
+        selectTop(query, ids);
+    sortAndGroup(query, ids, result);
     return 0;
 }
 
-// TODO: this function has to be redone with the indexing system. MAYBE NOT!
-int StorageHandler::deleteTransaction(int id) {
-for (auto &[key, values] : transactions["data"].items()) {
-    for (json::iterator i = values.begin(); i != values.end(); i++) {
-    if ((*i)["id"] == id) {
-        if (updateBalance((*i)["wallet"],
-                        -1 * static_cast<int>((*i)["amount"])) != 0) {
-        std::cerr
-            << "Error in transaction deletion: Could not update balance."
-            << std::endl;
+/**
+* @brief Runs a query over date partitions as tasks of the shared executor.
+* Every partition is filtered on its own. Grouped by date, each partition also
+* sorts and groups its rows, and since partitions never share a date their
+* groups are simply concatenated in date order. Other groupings sort the
+* concatenated matches once. With --top, every partition keeps its own N
+* biggest per group, which always include the overall N biggest.
+* @param query the view query
+* @param filters the resolved filters of the query
+* @param partitions the date partitions, in date order
+* @param result ordered groups to be filled
+* @return int -1 when nothing matches, 0 on success
+*/
+int StorageHandler::retrievePartitioned(const ViewQuery& query, const CandidateFilters& filters,
+                                        const std::vector<DatePartition>& partitions, TransactionGroups& result) {
+    if (query.groupBy != "date" && query.groupBy != "category" && query.groupBy != "wallet" && query.groupBy != "none")
+        throw std::invalid_argument("Invalid groupBy parameter.");
+    const bool groupLocally = query.groupBy == "date" && query.top == 0;
+
+    std::vector<std::vector<TransactionId>> matches(partitions.size());
+    std::vector<TransactionGroups> groups(partitions.size());
+    Executor::shared().parallelFor(0, partitions.size(), 1, [&](size_t first, size_t last) {
+        for (size_t p = first; p < last; p++) {
+            filterPartition(partitions[p], filters, matches[p]);
+            if (query.top > 0)
+                selectTop(query, matches[p]);
+            else if (groupLocally && !matches[p].empty())
+                sortAndGroup(query, matches[p], groups[p]);
+        }
+    });
+
+    if (groupLocally) {
+        // dates come out newest first when sorting by date descending
+        const bool newestFirst = query.sortBy == "date" && query.descending;
+        for (size_t i = 0; i < groups.size(); i++) {
+            TransactionGroups& partition = groups[newestFirst ? groups.size() - 1 - i : i];
+            std::move(partition.begin(), partition.end(), std::back_inserter(result));
+        }
+        return result.empty() ? -1 : 0;
+    }
+
+    std::vector<TransactionId> ids;
+    for (const std::vector<TransactionId>& partition : matches)
+        ids.insert(ids.end(), partition.begin(), partition.end());
+    if (ids.empty())
         return -1;
+    if (query.top > 0)
+        selectTop(query, ids);
+    sortAndGroup(query, ids, result);
+    return 0;
+}
+
+/**
+* @brief First stage of a streamed query: yields every id in the requested
+* order, walking the index that is already sorted by the sort key. Only the
+* ids sharing a key (a date, a category, an amount) are held at a time, and
+* sorted by id like orderRows does with ties. Sorting by id walks the ids of
+* rowsById, which are sorted.
+* @param sortBy one of "date", "category", "amount", "size" or "id"
+* @param descending true to walk from the biggest key
+* @return Generator<TransactionId> the ids
+*/
+Generator<TransactionId> StorageHandler::scanIds(std::string sortBy, bool descending) {
+    std::vector<TransactionId> run;
+    auto sortedRun = [&run]() -> std::vector<TransactionId>& {
+        std::sort(run.begin(), run.end());
+        return run;
+    };
+
+    if (sortBy == "date" || sortBy == "category") {
+        const auto& index = sortBy == "date" ? *idxManager.transactionsByDateMap : *idxManager.transactionsByCategory;
+        // postings are already sorted by id
+        auto visit = [&](const Postings& ids) -> std::vector<TransactionId>& {
+            run.assign(ids.begin(), ids.end());
+            return run;
+        };
+        if (descending) {
+            for (auto it = index.rbegin(); it != index.rend(); ++it) {
+                for (TransactionId id : visit(it->second))
+                    co_yield id;
+            }
+        } else {
+            for (auto it = index.begin(); it != index.end(); ++it) {
+                for (TransactionId id : visit(it->second))
+                    co_yield id;
+            }
         }
-        values.erase(i);
-        storeData();
-        return 0;
+    } else if (sortBy == "amount" || sortBy == "size") {
+        // (amount, id) pairs sorted by amount, sizes grow away from the first non-negative amount
+        const auto& amounts = idxManager.transactionsByAmount;
+        const auto zero = amounts.lower_bound(std::pair<int, TransactionId>(0, std::numeric_limits<TransactionId>::min()));
+        auto key = [&sortBy](const std::pair<int, TransactionId>& entry) {
+            std::int64_t amount = entry.first;
+            return sortBy == "size" ? std::abs(amount) : amount;
+        };
+        // [low, high) is the part of amounts still to be visited: for "amount" it
+        // is consumed from one end, for "size" from both ends (descending) or from
+        // the middle outwards (ascending), whichever side has the next key
+        auto low = amounts.begin(), high = amounts.end();
+        auto inner = zero, outer = zero; // ascending sizes: [inner, outer) visited
+        while (true) {
+            run.clear();
+            if (sortBy == "amount" || descending) {
+                if (low == high)
+                    break;
+                std::int64_t next;
+                if (sortBy == "amount")
+                    next = descending ? key(*(high - 1)) : key(*low);
+                else
+                    next = std::max(key(*low), key(*(high - 1)));
+                if (!descending) {
+                    while (low != high && key(*low) == next)
+                        run.push_back((low++)->second);
+                } else {
+                    while (high != low && key(*(high - 1)) == next)
+                        run.push_back((--high)->second);
+                    while (low != high && key(*low) == next)
+                        run.push_back((low++)->second);
+                }
+            } else {
+                if (inner == amounts.begin() && outer == amounts.end())
+                    break;
+                std::int64_t next = std::numeric_limits<std::int64_t>::max();
+                if (inner != amounts.begin())
+                    next = key(*(inner - 1));
+                if (outer != amounts.end())
+                    next = std::min(next, key(*outer));
+                while (inner != amounts.begin() && key(*(inner - 1)) == next)
+                    run.push_back((--inner)->second);
+                while (outer != amounts.end() && key(*outer) == next)
+                    run.push_back((outer++)->second);
+            }
+            for (TransactionId id : sortedRun())
+                co_yield id;
+        }
+    } else if (sortBy == "id") {
+        std::vector<TransactionId> ids;
+        ids.reserve(idxManager.columns.rowsById.size());
+        for (const auto& [id, row] : idxManager.columns.rowsById)
+            ids.push_back(id);
+        if (descending) {
+            for (auto it = ids.rbegin(); it != ids.rend(); ++it)
+                co_yield *it;
+        } else {
+            for (TransactionId id : ids)
+                co_yield id;
+        }
+    } else {
+        throw std::invalid_argument("Invalid sort key: " + sortBy);
     }
+}
+
+/**
+* @brief Filter stage of a streamed query: passes on the ids matching every
+* filter of the query.
+* @param ids the ids of the previous stage
+* @param filters the resolved filters of the query
+* @return Generator<TransactionId> the matching ids, in the same order
+*/
+Generator<TransactionId> StorageHandler::filterIds(Generator<TransactionId> ids, const CandidateFilters& filters) const {
+    for (TransactionId id : ids) {
+        if (matchesFilters(filters, id))
+            co_yield id;
     }
 }
-std::cerr << "Error in transaction deletion: Transaction not found."
-            << std::endl;
-return -1;
+
+/**
+* @brief Projection stage of a streamed query: turns ids into the transactions
+* to print, from the columns with their descriptions filled in.
+* @param ids the ids of the previous stage
+* @return Generator<const Transaction*> the transactions, in the same order
+*/
+Generator<const Transaction*> StorageHandler::projectRows(Generator<TransactionId> ids) {
+    Transaction row;
+    for (TransactionId id : ids) {
+        row = getTransactionById(id);
+        const Transaction* rendered = &row;
+        co_yield rendered;
+    }
+}
+
+/**
+* @brief Retrieves the transactions of a query that is not grouped, as a
+* stream consumed by the printer (see printStream). Scanning, filtering and
+* projecting are chained generators that only advance when the printer asks
+* for the next row, so the first row comes out right away and the memory used
+* does not grow with the number of rows.
+* Queries that only match a few rows (a base day, week or month, a selective
+* filter, --top) are collected and sorted as usual, and then streamed.
+* Nothing runs before the first row is asked for, and errors in the query are
+* thrown from there.
+* @param query the view query, not grouped
+* @return Generator<const Transaction*> the matching transactions, in order
+*/
+Generator<const Transaction*> StorageHandler::streamTransactions(ViewQuery query) {
+    CandidateFilters filters;
+    resolveFilters(query, filters);
+
+    if (filters.dateRange || query.top > 0 || isSelective(filters)) {
+        std::vector<TransactionId> ids;
+        if (collectCandidates(filters, ids) < 0)
+            co_return;
+        if (query.top > 0)
+            selectTop(query, ids);
+        std::vector<size_t> rows;
+        std::vector<std::uint32_t> order;
+        orderRows(query, ids, rows, order);
+        Transaction row;
+        for (std::uint32_t position : order) {
+            row = idxManager.columns.transaction(rows[position]);
+            const Transaction* rendered = &row;
+            co_yield rendered;
+        }
+        co_return;
+    }
+
+    for (const Transaction* transaction : projectRows(filterIds(scanIds(query.sortBy, query.descending), filters)))
+        co_yield transaction;
+}
+
+/**
+* @brief Computes amount statistics over the transactions matching a query, per
+* category and overall, in a single pass over the amounts.
+* Date partitions (see partitionDates), or else chunks of the matching ids, are
+* summarized as tasks of the shared executor and then merged, which is possible
+* because the histograms are mergeable.
+* @param query the view query selecting the transactions
+* @param income true to summarize incomes, false for expenses
+* @param rollup true to also add the amounts of each category to all its parent categories
+* @param perCategory histogram of each category, to be filled
+* @param overall histogram of every matching transaction, to be filled
+* @return int -1 when nothing matches, 0 on success
+*/
+int StorageHandler::computeStats(const ViewQuery& query, bool income, bool rollup, std::map<std::string, AmountHistogram>& perCategory,
+                                AmountHistogram& overall) {
+    CandidateFilters filters;
+    resolveFilters(query, filters);
+
+    using Partial = std::map<std::string, AmountHistogram>;
+    auto summarizeIds = [this, income](const std::vector<TransactionId>& ids, size_t begin, size_t end) {
+        Partial partial;
+        const SharedColumns& columns = idxManager.columns;
+        for (size_t i = begin; i < end; i++) {
+            std::optional<size_t> row = columns.rowOf(ids[i]);
+            if (!row)
+                throw std::runtime_error("Transaction not found.");
+            const int amount = columns.amounts[*row];
+            if ((amount > 0) != income || amount == 0)
+                continue;
+            partial[columns.category(*row)].add(amount);
+        }
+        return partial;
+    };
+    auto combine = [](Partial left, Partial right) {
+        for (auto& [category, histogram] : right)
+            left[category].merge(histogram);
+        return left;
+    };
+
+    Executor& executor = Executor::shared();
+    Partial merged;
+    std::vector<DatePartition> partitions;
+    if (partitionDates(filters, partitions)) {
+        // each partition is filtered and summarized by the same task
+        auto summarizePartitions = [&](size_t first, size_t last) {
+            Partial partial;
+            for (size_t p = first; p < last; p++) {
+                std::vector<TransactionId> ids;
+                filterPartition(partitions[p], filters, ids);
+                partial = combine(std::move(partial), summarizeIds(ids, 0, ids.size()));
+            }
+            return partial;
+        };
+        merged = executor.parallelReduce(0, partitions.size(), 1, Partial(), summarizePartitions, combine);
+    } else {
+        std::vector<TransactionId> ids;
+        if (collectCandidates(filters, ids) < 0)
+            return -1;
+        const size_t minPartition = 1 << 16;
+        merged = executor.parallelReduce(0, ids.size(), minPartition, Partial(),
+                                         [&](size_t begin, size_t end) { return summarizeIds(ids, begin, end); }, combine);
+    }
+
+    for (const auto& [category, histogram] : merged) {
+        perCategory[category].merge(histogram);
+        overall.merge(histogram);
+        if (!rollup)
+            continue;
+        // every parent category (food for food/groceries) also gets the amounts
+        for (size_t slash = category.find('/'); slash != std::string::npos; slash = category.find('/', slash + 1))
+            perCategory[category.substr(0, slash)].merge(histogram);
+    }
+    if (overall.count() == 0)
+        return -1;
+    return 0;
+}
+
+/**
+* @brief Deletes the transaction with the given id and reverts its amount from
+* its wallet. When the indexes are built they give the date of the
+* transaction, so only its bucket is searched and copied, and the transaction
+* is removed from the indexes instead of invalidating them.
+*
+* @param id the transaction
+* @return int -1 on error, 0 on success, PARTIAL_COMMIT, see commitChange
+*/
+int StorageHandler::deleteTransaction(TransactionId id) {
+return commitChange([&]() {
+    std::optional<std::string> date;
+    if (std::optional<size_t> row = idxManager.isColumnsPopulated ? idxManager.columns.rowOf(id) : std::nullopt)
+        date = idxManager.columns.date(*row);
+    for (const auto &[key, values] : *buckets) {
+        if (date && key != *date)
+            continue;
+        for (size_t i = 0; i < values->size(); i++) {
+        const json& candidate = (*values)[i];
+        auto candidateId = candidate.find("id");
+        if (candidateId != candidate.end() && *candidateId == id) {
+            if (updateBalance(candidate.at("wallet"),
+                            -1 * static_cast<int>(candidate.at("amount"))) != 0) {
+            errStream()
+                << "Error in transaction deletion: Could not update balance."
+                << std::endl;
+            return -1;
+            }
+            const std::string bucketDate = key;
+            json updated = *values;
+            updated.erase(i);
+            buckets.write()[bucketDate] = std::make_shared<const json>(std::move(updated));
+            if (!idxManager.removeTransaction(id))
+                idxManager.invalidate();
+            return 0;
+        }
+        }
+    }
+    errStream() << "Error in transaction deletion: Transaction not found."
+                << std::endl;
+    return -1;
+});
 }
 
 /**
@@ -532,17 +1816,18 @@ return -1;
 * @return float the balance as a float
 */
 float StorageHandler::retrieveBalance(const std::string &wallet) {
-if (!wallets["wallets"].contains(wallet)) {
-    std::cerr << "Error: Wallet " << wallet << " not found.\n";
+const json& walletData = wallets;
+if (!walletData.contains("wallets") || !walletData["wallets"].contains(wallet)) {
+    errStream() << "Error: Wallet " << wallet << " not found.\n";
     return -1;
 }
 
-if (!wallets["wallets"][wallet].is_number()) {
-    std::cerr << "Error: Invalid wallet balance.\n";
+if (!walletData["wallets"][wallet].is_number()) {
+    errStream() << "Error: Invalid wallet balance.\n";
     return -1;
 }
 
-return wallets["wallets"][wallet].get<float>() / 100;
+return walletData["wallets"][wallet].get<float>() / 100;
 }
 
 /**
@@ -555,17 +1840,17 @@ return wallets["wallets"][wallet].get<float>() / 100;
 int StorageHandler::updateBalance(const std::string &wallet, int amount) {
 std::string wlt;
 if (wallet == "default")
-    wlt = StorageHandler::default_wallet;
+    wlt = default_wallet;
 else
     wlt = wallet;
 if (!wallets["wallets"].contains(wlt)) {
-    std::cerr << "Error: Wallet '" << wlt
+    errStream() << "Error: Wallet '" << wlt
             << "' does not exist. Unable to update wallet balance."
             << std::endl;
     return -1;
 }
-std::cout << wallets["wallets"][wlt] << std::endl;
+outStream() << wallets["wallets"][wlt] << std::endl;
 wallets["wallets"][wlt] = wallets["wallets"][wlt].get<int>() + amount;
-std::cout << wallets["wallets"][wlt].get<int>() << std::endl;
+outStream() << wallets["wallets"][wlt].get<int>() << std::endl;
 return 0;
 }
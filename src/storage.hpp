@@ -9,14 +9,73 @@
 #define STORAGE_HPP
 
 #include "indexmanager.hpp"
+#include "stats.hpp"
+#include "expression.hpp"
+#include "generator.hpp"
+#include "idallocator.hpp"
+#include "ledgerlock.hpp"
 
 #include <string>
 #include "json.hpp"
 #include <vector>
+#include <map>
+#include <optional>
+#include <memory>
 #include <ctime>
+#include <cstdint>
+#include <functional>
+#include <unordered_set>
 
 using json = nlohmann::json;
 
+/**
+* @struct
+* @brief Filters and output ordering of a 'view' query
+*
+*/
+struct ViewQuery {
+    std::string baseDate;
+    int range = 1;      // 0 disables the date filter
+    std::string wallet;
+    std::string category;
+    std::string groupBy = "date";
+    std::string sortBy = "id";
+    bool descending = false;
+    std::string search;             // description substring
+    std::optional<int> minAmount;  // cents, inclusive
+    std::optional<int> maxAmount;  // cents, inclusive
+    std::string type;               // "", "expense" or "income"
+    std::vector<int> weekdays;      // 1 = Monday ... 7 = Sunday, empty for any
+    std::shared_ptr<const ExprNode> where;
+    std::vector<std::string> allTags;  // every one required
+    std::vector<std::string> anyTags;  // at least one required
+    std::vector<std::string> noTags;   // none allowed
+    int top = 0;        // 0 keeps every match
+    std::string topBy;  // "", "category" or "wallet"
+};
+
+/**
+* @struct
+* @brief Filters of a query resolved against the indexes: postings that must
+* all contain a transaction, and the rows passing the column filters, if any.
+*/
+struct CandidateFilters {
+    std::vector<std::unordered_set<TransactionId>> sets;
+    std::optional<SelectionMask> mask;
+    bool dateRange = false; // one of the sets is the base day, week or month
+};
+
+/**
+* @struct
+* @brief Run of consecutive dates of the date index (a month or a year) that a
+* partitioned query filters as a single task.
+*/
+struct DatePartition {
+    std::map<std::string, Postings>::const_iterator first;
+    std::map<std::string, Postings>::const_iterator last;
+    size_t rows = 0;
+};
+
 /**
 * @class
 * @brief Storage Handler class
@@ -24,41 +83,85 @@ using json = nlohmann::json;
 */
 class StorageHandler {
 private:
-    json transactions;
+    json transactions; // the transaction file, its date buckets moved to buckets
+    CopyOnWrite<DateBuckets> buckets; // shared with the other versions until written
     json wallets;
     std::string walletFile;
     std::string transactionFile; 
-    static std::string default_wallet;
+    std::string default_wallet; // of the loaded wallet file, copied with the snapshot
     IndexManager idxManager; 
+    bool isDataPending = false; // "data" was not parsed into transactions yet
+    std::shared_ptr<const std::string> pendingTransactionText; // transaction file contents, if already read
+    std::shared_ptr<LedgerLock> ledgerLock;     // shared by the copies of a handler
+    std::int64_t loadedGeneration = 0; // ledger generation the loaded data belongs to
+    std::shared_ptr<IdAllocator> idAllocator;   // shared by the copies of a handler
 
     void loadData();
-    json loadFile(const std::string& filePath);
-    int storeData();
-    int storeFile(const std::string& filePath, json& data);
+    void reload();
+    json loadTransactionFile(const std::string& filePath);
+    void ensureData();
+    int commitChange(const std::function<int()>& apply);
+    std::string dumpTransactions() const;
+    int appendTransaction(Transaction& transaction);
+    int writeTemporaryFile(const std::string& filePath, const std::string& text);
+    int writeCommitRecord(std::int64_t generation);
+    bool finishCommit();
+    SelectionMask filterColumns(const ViewQuery& query);
+    bool pushDownTerm(const ExprNode& term, std::unordered_set<TransactionId>& result);
+    void resolveFilters(const ViewQuery& query, CandidateFilters& filters);
+    int collectCandidates(const CandidateFilters& filters, std::vector<TransactionId>& ids);
+    bool isSelective(const CandidateFilters& filters) const;
+    bool matchesFilters(const CandidateFilters& filters, TransactionId id) const;
+    bool partitionDates(const CandidateFilters& filters, std::vector<DatePartition>& partitions);
+    void filterPartition(const DatePartition& partition, const CandidateFilters& filters, std::vector<TransactionId>& ids) const;
+    int retrievePartitioned(const ViewQuery& query, const CandidateFilters& filters,
+                            const std::vector<DatePartition>& partitions, TransactionGroups& result);
+    void selectTop(const ViewQuery& query, std::vector<TransactionId>& ids);
+    void orderRows(const ViewQuery& query, const std::vector<TransactionId>& ids, std::vector<size_t>& rows,
+                   std::vector<std::uint32_t>& order);
+    void sortAndGroup(const ViewQuery& query, const std::vector<TransactionId>& ids, TransactionGroups& result);
+    Generator<TransactionId> scanIds(std::string sortBy, bool descending);
+    Generator<TransactionId> filterIds(Generator<TransactionId> ids, const CandidateFilters& filters) const;
+    Generator<const Transaction*> projectRows(Generator<TransactionId> ids);
 public:
-    void populateIdIdx();
+    static const int PARTIAL_COMMIT = 1; // committed, but the files are completed on the next load
+
     void populateWalletIdx();
     void populateCategoryIdx();
     void populateDateHash();
     void populateDateMap();
+    void populateAmountIdx();
+    void populateTextIdx();
+    void populateColumns();
     StorageHandler(const std::string& walletFile, const std::string& transactionFile);
+    StorageHandler(const StorageHandler& other) = default; // next version of the same ledger
+    StorageHandler& operator=(const StorageHandler&) = delete;
+    void prepareSnapshot();
 
     static int setupWallets(const std::string& walletFile);
     static int setupTransactions(const std::string& transactionFile);
+    static json loadFile(const std::string& filePath);
     
-    int storeTransaction(Transaction& transaction);
-    int deleteTransaction(int id);
-
-    Transaction& getTransactionById(int id);
-    int getTransactionsByCategory(const std::string& category, std::unordered_set<int>& result);
-    int getTransactionsByWallet(const std::string& wallet, std::unordered_set<int>& result);
-    int retrieveDailyTransactions(const std::string& date, std::unordered_set<int> &result);
-    int retrieveWeeklyTransactions(const std::string& date, std::unordered_set<int> &result);
-    int retrieveMonthlyTransactions(const std::string& date, std::unordered_set<int> &result);
-
-    int retrieveTransactions(const std::string& base_date, int range, const std::string& wallet, 
-        const std::string& category, std::unordered_map<std::string, std::vector<Transaction>>& result,
-        const std::string& groupBy);
+    int getTagId(const std::string& tag, bool create);
+    std::vector<std::string> getTagNames();
+
+    int storeTransaction(Transaction& transaction, const std::vector<std::string>& tagNames = {});
+    int deleteTransaction(TransactionId id);
+
+    Transaction getTransactionById(TransactionId id);
+    int getTransactionsByCategory(const std::string& category, std::unordered_set<TransactionId>& result);
+    int getTransactionsByWallet(const std::string& wallet, std::unordered_set<TransactionId>& result);
+    int searchTransactions(const std::string& text, std::unordered_set<TransactionId>& result);
+    int getTransactionsByAmount(std::optional<int> minAmount, std::optional<int> maxAmount, std::unordered_set<TransactionId>& result);
+    int retrieveDailyTransactions(const std::string& date, std::unordered_set<TransactionId> &result);
+    int retrieveWeeklyTransactions(const std::string& date, std::unordered_set<TransactionId> &result);
+    int retrieveMonthlyTransactions(const std::string& date, std::unordered_set<TransactionId> &result);
+    int retrieveTransactionsBetween(const std::string& start, const std::string& end, std::unordered_set<TransactionId> &result);
+
+    int retrieveTransactions(const ViewQuery& query, TransactionGroups& result);
+    Generator<const Transaction*> streamTransactions(ViewQuery query);
+    int computeStats(const ViewQuery& query, bool income, bool rollup, std::map<std::string, AmountHistogram>& perCategory,
+        AmountHistogram& overall);
 
     float retrieveBalance(const std::string& wallet);
     int updateBalance(const std::string& wallet, int amount);
@@ -2,24 +2,27 @@
 #include "json.hpp"
 
 Transaction::Transaction(int amt, const std::string& cat, const std::string& desc, const std::string& wlt) 
-    : amount(amt), category(cat), description(desc), wallet(wlt) {
-        id = ++Transaction::currentID;
-    }
+    : id(0), amount(amt), category(cat), description(desc), wallet(wlt) {}
 
 Transaction::Transaction(const json& transactionObject) {
-    id = transactionObject.at("id").get<int>();
+    id = transactionObject.at("id").get<TransactionId>();
     amount = transactionObject.at("amount").get<int>();
     category = transactionObject.at("category").get<std::string>();
     description = transactionObject.at("description").get<std::string>();
     wallet = transactionObject.at("wallet").get<std::string>();
+    if (transactionObject.contains("tags"))
+        tags = transactionObject.at("tags").get<std::vector<int>>();
 }
 
 json Transaction::toJson() const {
-    return {
+    json transactionObject = {
         {"id", id},
         {"amount", amount},
         {"category", category},
         {"description", description},
         {"wallet", wallet}
     };
+    if (!tags.empty())
+        transactionObject["tags"] = tags;
+    return transactionObject;
 }
@@ -1,23 +1,33 @@
 #ifndef TRANSACTION_HPP
 #define TRANSACTION_HPP
 
+#include <cstdint>
 #include <string>
+#include <utility>
+#include <vector>
 #include "json.hpp"
 
 using json = nlohmann::json;
 
+// ids are handed out in blocks and never reused, so they need the headroom of 64 bits
+using TransactionId = std::int64_t;
+
 class Transaction {
 public:
-    static int currentID;
-    int id;
+    TransactionId id;
     int amount;
     std::string category;
     std::string description;
     std::string wallet;
     std::string date;
+    std::vector<int> tags; // ids into the tag list of the transaction file metadata
 
+    Transaction() : id(0), amount(0) {}
     Transaction(int amt, const std::string& cat, const std::string& desc, const std::string& wlt);
     Transaction(const json& transactionObject);
     json toJson() const;
 };
+
+// query results as (group key, transactions) pairs, in output order
+using TransactionGroups = std::vector<std::pair<std::string, std::vector<Transaction>>>;
 #endif
@@ -6,28 +6,58 @@
  */
 
 #include "utils.hpp"
+#include <cctype>
+#include <charconv>
 #include <chrono>
 #include <ctime>
+#include <stdexcept>
 
 /**
  * @brief Parses a date string into a 'std::chrono::year_month_day'.
  *
  * This function takes a date string in the format "YYYY-MM-DD" and converts it
- * into a 'std::chrono::year_month_day'. If the parsing fails, it throws a runtime error.
+ * into a 'std::chrono::year_month_day'. If the parsing fails or the date does not
+ * exist, it throws a runtime error.
  * 
  * @param dateString The date string to parse in "YYYY-MM-DD" format.
  * @return std::chrono::year_month_day of the provided date string.
  */
 std::chrono::year_month_day parseYMD(const std::string& dateString) {
-    std::istringstream ss(dateString);
-    std::chrono::year_month_day ymd;
-    ss >> std::chrono::parse("%Y-%m-%d", ymd);
-    if (ss.fail()) {
+    const char* first = dateString.data();
+    const char* last = first + dateString.size();
+    int year = 0;
+    unsigned month = 0, day = 0;
+
+    auto [yearEnd, yearErr] = std::from_chars(first, last, year);
+    if (yearErr != std::errc() || yearEnd == last || *yearEnd != '-')
+        throw std::runtime_error("Failed to parse date: " + dateString);
+    auto [monthEnd, monthErr] = std::from_chars(yearEnd + 1, last, month);
+    if (monthErr != std::errc() || monthEnd == last || *monthEnd != '-')
+        throw std::runtime_error("Failed to parse date: " + dateString);
+    auto [dayEnd, dayErr] = std::from_chars(monthEnd + 1, last, day);
+    if (dayErr != std::errc() || dayEnd != last)
+        throw std::runtime_error("Failed to parse date: " + dateString);
+
+    std::chrono::year_month_day ymd{std::chrono::year{year}, std::chrono::month{month}, std::chrono::day{day}};
+    if (!ymd.ok()) {
         throw std::runtime_error("Failed to parse date: " + dateString);
     }
     return ymd;
 }
 
+/**
+ * @brief Converts a "YYYY-MM-DD" date string into a day number (days since 1970-01-01).
+ *
+ * Day numbers are plain integers, so they can be used as sort keys and compared
+ * without going back to the string representation.
+ *
+ * @param dateString The date string to convert in "YYYY-MM-DD" format.
+ * @return int number of days since the unix epoch.
+ */
+int dayNumber(const std::string& dateString) {
+    return std::chrono::sys_days{parseYMD(dateString)}.time_since_epoch().count();
+}
+
 std::string formatYMD(const std::chrono::year_month_day& dateYMD) {
     std::ostringstream oss;
     oss << static_cast<int>(dateYMD.year()) << '-' 
@@ -36,6 +66,16 @@ std::string formatYMD(const std::chrono::year_month_day& dateYMD) {
     return oss.str();
 }
 
+/**
+ * @brief Formats a day number (days since 1970-01-01) as a "YYYY-MM-DD" string.
+ *
+ * @param day the day number
+ * @return std::string the formatted date
+ */
+std::string formatDayNumber(int day) {
+    return formatYMD(std::chrono::year_month_day{std::chrono::sys_days{std::chrono::days{day}}});
+}
+
 bool same_month(const std::chrono::year_month_day& d1, const std::chrono::year_month_day& d2) {
     return d1.year() == d2.year() && d1.month() == d2.month();
 }
@@ -70,3 +110,52 @@ void getWeek(const std::chrono::year_month_day& baseDate, std::chrono::year_mont
     firstDay = year_month_day(startOfWeek);
     lastDay = year_month_day(endOfWeek);
 }
+
+/**
+ * @brief Parses a weekday name ("mon", "Monday", ...) into its ISO number.
+ *
+ * @param weekday the weekday name, case-insensitive, at least 3 letters
+ * @return int 1 for Monday up to 7 for Sunday, 0 when the name is invalid
+ */
+int parseWeekday(const std::string& weekday) {
+    static const char* names[] = {"monday", "tuesday", "wednesday", "thursday", "friday", "saturday", "sunday"};
+    std::string lower;
+    for (char c : weekday)
+        lower.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+    if (lower.size() < 3)
+        return 0;
+    for (int i = 0; i < 7; i++) {
+        if (std::string(names[i]).compare(0, lower.size(), lower) == 0)
+            return i + 1;
+    }
+    return 0;
+}
+
+static thread_local std::ostream* threadOut = nullptr;
+static thread_local std::ostream* threadErr = nullptr;
+
+/**
+ * @brief The stream command output goes to: std::cout, unless the calling
+ * thread redirected it with a StreamRedirect.
+ */
+std::ostream& outStream() {
+    return threadOut ? *threadOut : std::cout;
+}
+
+/**
+ * @brief The stream command errors go to: std::cerr, unless the calling
+ * thread redirected it with a StreamRedirect.
+ */
+std::ostream& errStream() {
+    return threadErr ? *threadErr : std::cerr;
+}
+
+StreamRedirect::StreamRedirect(std::ostream& out, std::ostream& err) : oldOut(threadOut), oldErr(threadErr) {
+    threadOut = &out;
+    threadErr = &err;
+}
+
+StreamRedirect::~StreamRedirect() {
+    threadOut = oldOut;
+    threadErr = oldErr;
+}
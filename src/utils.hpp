@@ -21,11 +21,35 @@
 #include <string>
 
 std::chrono::year_month_day parseYMD(const std::string& dateString);
+int dayNumber(const std::string& dateString);
+std::string formatDayNumber(int day);
 std::string formatYMD(const std::chrono::year_month_day& dateYMD);
 std::string getCurrentDate();
 bool same_month(const std::chrono::year_month_day& d1, const std::chrono::year_month_day& d2);
+int parseWeekday(const std::string& weekday);
 void getWeek(const std::chrono::year_month_day& baseDate, std::chrono::year_month_day& firstDay, std::chrono::year_month_day& lastDay);
 
+std::ostream& outStream();
+std::ostream& errStream();
+
+/**
+* @class
+* @brief Sends what the calling thread writes to outStream() and errStream()
+* to the given streams for as long as it lives. Other threads are not
+* affected, so commands running side by side keep their output apart.
+*/
+class StreamRedirect {
+public:
+    StreamRedirect(std::ostream& out, std::ostream& err);
+    ~StreamRedirect();
+    StreamRedirect(const StreamRedirect&) = delete;
+    StreamRedirect& operator=(const StreamRedirect&) = delete;
+
+private:
+    std::ostream* oldOut;
+    std::ostream* oldErr;
+};
+
 enum daysByMonth {
     jan = 31,
     feb = 28, 
@@ -0,0 +1,96 @@
+/**
+ * @file versions.cpp
+ * @brief Checks that writing to a copy of a StorageHandler, as the server does
+ * for each new version of the ledger, leaves the version it was copied from
+ * unchanged, with the indexes read in place from the index segment
+ *
+ * Usage: munnybud_test_versions
+ * Exits with 0 when every check passes, 1 otherwise.
+ */
+
+#include "storage.hpp"
+#include "utils.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+
+/**
+ * @brief The ids and descriptions a query over the whole ledger returns,
+ * optionally limited to a search text.
+ */
+static std::set<std::string> viewAll(StorageHandler& storage, const std::string& search = "") {
+    ViewQuery query;
+    query.range = 0;
+    query.search = search;
+    TransactionGroups result;
+    storage.retrieveTransactions(query, result);
+    std::set<std::string> rows;
+    for (const auto& [key, transactions] : result) {
+        for (const Transaction& transaction : transactions)
+            rows.insert(std::to_string(transaction.id) + " " + transaction.description);
+    }
+    return rows;
+}
+
+int main() {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "munnybud_test_versions";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    const std::string walletFile = (dir / "wallets.json").string();
+    const std::string transactionFile = (dir / "transactions.json").string();
+    std::ofstream(walletFile) << "{\"default_wallet\": \"default\", \"wallets\": {\"default\": 0}}";
+    std::ofstream(transactionFile) << "{\"metadata\": {\"currentID\": 8}, \"data\": {"
+                                   << "\"2024-03-01\": [{\"id\": 7, \"amount\": -500, \"category\": \"food\", "
+                                   << "\"description\": \"market\", \"wallet\": \"default\"}], "
+                                   << "\"2024-03-02\": [{\"id\": 8, \"amount\": -1250, "
+                                   << "\"category\": \"rent\", \"description\": \"landlord\", \"wallet\": \"default\"}]}}";
+
+    std::ostringstream discarded;
+    StreamRedirect quiet(discarded, std::cerr);
+    int failures = 0;
+    auto check = [&failures](bool passed, const char* what) {
+        if (!passed) {
+            std::cerr << "FAIL: " << what << std::endl;
+            failures++;
+        }
+    };
+    try {
+        // the first load publishes the index segment, the handler under test attaches it
+        { StorageHandler publisher(walletFile, transactionFile); }
+        check(std::filesystem::exists(transactionFile + ".idx"), "no index segment was published");
+        StorageHandler original(walletFile, transactionFile);
+        const std::set<std::string> before = viewAll(original);
+        check(before == std::set<std::string>{"7 market", "8 landlord"}, "original does not see the ledger");
+        check(viewAll(original, "market").size() == 1, "original cannot search the ledger");
+
+        StorageHandler next(original);
+        Transaction added(-300, "food", "market stall", "default");
+        added.date = "2024-03-01";
+        check(next.storeTransaction(added) == 0, "store on the copy failed");
+        check(next.deleteTransaction(7) == 0, "delete on the copy failed");
+
+        check(viewAll(next) == std::set<std::string>{"8 landlord", std::to_string(added.id) + " market stall"},
+              "copy does not see its own writes");
+        check(viewAll(next, "market") == std::set<std::string>{std::to_string(added.id) + " market stall"},
+              "copy search does not see its own writes");
+        check(viewAll(original) == before, "writes to the copy changed the original");
+        check(viewAll(original, "market") == std::set<std::string>{"7 market"},
+              "writes to the copy changed the search of the original");
+
+        StorageHandler last(next);
+        check(last.deleteTransaction(8) == 0, "delete on the copy of the copy failed");
+        check(viewAll(next).count("8 landlord") == 1, "writes to the copy of the copy changed the copy");
+        check(viewAll(last) == std::set<std::string>{std::to_string(added.id) + " market stall"},
+              "copy of the copy does not see its own writes");
+    } catch (const std::exception& e) {
+        std::cerr << "FAIL: " << e.what() << std::endl;
+        failures++;
+    }
+
+    std::filesystem::remove_all(dir);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file views.cpp
+ * @brief Checks that 'view' finds transactions whose ids do not fit in 32 bits
+ * over every date range
+ *
+ * Usage: munnybud_test_views
+ * Exits with 0 when every check passes, 1 otherwise.
+ */
+
+#include "storage.hpp"
+#include "utils.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+
+/**
+ * @brief Id past INT32_MAX, which an int would turn into another id.
+ */
+static const TransactionId LARGE_ID = 5000000001;
+
+/**
+ * @brief Runs a query of the given range around 2024-03-02 and tells whether
+ * both transactions of the test ledger came back.
+ */
+static bool viewFindsLargeId(StorageHandler& storage, int range) {
+    ViewQuery query;
+    query.baseDate = "2024-03-02";
+    query.range = range;
+    TransactionGroups result;
+    storage.retrieveTransactions(query, result);
+    bool large = false;
+    bool small = false;
+    for (const auto& [key, transactions] : result) {
+        for (const Transaction& transaction : transactions) {
+            large |= transaction.id == LARGE_ID && transaction.description == "large id";
+            small |= transaction.id == 7 && transaction.description == "small id";
+        }
+    }
+    return large && small;
+}
+
+int main() {
+    static_assert(LARGE_ID > std::numeric_limits<std::int32_t>::max());
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "munnybud_test_views";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    const std::string walletFile = (dir / "wallets.json").string();
+    const std::string transactionFile = (dir / "transactions.json").string();
+    std::ofstream(walletFile) << "{\"default_wallet\": \"default\", \"wallets\": {\"default\": 0}}";
+    std::ofstream(transactionFile) << "{\"metadata\": {\"currentID\": " << LARGE_ID << "}, \"data\": {"
+                                   << "\"2024-03-01\": [{\"id\": 7, \"amount\": -500, \"category\": \"food\", "
+                                   << "\"description\": \"small id\", \"wallet\": \"default\"}], "
+                                   << "\"2024-03-02\": [{\"id\": " << LARGE_ID << ", \"amount\": -1250, "
+                                   << "\"category\": \"food\", \"description\": \"large id\", \"wallet\": \"default\"}]}}";
+
+    std::ostringstream discarded;
+    StreamRedirect quiet(discarded, std::cerr);
+    int failures = 0;
+    try {
+        StorageHandler storage(walletFile, transactionFile);
+        static const std::pair<int, const char*> ranges[] = {{0, "all"}, {2, "week"}, {3, "month"}};
+        for (const auto& [range, name] : ranges) {
+            if (!viewFindsLargeId(storage, range)) {
+                std::cerr << "FAIL: view over range " << name << " lost a transaction" << std::endl;
+                failures++;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "FAIL: " << e.what() << std::endl;
+        failures++;
+    }
+
+    std::filesystem::remove_all(dir);
+    return failures == 0 ? 0 : 1;
+}